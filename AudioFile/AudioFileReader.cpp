@@ -0,0 +1,595 @@
+//=======================================================================
+/** @file AudioFileReader.cpp
+ *
+ * This file is part of the 'AudioFile' library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+
+#include "AudioFileReader.h"
+
+#include <cstring>
+#include <cmath>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    //=============================================================
+    uint32_t readLittle (const uint8_t* p, int numBytes)
+    {
+        uint32_t value = 0;
+        for (int i = numBytes - 1; i >= 0; i--)
+            value = (value << 8) | p[i];
+        return value;
+    }
+
+    uint32_t readBig (const uint8_t* p, int numBytes)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < numBytes; i++)
+            value = (value << 8) | p[i];
+        return value;
+    }
+
+    bool idMatches (const uint8_t* p, const char* id)
+    {
+        return std::memcmp (p, id, 4) == 0;
+    }
+
+    //=============================================================
+    /** The 80-bit extended precision number AIFF stores the sample rate in */
+    double extendedToDouble (const uint8_t* p)
+    {
+        const int exponent = (int) (((p[0] & 0x7f) << 8) | p[1]) - 16383;
+        const uint64_t mantissa = ((uint64_t) readBig (p + 2, 4) << 32) | readBig (p + 6, 4);
+        const double value = std::ldexp ((double) mantissa, exponent - 63);
+        return (p[0] & 0x80) ? -value : value;
+    }
+
+    //=============================================================
+    template <class T>
+    T decodeSample (const uint8_t* p, int numBytes, bool bigEndian)
+    {
+        // the sample is shifted to the top of 32 bits, so every bit depth shares the scaling
+        uint32_t bits = bigEndian ? readBig (p, numBytes) : readLittle (p, numBytes);
+        bits <<= 8 * (4 - numBytes);
+        return (T) (int32_t) bits / (T) 2147483648.;
+    }
+
+    template <class T>
+    T decodeFloat (const uint8_t* p, int numBytes, bool bigEndian)
+    {
+        uint8_t bytes[8];
+        for (int i = 0; i < numBytes; i++)
+            bytes[i] = bigEndian ? p[numBytes - 1 - i] : p[i];
+
+        if (numBytes == 4)
+        {
+            float value;
+            std::memcpy (&value, bytes, 4);
+            return (T) value;
+        }
+        double value;
+        std::memcpy (&value, bytes, 8);
+        return (T) value;
+    }
+}
+
+//=============================================================
+AudioFileReader::AudioFileReader()
+    : fileData (nullptr), fileSize (0),
+#ifdef _WIN32
+      fileHandle (nullptr), mappingHandle (nullptr),
+#endif
+      audioFileFormat (AudioFileFormat::NotLoaded), encoding (Encoding::SignedLittle),
+      sampleRate (0), numChannels (0), bitDepth (0), numBytesPerSample (0),
+      numFrames (0), dataOffset (0), position (0)
+{
+}
+
+//=============================================================
+AudioFileReader::~AudioFileReader()
+{
+    close();
+}
+
+//=============================================================
+AudioFileReader::AudioFileReader (AudioFileReader&& other) noexcept
+    : AudioFileReader()
+{
+    *this = std::move (other);
+}
+
+//=============================================================
+AudioFileReader& AudioFileReader::operator= (AudioFileReader&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        fileData = other.fileData;
+        fileSize = other.fileSize;
+#ifdef _WIN32
+        fileHandle = other.fileHandle;
+        mappingHandle = other.mappingHandle;
+        other.fileHandle = nullptr;
+        other.mappingHandle = nullptr;
+#endif
+        audioFileFormat = other.audioFileFormat;
+        encoding = other.encoding;
+        sampleRate = other.sampleRate;
+        numChannels = other.numChannels;
+        bitDepth = other.bitDepth;
+        numBytesPerSample = other.numBytesPerSample;
+        numFrames = other.numFrames;
+        dataOffset = other.dataOffset;
+        position = other.position;
+
+        other.fileData = nullptr;
+        other.fileSize = 0;
+        other.close();
+    }
+    return *this;
+}
+
+//=============================================================
+bool AudioFileReader::open (std::string filePath)
+{
+    close();
+
+    if (! map (filePath))
+    {
+        std::cout << "ERROR: File doesn't exist or otherwise can't map file" << std::endl;
+        std::cout << filePath << std::endl;
+        return false;
+    }
+
+    bool parsed = false;
+    if (fileSize >= 12 && idMatches (fileData, "RIFF") && idMatches (fileData + 8, "WAVE"))
+    {
+        audioFileFormat = AudioFileFormat::Wave;
+        parsed = parseWaveHeader();
+    }
+    else if (fileSize >= 12 && idMatches (fileData, "FORM") && (idMatches (fileData + 8, "AIFF") || idMatches (fileData + 8, "AIFC")))
+    {
+        audioFileFormat = AudioFileFormat::Aiff;
+        parsed = parseAiffHeader();
+    }
+    else
+    {
+        std::cout << "Audio File Type: " << "Error" << std::endl;
+    }
+
+    if (! parsed || ! checkSampleFormat())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+//=============================================================
+void AudioFileReader::close()
+{
+    unmap();
+    audioFileFormat = AudioFileFormat::NotLoaded;
+    sampleRate = 0;
+    numChannels = 0;
+    bitDepth = 0;
+    numBytesPerSample = 0;
+    numFrames = 0;
+    dataOffset = 0;
+    position = 0;
+}
+
+//=============================================================
+bool AudioFileReader::isOpen() const
+{
+    return fileData != nullptr;
+}
+
+//=============================================================
+bool AudioFileReader::map (const std::string& filePath)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA (filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    const void* view = nullptr;
+    if (GetFileSizeEx (file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA (file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+        view = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (! view)
+    {
+        if (mapping)
+            CloseHandle (mapping);
+        CloseHandle (file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    fileData = static_cast<const uint8_t*> (view);
+    fileSize = (std::size_t) size.QuadPart;
+    return true;
+#else
+    const int file = ::open (filePath.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat status;
+    void* view = MAP_FAILED;
+    if (fstat (file, &status) == 0 && status.st_size > 0)
+        view = mmap (nullptr, (std::size_t) status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close (file); // the mapping keeps the file alive
+
+    if (view == MAP_FAILED)
+        return false;
+
+    fileData = static_cast<const uint8_t*> (view);
+    fileSize = (std::size_t) status.st_size;
+    return true;
+#endif
+}
+
+//=============================================================
+void AudioFileReader::unmap()
+{
+    if (! fileData)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile (fileData);
+    CloseHandle (mappingHandle);
+    CloseHandle (fileHandle);
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    munmap (const_cast<uint8_t*> (fileData), fileSize);
+#endif
+    fileData = nullptr;
+    fileSize = 0;
+}
+
+//=============================================================
+bool AudioFileReader::parseWaveHeader()
+{
+    bool foundFormat = false;
+    int audioFormat = 0;
+    int numBytesPerBlock = 0;
+
+    // walk the chunks instead of searching for their names, which may appear inside the data
+    std::size_t p = 12;
+    while (p + 8 <= fileSize)
+    {
+        const uint8_t* chunk = fileData + p;
+        const std::size_t chunkSize = readLittle (chunk + 4, 4);
+        const std::size_t available = fileSize - p - 8;
+
+        if (idMatches (chunk, "fmt ") && chunkSize >= 16 && available >= 16)
+        {
+            audioFormat = (int) readLittle (chunk + 8, 2);
+            numChannels = (int) readLittle (chunk + 10, 2);
+            sampleRate = readLittle (chunk + 12, 4);
+            numBytesPerBlock = (int) readLittle (chunk + 20, 2);
+            bitDepth = (int) readLittle (chunk + 22, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE keeps the real format in the first bytes of the sub format GUID
+            if (audioFormat == 0xfffe && chunkSize >= 40 && available >= 40)
+                audioFormat = (int) readLittle (chunk + 32, 2);
+            foundFormat = true;
+        }
+        else if (idMatches (chunk, "data"))
+        {
+            if (! foundFormat)
+                break;
+
+            dataOffset = p + 8;
+            // a writer which stopped abruptly may have left the size at 0 or pointing past the end
+            std::size_t dataSize = chunkSize;
+            if (dataSize == 0 || dataSize > available)
+                dataSize = available;
+
+            if (audioFormat != 1 && audioFormat != 3)
+            {
+                std::cout << "ERROR: this is a compressed .WAV file and this library does not support decoding them at present" << std::endl;
+                return false;
+            }
+            if (numChannels < 1 || numBytesPerBlock < numChannels || numBytesPerBlock % numChannels != 0)
+            {
+                std::cout << "ERROR: the header data in this WAV file seems to be inconsistent" << std::endl;
+                return false;
+            }
+
+            numBytesPerSample = numBytesPerBlock / numChannels;
+            encoding = audioFormat == 3 ? Encoding::FloatLittle : (numBytesPerSample == 1 ? Encoding::Unsigned8 : Encoding::SignedLittle);
+            numFrames = dataSize / (std::size_t) numBytesPerBlock;
+            return true;
+        }
+
+        p += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    std::cout << "ERROR: this doesn't seem to be a valid .WAV file" << std::endl;
+    return false;
+}
+
+//=============================================================
+bool AudioFileReader::parseAiffHeader()
+{
+    const bool isAifc = idMatches (fileData + 8, "AIFC");
+    bool foundComm = false;
+    uint32_t numFramesInHeader = 0;
+    bool littleEndian = false, floatingPoint = false;
+
+    std::size_t p = 12;
+    while (p + 8 <= fileSize)
+    {
+        const uint8_t* chunk = fileData + p;
+        const std::size_t chunkSize = readBig (chunk + 4, 4);
+        const std::size_t available = fileSize - p - 8;
+
+        if (idMatches (chunk, "COMM") && chunkSize >= 18 && available >= 18)
+        {
+            numChannels = (int) readBig (chunk + 8, 2);
+            numFramesInHeader = readBig (chunk + 10, 4);
+            bitDepth = (int) readBig (chunk + 14, 2);
+            const double rate = extendedToDouble (chunk + 16);
+            sampleRate = rate > 0. && rate < 4294967296. ? (uint32_t) std::lround (rate) : 0;
+
+            if (isAifc && chunkSize >= 22 && available >= 22)
+            {
+                const uint8_t* compression = chunk + 26;
+                if (idMatches (compression, "sowt"))
+                    littleEndian = true;
+                else if (idMatches (compression, "fl32") || idMatches (compression, "FL32") || idMatches (compression, "fl64"))
+                    floatingPoint = true;
+                else if (! idMatches (compression, "NONE"))
+                {
+                    std::cout << "ERROR: this is a compressed AIFF file and this library does not support decoding them at present" << std::endl;
+                    return false;
+                }
+            }
+            foundComm = true;
+        }
+        else if (idMatches (chunk, "SSND") && available >= 8)
+        {
+            if (! foundComm)
+                break;
+
+            const std::size_t offset = readBig (chunk + 8, 4);
+            std::size_t dataSize = std::min (chunkSize, available);
+            if (dataSize < 8 + offset)
+                break;
+            dataSize -= 8 + offset;
+            dataOffset = p + 16 + offset;
+
+            if (numChannels < 1)
+                break;
+            numBytesPerSample = (bitDepth + 7) / 8;
+            encoding = floatingPoint ? Encoding::FloatBig : (littleEndian ? Encoding::SignedLittle : Encoding::SignedBig);
+            numFrames = std::min<uint64_t> (numFramesInHeader, dataSize / ((std::size_t) numBytesPerSample * numChannels));
+            return true;
+        }
+
+        p += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    std::cout << "ERROR: this doesn't seem to be a valid AIFF file" << std::endl;
+    return false;
+}
+
+//=============================================================
+bool AudioFileReader::checkSampleFormat()
+{
+    const bool isFloat = encoding == Encoding::FloatLittle || encoding == Encoding::FloatBig;
+    if (isFloat ? (numBytesPerSample != 4 && numBytesPerSample != 8) : (numBytesPerSample < 1 || numBytesPerSample > 4))
+    {
+        std::cout << "ERROR: this file has a bit depth that is not supported" << std::endl;
+        return false;
+    }
+    if (sampleRate == 0)
+    {
+        std::cout << "ERROR: this file has an unsupported sample rate" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//=============================================================
+AudioFileFormat AudioFileReader::getFormat() const
+{
+    return audioFileFormat;
+}
+
+//=============================================================
+uint32_t AudioFileReader::getSampleRate() const
+{
+    return sampleRate;
+}
+
+//=============================================================
+int AudioFileReader::getNumChannels() const
+{
+    return numChannels;
+}
+
+//=============================================================
+int AudioFileReader::getBitDepth() const
+{
+    return bitDepth;
+}
+
+//=============================================================
+bool AudioFileReader::isFloatingPoint() const
+{
+    return encoding == Encoding::FloatLittle || encoding == Encoding::FloatBig;
+}
+
+//=============================================================
+uint64_t AudioFileReader::getNumFrames() const
+{
+    return numFrames;
+}
+
+//=============================================================
+double AudioFileReader::getLengthInSeconds() const
+{
+    return sampleRate ? (double) numFrames / (double) sampleRate : 0.;
+}
+
+//=============================================================
+const uint8_t* AudioFileReader::getRawData() const
+{
+    return fileData ? fileData + dataOffset : nullptr;
+}
+
+//=============================================================
+int AudioFileReader::getNumBytesPerFrame() const
+{
+    return numBytesPerSample * numChannels;
+}
+
+//=============================================================
+std::size_t AudioFileReader::framesAvailable (uint64_t startFrame, std::size_t numFrames) const
+{
+    if (! fileData || startFrame >= this->numFrames)
+        return 0;
+    return (std::size_t) std::min<uint64_t> (numFrames, this->numFrames - startFrame);
+}
+
+//=============================================================
+template <class T>
+void AudioFileReader::decode (const uint8_t* source, std::size_t numSamples, std::size_t sourceStride, T* destination) const
+{
+    // the encoding is checked once, the loops below do not branch on it
+    const int n = numBytesPerSample;
+    switch (encoding)
+    {
+        case Encoding::Unsigned8:
+            for (std::size_t i = 0; i < numSamples; i++)
+                destination[i] = (T) ((int) source[i * sourceStride] - 128) / (T) 128.;
+            break;
+
+        case Encoding::SignedLittle:
+            if (n == 2)
+            {
+                for (std::size_t i = 0; i < numSamples; i++)
+                    destination[i] = (T) (int16_t) readLittle (source + i * sourceStride, 2) / (T) 32768.;
+            }
+            else
+            {
+                for (std::size_t i = 0; i < numSamples; i++)
+                    destination[i] = decodeSample<T> (source + i * sourceStride, n, false);
+            }
+            break;
+
+        case Encoding::SignedBig:
+            for (std::size_t i = 0; i < numSamples; i++)
+                destination[i] = decodeSample<T> (source + i * sourceStride, n, true);
+            break;
+
+        case Encoding::FloatLittle:
+            for (std::size_t i = 0; i < numSamples; i++)
+                destination[i] = decodeFloat<T> (source + i * sourceStride, n, false);
+            break;
+
+        case Encoding::FloatBig:
+            for (std::size_t i = 0; i < numSamples; i++)
+                destination[i] = decodeFloat<T> (source + i * sourceStride, n, true);
+            break;
+    }
+}
+
+//=============================================================
+template <class T>
+std::size_t AudioFileReader::read (uint64_t startFrame, std::size_t numFrames, T* interleaved) const
+{
+    const std::size_t frames = framesAvailable (startFrame, numFrames);
+    const uint8_t* source = fileData + dataOffset + startFrame * (uint64_t) getNumBytesPerFrame();
+    decode (source, frames * (std::size_t) numChannels, (std::size_t) numBytesPerSample, interleaved);
+    return frames;
+}
+
+//=============================================================
+template <class T>
+std::size_t AudioFileReader::readChannels (uint64_t startFrame, std::size_t numFrames, T* const* channels) const
+{
+    const std::size_t frames = framesAvailable (startFrame, numFrames);
+    const uint8_t* source = fileData + dataOffset + startFrame * (uint64_t) getNumBytesPerFrame();
+    for (int channel = 0; channel < numChannels; channel++)
+        decode (source + channel * numBytesPerSample, frames, (std::size_t) getNumBytesPerFrame(), channels[channel]);
+    return frames;
+}
+
+//=============================================================
+template <class T>
+std::size_t AudioFileReader::readChannels (uint64_t startFrame, std::size_t numFrames, std::vector<std::vector<T>>& buffer) const
+{
+    const std::size_t frames = framesAvailable (startFrame, numFrames);
+    buffer.resize ((std::size_t) numChannels);
+    std::vector<T*> channels;
+    for (auto& channel : buffer)
+    {
+        channel.resize (frames);
+        channels.push_back (channel.data());
+    }
+    return readChannels (startFrame, frames, channels.data());
+}
+
+//=============================================================
+void AudioFileReader::seek (uint64_t frame)
+{
+    position = std::min (frame, numFrames);
+}
+
+//=============================================================
+uint64_t AudioFileReader::tell() const
+{
+    return position;
+}
+
+//=============================================================
+template <class T>
+std::size_t AudioFileReader::readNext (std::size_t numFrames, T* interleaved)
+{
+    const std::size_t frames = read (position, numFrames, interleaved);
+    position += frames;
+    return frames;
+}
+
+//===========================================================
+template std::size_t AudioFileReader::read<float> (uint64_t, std::size_t, float*) const;
+template std::size_t AudioFileReader::read<double> (uint64_t, std::size_t, double*) const;
+template std::size_t AudioFileReader::readChannels<float> (uint64_t, std::size_t, float* const*) const;
+template std::size_t AudioFileReader::readChannels<double> (uint64_t, std::size_t, double* const*) const;
+template std::size_t AudioFileReader::readChannels<float> (uint64_t, std::size_t, AudioFile<float>::AudioBuffer&) const;
+template std::size_t AudioFileReader::readChannels<double> (uint64_t, std::size_t, AudioFile<double>::AudioBuffer&) const;
+template std::size_t AudioFileReader::readNext<float> (std::size_t, float*);
+template std::size_t AudioFileReader::readNext<double> (std::size_t, double*);
@@ -0,0 +1,169 @@
+//=======================================================================
+/** @file AudioFileReader.h
+ *
+ * This file is part of the 'AudioFile' library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+
+#ifndef _AS_AudioFileReader_h
+#define _AS_AudioFileReader_h
+
+#include "AudioFile.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+//=============================================================
+/** Reads WAV and AIFF files through a memory mapping of the file. Opening only parses
+ * the headers; samples are decoded on request, for any range of frames, so a file of
+ * any size can be played or scanned without loading it. The pages of the file are
+ * read by the operating system when they are first touched.
+ *
+ * Supported: PCM WAV of 8, 16, 24 and 32 bits, IEEE float WAV of 32 and 64 bits,
+ * WAVE_FORMAT_EXTENSIBLE of those, AIFF of 8, 16, 24 and 32 bits, and AIFF-C
+ * with the NONE, sowt, fl32 and fl64 compression types. Any number of channels.
+ *
+ * A reader may be used from several threads at once, as long as it is not
+ * opened or closed meanwhile. The read position of readNext is not shared though.
+ */
+class AudioFileReader
+{
+public:
+
+    //=============================================================
+    AudioFileReader();
+    ~AudioFileReader();
+    AudioFileReader (AudioFileReader&& other) noexcept;
+    AudioFileReader& operator= (AudioFileReader&& other) noexcept;
+    AudioFileReader (const AudioFileReader&) = delete;
+    AudioFileReader& operator= (const AudioFileReader&) = delete;
+
+    //=============================================================
+    /** Maps a file and parses its headers.
+     * @Returns true if the file can be decoded
+     */
+    bool open (std::string filePath);
+
+    /** Unmaps the file, the reader can be opened again */
+    void close();
+
+    /** @Returns true if a file is open */
+    bool isOpen() const;
+
+    //=============================================================
+    /** @Returns Wave or Aiff for an open file, NotLoaded otherwise */
+    AudioFileFormat getFormat() const;
+
+    /** @Returns the sample rate */
+    uint32_t getSampleRate() const;
+
+    /** @Returns the number of channels */
+    int getNumChannels() const;
+
+    /** @Returns the bit depth of each sample */
+    int getBitDepth() const;
+
+    /** @Returns true if the samples are floating point numbers */
+    bool isFloatingPoint() const;
+
+    /** @Returns the number of frames, a frame holding one sample of every channel */
+    uint64_t getNumFrames() const;
+
+    /** @Returns the length in seconds */
+    double getLengthInSeconds() const;
+
+    //=============================================================
+    /** Decodes the frames [startFrame, startFrame + numFrames) into interleaved samples in [-1, 1).
+     * @Returns the number of frames decoded, less than numFrames at the end of the file
+     */
+    template <class T>
+    std::size_t read (uint64_t startFrame, std::size_t numFrames, T* interleaved) const;
+
+    /** Decodes the frames [startFrame, startFrame + numFrames) into one buffer per channel.
+     * @Returns the number of frames decoded, less than numFrames at the end of the file
+     */
+    template <class T>
+    std::size_t readChannels (uint64_t startFrame, std::size_t numFrames, T* const* channels) const;
+
+    /** Decodes into an AudioFile buffer, resized to the frames decoded */
+    template <class T>
+    std::size_t readChannels (uint64_t startFrame, std::size_t numFrames, std::vector<std::vector<T>>& buffer) const;
+
+    //=============================================================
+    /** Sets the frame readNext starts from */
+    void seek (uint64_t frame);
+
+    /** @Returns the frame readNext starts from */
+    uint64_t tell() const;
+
+    /** Decodes the next frames into interleaved samples and moves the read position past them.
+     * @Returns the number of frames decoded, 0 at the end of the file
+     */
+    template <class T>
+    std::size_t readNext (std::size_t numFrames, T* interleaved);
+
+    //=============================================================
+    /** @Returns the raw sample data inside the mapping, the frames are numBytesPerFrame apart */
+    const uint8_t* getRawData() const;
+
+    /** @Returns the number of bytes of one frame */
+    int getNumBytesPerFrame() const;
+
+private:
+
+    //=============================================================
+    enum class Encoding
+    {
+        SignedLittle,
+        SignedBig,
+        Unsigned8,
+        FloatLittle,
+        FloatBig
+    };
+
+    //=============================================================
+    bool map (const std::string& filePath);
+    void unmap();
+    bool parseWaveHeader();
+    bool parseAiffHeader();
+    bool checkSampleFormat();
+    std::size_t framesAvailable (uint64_t startFrame, std::size_t numFrames) const;
+
+    template <class T>
+    void decode (const uint8_t* source, std::size_t numSamples, std::size_t sourceStride, T* destination) const;
+
+    //=============================================================
+    const uint8_t* fileData;
+    std::size_t fileSize;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+
+    //=============================================================
+    AudioFileFormat audioFileFormat;
+    Encoding encoding;
+    uint32_t sampleRate;
+    int numChannels;
+    int bitDepth;
+    int numBytesPerSample;
+    uint64_t numFrames;
+    std::size_t dataOffset;
+    uint64_t position;
+};
+
+#endif /* AudioFileReader_h */
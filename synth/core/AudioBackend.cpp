@@ -0,0 +1,207 @@
+#include "AudioBackend.h"
+#include "utility.h"
+
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+
+namespace {
+    void ErrorCheck(const PaError& err)
+    {
+        if( err != paNoError )
+            throw std::runtime_error(std::string("PortAudio exception: ")+Pa_GetErrorText(err));
+    }
+}
+
+std::unique_ptr<AudioBackend> AudioBackend::create(const std::string& name, unsigned sampleRate, unsigned bufferSize, const std::string& path, uint64_t maxFrames)
+{
+	if (name == "portaudio") return std::make_unique<PortAudioBackend>(sampleRate, bufferSize);
+	if (name == "null") return std::make_unique<NullBackend>(sampleRate, bufferSize, maxFrames);
+	if (name == "freewheel") return std::make_unique<FreewheelBackend>(sampleRate, bufferSize, path, maxFrames);
+	throw std::invalid_argument("There is no audio backend called " + name + ".");
+}
+
+int PortAudioBackend::callbackFunction(
+    const void*                     inputBuffer,
+    void*                           outputBuffer,
+    unsigned long                   framesPerBuffer,
+    const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags           statusFlags,
+    void*                           userData)
+{
+	auto* backend = static_cast<PortAudioBackend*>(userData);
+	auto* in = static_cast<const float*>(inputBuffer);
+
+	// PortAudio may hand over bigger buffers than requested
+	if (backend->silence.size() < framesPerBuffer) {
+		backend->silence.resize(framesPerBuffer);
+	}
+
+	Status status;
+	if (timeInfo && timeInfo->outputBufferDacTime > 0. && timeInfo->currentTime > 0.) {
+		status.latency = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+	}
+	status.outputUnderflow = (statusFlags & paOutputUnderflow) != 0;
+	status.outputOverflow = (statusFlags & paOutputOverflow) != 0;
+	status.inputUnderflow = (statusFlags & paInputUnderflow) != 0;
+	status.inputOverflow = (statusFlags & paInputOverflow) != 0;
+	status.primingOutput = (statusFlags & paPrimingOutput) != 0;
+
+	backend->render(in ? in : backend->silence.data(), static_cast<float*>(outputBuffer), framesPerBuffer, status);
+	return 0;
+}
+
+PortAudioBackend::PortAudioBackend(unsigned sampleRate, unsigned bufferSize)
+	:silence(bufferSize)
+{
+	ErrorCheck(Pa_Initialize());
+	PaStreamParameters outputParameters, inputParameters;
+	outputParameters.device = Pa_GetDefaultOutputDevice();
+	if (outputParameters.device == paNoDevice) {
+		Pa_Terminate();
+		throw std::runtime_error("PortAudio error: No default output device.\n");
+	}
+	outputParameters.channelCount = 2;                    /* stereo output */
+	outputParameters.sampleFormat = paFloat32;
+	outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+	outputParameters.hostApiSpecificStreamInfo = NULL;
+
+	// Without a microphone the input is silence
+	inputParameters.device = Pa_GetDefaultInputDevice();
+	inputParameters.channelCount = 1;                     /* Mono input */
+	inputParameters.sampleFormat = paFloat32;
+	inputParameters.suggestedLatency = 0.01;
+	inputParameters.hostApiSpecificStreamInfo = NULL;
+
+	const PaError err = Pa_OpenStream( &stream,
+	                     inputParameters.device == paNoDevice ? nullptr : &inputParameters,
+	                     &outputParameters,
+	                     sampleRate,
+	                     bufferSize,               /* Frames per buffer. */
+	                     paNoFlag,         /* Automatically clip samples out of [-1, 1] */
+	                     callbackFunction,
+	                     this );
+	if (err != paNoError) {
+		Pa_Terminate();
+		ErrorCheck(err);
+	}
+}
+
+PortAudioBackend::~PortAudioBackend()
+{
+	if (running) {
+		Pa_StopStream(stream);
+	}
+	Pa_CloseStream(stream);
+	Pa_Terminate();
+}
+
+void PortAudioBackend::start(render_t render)
+{
+	this->render = render;
+	ErrorCheck(Pa_StartStream( stream ));
+	running = true;
+}
+
+void PortAudioBackend::stop()
+{
+	ErrorCheck(Pa_StopStream( stream ));
+	running = false;
+}
+
+NullBackend::NullBackend(unsigned sampleRate, unsigned bufferSize, uint64_t maxFrames)
+	:sampleRate(sampleRate), bufferSize(bufferSize), maxFrames(maxFrames)
+{
+	if (!sampleRate || !bufferSize) {
+		throw std::invalid_argument("The sample rate and the buffer size have to be positive.");
+	}
+}
+
+NullBackend::~NullBackend()
+{
+	stop();
+}
+
+void NullBackend::start(render_t render)
+{
+	if (running.exchange(true)) {
+		throw std::logic_error("The null audio backend is already running.");
+	}
+	clock = std::thread([this, render]() {
+		using clock_t = std::chrono::steady_clock;
+		const auto period = std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(double(bufferSize) / sampleRate));
+		std::vector<float> in(bufferSize), out(2 * bufferSize);
+		auto next = clock_t::now();
+		while (running && frames < maxFrames) {
+			Status status;
+			const auto now = clock_t::now();
+			if (now - next > period) {
+				status.outputUnderflow = true;
+				next = now;
+			}
+			const std::size_t n = std::size_t(std::min<uint64_t>(bufferSize, maxFrames - frames));
+			render(in.data(), out.data(), n, status);
+			frames += n;
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+		done = true;
+	});
+}
+
+void NullBackend::stop()
+{
+	running = false;
+	if (clock.joinable()) clock.join();
+}
+
+FreewheelBackend::FreewheelBackend(unsigned sampleRate, unsigned bufferSize, const std::string& path, uint64_t maxFrames)
+	:sampleRate(sampleRate), bufferSize(bufferSize), path(path), maxFrames(maxFrames)
+{
+	if (!sampleRate || !bufferSize) {
+		throw std::invalid_argument("The sample rate and the buffer size have to be positive.");
+	}
+}
+
+FreewheelBackend::~FreewheelBackend()
+{
+	stop();
+}
+
+void FreewheelBackend::start(render_t render)
+{
+	if (running || worker.joinable()) {
+		throw std::logic_error("The freewheel audio backend is already running.");
+	}
+	// The file is opened here, so an unwritable path throws on this thread
+	auto sink = path.empty() ? nullptr : std::make_shared<WavWriter>(path, sampleRate, 2, WavWriter::Format::Float32);
+	running = true;
+	worker = std::thread([this, render, sink]() {
+		std::vector<float> in(bufferSize), out(2 * bufferSize);
+		// Nobody waits for this thread, so it stops and logs, like the callbacks of a device
+		try {
+			while (running && frames < maxFrames) {
+				const std::size_t n = std::size_t(std::min<uint64_t>(bufferSize, maxFrames - frames));
+				if (sink && sink->remainingFrames() < n) {
+					throw std::length_error("The WAV file " + path + " is full after " + std::to_string(frames) + " frames.");
+				}
+				render(in.data(), out.data(), n, Status());
+				if (sink) sink->write(out.data(), n);
+				frames += n;
+			}
+			if (sink) sink->close();
+		}
+		catch (const std::exception& e) {
+			error = e.what();
+			log("Freewheel audio backend stopped: " + error);
+		}
+		running = false;
+		done = true;
+	});
+}
+
+void FreewheelBackend::stop()
+{
+	running = false;
+	if (worker.joinable()) worker.join();
+}
@@ -0,0 +1,113 @@
+#ifndef AUDIOBACKEND_H_INCLUDED
+#define AUDIOBACKEND_H_INCLUDED
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <portaudio.h>
+
+#include "WavWriter.h"
+
+// Where the blocks of a SynthStream are played. The backend calls render from its own thread
+// with blocks of interleaved stereo frames, and the mono input, which is silence without a device.
+class AudioBackend
+{
+public:
+	struct Status
+	{
+		double latency{ -1. }; // until the block reaches the DAC in seconds, negative if unknown
+		bool outputUnderflow{ false }, outputOverflow{ false }, inputUnderflow{ false }, inputOverflow{ false }, primingOutput{ false };
+	};
+	using render_t = std::function<void(const float* in, float* out, std::size_t frames, const Status& status)>;
+
+	virtual ~AudioBackend() = default;
+	virtual void start(render_t render) = 0;
+	virtual void stop() = 0;
+	// Backends which stop by themselves after a number of frames tell when they did, readable from any thread
+	virtual bool isDone() const { return false; }
+	// Once done, why the backend stopped before its last frame, empty if it did not
+	virtual std::string getError() const { return {}; }
+
+	// "portaudio", "null" or "freewheel", the freewheel backend writes to path.
+	// The null and freewheel backends stop after maxFrames.
+	static std::unique_ptr<AudioBackend> create(const std::string& name, unsigned sampleRate, unsigned bufferSize, const std::string& path = "", uint64_t maxFrames = UINT64_MAX);
+};
+
+// The default output device, and the default input device if there is one
+class PortAudioBackend final : public AudioBackend
+{
+public:
+	PortAudioBackend(unsigned sampleRate, unsigned bufferSize);
+	~PortAudioBackend();
+
+	virtual void start(render_t render) override;
+	virtual void stop() override;
+
+private:
+	static int callbackFunction(
+		const void*                     inputBuffer,
+		void*                           outputBuffer,
+		unsigned long                   framesPerBuffer,
+		const PaStreamCallbackTimeInfo* timeInfo,
+		PaStreamCallbackFlags           statusFlags,
+		void*                           userData);
+
+	render_t render;
+	std::vector<float> silence;
+	PaStream* stream{ nullptr };
+	bool running{ false };
+};
+
+// Renders a block every buffer period of a steady clock and drops it, like a device without speakers.
+// A block which is late by a whole period counts as an output underflow and the clock starts again.
+// It stops by itself after maxFrames.
+class NullBackend final : public AudioBackend
+{
+public:
+	NullBackend(unsigned sampleRate, unsigned bufferSize, uint64_t maxFrames = UINT64_MAX);
+	~NullBackend();
+
+	virtual void start(render_t render) override;
+	virtual void stop() override;
+	virtual bool isDone() const override { return done; }
+	// Rendered so far
+	uint64_t getFrames() const { return frames; }
+
+private:
+	unsigned sampleRate, bufferSize;
+	const uint64_t maxFrames;
+	std::atomic<bool> running{ false }, done{ false };
+	std::atomic<uint64_t> frames{ 0 };
+	std::thread clock;
+};
+
+// Renders blocks as fast as possible into a WAV file, without an empty path they are dropped.
+// It stops by itself after maxFrames, when the file is full or when rendering or writing throws,
+// which is logged and kept for getError.
+class FreewheelBackend final : public AudioBackend
+{
+public:
+	FreewheelBackend(unsigned sampleRate, unsigned bufferSize, const std::string& path, uint64_t maxFrames = UINT64_MAX);
+	~FreewheelBackend();
+
+	virtual void start(render_t render) override;
+	virtual void stop() override;
+	virtual bool isDone() const override { return done; }
+	virtual std::string getError() const override { return done ? error : std::string(); }
+	uint64_t getFrames() const { return frames; }
+
+private:
+	unsigned sampleRate, bufferSize;
+	std::string path;
+	const uint64_t maxFrames;
+	std::string error; // written by the worker before done
+	std::atomic<bool> running{ false }, done{ false };
+	std::atomic<uint64_t> frames{ 0 };
+	std::thread worker;
+};
+
+#endif //AUDIOBACKEND_H_INCLUDED
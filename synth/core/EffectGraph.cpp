@@ -0,0 +1,229 @@
+#include "EffectGraph.h"
+#include "RenderPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+EffectGraph::EffectGraph()
+{
+	nodes.push_back(std::make_unique<Node>());
+	nodes.back()->name = "Input";
+	sort();
+}
+
+EffectGraph::NodeId EffectGraph::addNode(const std::string& name, process_t process, const std::vector<NodeId>& inputs)
+{
+	if (!process) {
+		throw std::invalid_argument("The node " + name + " has nothing to process.");
+	}
+	for (const NodeId from : inputs) at(from);
+
+	auto node = std::make_unique<Node>();
+	node->name = name;
+	node->process = std::move(process);
+	node->inputs = inputs.empty() ? std::vector<NodeId>{ input } : inputs;
+	nodes.push_back(std::move(node));
+	sort();
+	return nodes.size() - 1;
+}
+
+EffectGraph::NodeId EffectGraph::append(const std::string& name, process_t process)
+{
+	const NodeId node = addNode(name, std::move(process), outputs);
+	setOutputs({ node });
+	return node;
+}
+
+void EffectGraph::connect(NodeId from, NodeId to)
+{
+	at(from);
+	auto& inputs = at(to).inputs;
+	if (to == input) {
+		throw std::invalid_argument("Nothing can be connected to the input.");
+	}
+	inputs.push_back(from);
+	try {
+		sort();
+	}
+	catch (...) {
+		inputs.pop_back();
+		sort();
+		throw;
+	}
+}
+
+void EffectGraph::setOutputs(const std::vector<NodeId>& outputs)
+{
+	if (outputs.empty()) {
+		throw std::invalid_argument("The graph needs an output.");
+	}
+	for (const NodeId node : outputs) at(node);
+	this->outputs = outputs;
+	sort();
+}
+
+void EffectGraph::setBypassed(NodeId node, bool bypassed)
+{
+	if (node == input) {
+		throw std::invalid_argument("The input cannot be bypassed.");
+	}
+	at(node).bypassed.store(bypassed);
+	changed.store(true, std::memory_order_release);
+}
+
+bool EffectGraph::isBypassed(NodeId node) const
+{
+	return at(node).bypassed.load();
+}
+
+const std::string& EffectGraph::getName(NodeId node) const
+{
+	return at(node).name;
+}
+
+EffectGraph::Node& EffectGraph::at(NodeId node)
+{
+	if (node >= nodes.size()) {
+		throw std::out_of_range("No node " + std::to_string(node) + " in the effect graph.");
+	}
+	return *nodes[node];
+}
+
+const EffectGraph::Node& EffectGraph::at(NodeId node) const
+{
+	return const_cast<EffectGraph*>(this)->at(node);
+}
+
+void EffectGraph::sort()
+{
+	// Kahn's algorithm
+	std::vector<std::size_t> missing(nodes.size());
+	std::vector<std::vector<NodeId>> consumers(nodes.size());
+	for (NodeId n = 0; n < nodes.size(); ++n) {
+		missing[n] = nodes[n]->inputs.size();
+		for (const NodeId from : nodes[n]->inputs)
+			consumers[from].push_back(n);
+	}
+	std::vector<NodeId> sorted{ input };
+	for (std::size_t i = 0; i < sorted.size(); ++i) {
+		for (const NodeId n : consumers[sorted[i]]) {
+			if (--missing[n] == 0) sorted.push_back(n);
+		}
+	}
+	if (sorted.size() != nodes.size()) {
+		throw std::logic_error("The effect graph would have a cycle.");
+	}
+	order.assign(sorted.begin() + 1, sorted.end());
+
+	// With every node bypassed each one is replaced by all of its sources, so there are the most of them
+	std::vector<std::size_t> bypassedSources(nodes.size(), 1);
+	std::size_t sourceCount = 0;
+	auto count = [&](const std::vector<NodeId>& inputs) {
+		std::size_t sum = 0;
+		for (const NodeId from : inputs) sum += bypassedSources[from];
+		return sum;
+	};
+	for (const NodeId n : order) {
+		bypassedSources[n] = count(nodes[n]->inputs);
+		sourceCount += bypassedSources[n];
+	}
+	sourceCount += count(outputs);
+
+	sources.clear();
+	sources.reserve(sourceCount);
+	scheduled.clear();
+	scheduled.reserve(nodes.size());
+	levelEnds.clear();
+	levelEnds.reserve(nodes.size());
+	changed.store(true);
+}
+
+void EffectGraph::resolve(const std::vector<NodeId>& inputs)
+{
+	for (const NodeId from : inputs) {
+		const Node& node = *nodes[from];
+		if (from == input || node.scheduled) {
+			sources.push_back(from);
+		}
+		else {
+			for (std::size_t i = node.sourceBegin; i < node.sourceEnd; ++i)
+				sources.push_back(sources[i]);
+		}
+	}
+}
+
+void EffectGraph::schedule()
+{
+	sources.clear();
+	scheduled.clear();
+	levelEnds.clear();
+	unsigned maxLevel = 0;
+	for (const NodeId n : order) {
+		Node& node = *nodes[n];
+		node.scheduled = false;
+		node.sourceBegin = sources.size();
+		resolve(node.inputs);
+		node.sourceEnd = sources.size();
+		if (node.bypassed.load()) continue;
+
+		node.scheduled = true;
+		node.level = 1;
+		for (std::size_t i = node.sourceBegin; i < node.sourceEnd; ++i)
+			node.level = std::max(node.level, nodes[sources[i]]->level + 1);
+		maxLevel = std::max(maxLevel, node.level);
+	}
+	outputBegin = sources.size();
+	resolve(outputs);
+
+	for (unsigned level = 1; level <= maxLevel; ++level) {
+		for (const NodeId n : order) {
+			if (nodes[n]->scheduled && nodes[n]->level == level) scheduled.push_back(n);
+		}
+		levelEnds.push_back(scheduled.size());
+	}
+}
+
+void EffectGraph::mix(float* out, std::size_t begin, std::size_t end, const float* in, std::size_t frames) const
+{
+	const std::size_t samples = 2 * frames;
+	for (std::size_t i = begin; i < end; ++i) {
+		const float* source = sources[i] == input ? in : nodes[sources[i]]->buffer.data();
+		if (i == begin) {
+			std::copy(source, source + samples, out);
+		}
+		else {
+			for (std::size_t j = 0; j < samples; ++j) out[j] += source[j];
+		}
+	}
+}
+
+void EffectGraph::process(float* inOut, std::size_t frames, uint64_t startFrame)
+{
+	if (changed.exchange(false, std::memory_order_acquire)) {
+		schedule();
+	}
+	const bool passThrough = sources.size() - outputBegin == 1 && sources[outputBegin] == input;
+	if (scheduled.empty() && passThrough) {
+		return;
+	}
+
+	for (const NodeId n : scheduled) {
+		auto& buffer = nodes[n]->buffer;
+		if (buffer.size() < 2 * frames) buffer.resize(2 * frames);
+	}
+	std::size_t levelBegin = 0;
+	for (const std::size_t levelEnd : levelEnds) {
+		RenderPool::instance().parallelFor(levelEnd - levelBegin, frames, [&](std::size_t i) {
+			Node& node = *nodes[scheduled[levelBegin + i]];
+			mix(node.buffer.data(), node.sourceBegin, node.sourceEnd, inOut, frames);
+			node.process(node.buffer.data(), frames, startFrame);
+		});
+		levelBegin = levelEnd;
+	}
+
+	if (!passThrough) {
+		if (outputBuffer.size() < 2 * frames) outputBuffer.resize(2 * frames);
+		mix(outputBuffer.data(), outputBegin, sources.size(), inOut, frames);
+		std::copy(outputBuffer.begin(), outputBuffer.begin() + 2 * frames, inOut);
+	}
+}
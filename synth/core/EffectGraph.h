@@ -0,0 +1,109 @@
+#ifndef EFFECTGRAPH_H_INCLUDED
+#define EFFECTGRAPH_H_INCLUDED
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Effects connected into a directed acyclic graph, processing whole blocks of interleaved
+// stereo frames in place. The input of a node is the sum of the outputs of its inputs,
+// node 0 is the dry signal handed to process.
+// The nodes are sorted when the graph is built. Nodes of the same depth do not depend on each
+// other and run in parallel on the RenderPool; their outputs are summed in a fixed order,
+// so the result does not depend on the number of threads.
+// A bypassed node is left out of the schedule and its inputs are passed on in its place.
+// The graph must not be changed while it is processed, bypassing works from any thread.
+class EffectGraph
+{
+public:
+	using NodeId = std::size_t;
+	// Processes frames interleaved stereo frames in place, starting at the given frame
+	using process_t = std::function<void(float*, std::size_t, uint64_t)>;
+	static constexpr NodeId input = 0;
+
+	EffectGraph();
+	EffectGraph(const EffectGraph&) = delete;
+	EffectGraph& operator=(const EffectGraph&) = delete;
+
+	// A node fed by the given nodes, or by the input if none are given
+	NodeId addNode(const std::string& name, process_t process, const std::vector<NodeId>& inputs = {});
+	// A node fed by the current output, it becomes the output of the graph
+	NodeId append(const std::string& name, process_t process);
+	void connect(NodeId from, NodeId to);
+	// The output of the graph is the sum of these nodes. It is the input until something is appended.
+	void setOutputs(const std::vector<NodeId>& outputs);
+
+	// Effects are processed by their processBlock. The toggle button of the effect bypasses the node.
+	template<class Effect>
+	NodeId addEffect(const std::string& name, Effect effect, const std::vector<NodeId>& inputs = {})
+	{
+		const NodeId node = addNode(name, [effect](float* block, std::size_t frames, uint64_t startFrame) {
+			effect.processBlock(block, frames, startFrame);
+		}, inputs);
+		hookToggle(node, effect);
+		return node;
+	}
+	template<class Effect>
+	NodeId appendEffect(const std::string& name, Effect effect)
+	{
+		const NodeId node = addEffect(name, effect, outputs);
+		setOutputs({ node });
+		return node;
+	}
+
+	void setBypassed(NodeId node, bool bypassed);
+	bool isBypassed(NodeId node) const;
+	const std::string& getName(NodeId node) const;
+	// Number of nodes besides the input
+	std::size_t size() const { return nodes.size() - 1; }
+
+	// Audio thread. Nothing is locked; the buffers only grow when a bigger block comes.
+	void process(float* inOut, std::size_t frames, uint64_t startFrame);
+
+private:
+	struct Node
+	{
+		std::string name;
+		process_t process;
+		std::vector<NodeId> inputs;
+		std::atomic<bool> bypassed{ false };
+		// Updated by the audio thread from here on
+		bool scheduled = false;
+		unsigned level = 0;               // 1 + the level of the deepest source, the input is 0
+		std::size_t sourceBegin = 0, sourceEnd = 0; // range in sources
+		std::vector<float> buffer;
+	};
+
+	template<class Effect>
+	void hookToggle(NodeId node, Effect& effect)
+	{
+		setBypassed(node, !effect.isActive());
+		effect.setOnToggle([this, node](bool on) { setBypassed(node, !on); });
+	}
+
+	Node& at(NodeId node);
+	const Node& at(NodeId node) const;
+	// Sorts the nodes and reserves everything the audio thread needs, throws if there is a cycle
+	void sort();
+	// Resolves bypassed nodes and orders the active ones by level, without allocating
+	void schedule();
+	// Appends the nodes feeding the given inputs to sources, replacing bypassed ones by their sources
+	void resolve(const std::vector<NodeId>& inputs);
+	void mix(float* out, std::size_t begin, std::size_t end, const float* in, std::size_t frames) const;
+
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::vector<NodeId> outputs{ input };
+	std::vector<NodeId> order;            // topological, without the input
+	std::vector<NodeId> scheduled;        // active nodes by level
+	std::vector<std::size_t> levelEnds;   // end of each level in scheduled
+	std::vector<NodeId> sources;          // resolved inputs of every node, then of the output
+	std::size_t outputBegin = 0;
+	std::vector<float> outputBuffer;
+	std::atomic<bool> changed{ true };
+};
+
+#endif //EFFECTGRAPH_H_INCLUDED
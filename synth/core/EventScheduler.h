@@ -0,0 +1,84 @@
+#ifndef EVENTSCHEDULER_H_INCLUDED
+#define EVENTSCHEDULER_H_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "MidiMessage.h"
+
+// Something to do on the audio thread at an exact frame: a MIDI message, played through the
+// MIDI callback of the stream, or a call of apply, which has to be safe on the audio thread.
+struct ScheduledEvent
+{
+	using apply_t = void (*)(void* target, uint32_t index, double value, uint64_t frame);
+
+	uint64_t frame{ 0 };
+	MidiMessage message;
+	apply_t apply{ nullptr };
+	void* target{ nullptr };
+	uint32_t index{ 0 };
+	double value{ 0. };
+};
+
+// The pending events of the audio thread, earliest first, events of the same frame in the order
+// they were pushed. A binary heap in a fixed array, so nothing is allocated while it is used.
+template<std::size_t Capacity>
+class EventScheduler
+{
+public:
+	// Returns false if the scheduler is full, the event is not added then
+	bool push(const ScheduledEvent& event)
+	{
+		if (count == Capacity)
+			return false;
+		std::size_t i = count++;
+		heap[i] = { event, pushed++ };
+		while (i > 0 && earlier(heap[i], heap[(i - 1) / 2])) {
+			std::swap(heap[i], heap[(i - 1) / 2]);
+			i = (i - 1) / 2;
+		}
+		return true;
+	}
+
+	const ScheduledEvent& top() const { return heap[0].event; }
+
+	void pop()
+	{
+		heap[0] = heap[--count];
+		for (std::size_t i = 0;;) {
+			const std::size_t left = 2 * i + 1, right = left + 1;
+			std::size_t first = i;
+			if (left < count && earlier(heap[left], heap[first])) first = left;
+			if (right < count && earlier(heap[right], heap[first])) first = right;
+			if (first == i)
+				break;
+			std::swap(heap[i], heap[first]);
+			i = first;
+		}
+	}
+
+	bool empty() const { return count == 0; }
+	bool full() const { return count == Capacity; }
+	std::size_t size() const { return count; }
+	static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+	struct Entry
+	{
+		ScheduledEvent event;
+		uint64_t order;
+	};
+
+	static bool earlier(const Entry& a, const Entry& b)
+	{
+		return a.event.frame != b.event.frame ? a.event.frame < b.event.frame : a.order < b.order;
+	}
+
+	std::array<Entry, Capacity> heap{};
+	std::size_t count{ 0 };
+	uint64_t pushed{ 0 };
+};
+
+#endif //EVENTSCHEDULER_H_INCLUDED
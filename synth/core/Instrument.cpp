@@ -19,6 +19,42 @@ std::shared_ptr<Window> Instrument::getGuiElement() const
 	return window; 
 }
 
+void Instrument::watchWindow(std::function<void()> onClose)
+{
+	// Hidden windows are not drawn
+	auto listener = std::make_shared<EmptyGuiElement>();
+	listener->setOnDraw([this]() { setOpen(true); });
+	window->addEmptyListener(listener);
+	window->setOnClose([this, onClose]() {
+		onClose();
+		setOpen(false);
+	});
+}
+
+void Instrument::setOpen(bool open)
+{
+	if (open == isOpen) return;
+	isOpen = open;
+	if (onOpen) onOpen(open);
+}
+
+bool Instrument::scheduleValue(ScheduledEvent::apply_t play, void* target, uint32_t index, double value)
+{
+	if (!stream) return false;
+	ScheduledEvent event;
+	event.frame = stream->getTransport().frameAt(Transport::now());
+	event.apply = play;
+	event.target = target;
+	event.index = index;
+	event.value = value;
+	return stream->schedule(event);
+}
+
+bool Instrument::scheduleKey(ScheduledEvent::apply_t play, void* target, unsigned key, SynthKey::State keyState)
+{
+	return scheduleValue(play, target, key, keyState == SynthKey::State::Pressed);
+}
+
 KeyboardInstrument::KeyboardInstrument(
 	const std::string& title,
 	const TimbreModel& timbreModel,
@@ -37,13 +73,16 @@ KeyboardInstrument::KeyboardInstrument(
 	gui->setChildAlignment(10);
 	gui->setCursor(10, 10);
 
-	keyboard.outputTo(
-		generator,
-		glider
-	);
+	keyboard.outputTo(*this);
+	pitchBender.setPitchSetter([this](double freq) { setMainPitch(freq); });
+
+	auto sliderPan = std::shared_ptr(Slider::DefaultSlider("Pan", -1, 1, pan));
+	auto sliderWidth = std::shared_ptr(Slider::DefaultSlider("Width", 0, 1, width));
 
 	gui->addChildAutoPos(pitchBender.getFrame());
 	gui->addChildAutoPos(glider.getFrame());
+	gui->addChildAutoPos(sliderPan);
+	gui->addChildAutoPos(sliderWidth);
 	gui->newLine();
 
 	auto inputConfigFrame = std::make_shared<Frame>(0,0);
@@ -51,16 +90,14 @@ KeyboardInstrument::KeyboardInstrument(
 
 	inputConfigFrame->addChildAutoPos(pitchBender.getConfigFrame());
 	inputConfigFrame->addChildAutoPos(glider.getConfigFrame());
+	inputConfigFrame->addChildAutoPos(sliderPan->getConfigFrame());
+	inputConfigFrame->addChildAutoPos(sliderWidth->getConfigFrame());
 
 	const auto& timbre = generator.getTimbreModel();
 	for (unsigned i = 0; i < timbre.components.size(); ++i) {
 		auto cFrame = std::make_shared<Frame>();
 		auto cSlider = std::shared_ptr(Slider::DefaultSlider("Component" + std::to_string(i), 0, 1, [this, i](const Slider& slider) {
-			std::lock_guard lock(generator);
-			for (std::size_t j = 0; j < generator.size(); ++j) {
-				auto& g = generator[j];
-				g[i].modifyIntensity(generator.time(), slider.getValue());
-			}
+			setComponentIntensity(i, slider.getValue());
 		}));
 		cSlider->setValue(timbre.components[i].intensity);
 		
@@ -77,11 +114,7 @@ KeyboardInstrument::KeyboardInstrument(
 				if (val == 0) {
 					throw std::runtime_error("0 is not allowed for this input");
 				}
-				std::lock_guard lock(generator);
-				for (std::size_t j = 0; j < generator.size(); ++j) {
-					auto& g = generator[j];
-					g[i].modifyMainPitch(generator.time(), g[0].getMainFreq() * val);
-				}
+				setComponentRatio(i, val);
 			}
 			catch (...) {
 				cValueInput->setTextCentered(std::to_string(timbre.components[i].relativeFreq));
@@ -97,7 +130,7 @@ KeyboardInstrument::KeyboardInstrument(
 		inputConfigFrame->addChildAutoPos(cSlider->getConfigFrame());
 	}
 
-	generator.addAfterCallback(glider);
+	generator.getInserts().appendEffect("Glider", glider);
 
 	auto kbAABB = keyboard.getSynthKeyboard()->AABB();
 	gui->newLine();
@@ -135,7 +168,7 @@ KeyboardInstrument::KeyboardInstrument(
 	gui->fitToChildren();
 	window->setSize(SynthVec2(gui->getSize()));
 	window->setMenuBar(menuHeight);
-	window->setOnClose([this]() {keyboard.stopAll(); generator.releaseKeys(); });
+	watchWindow([this]() {keyboard.stopAll(); generator.releaseKeys(); });
 	window->getMenuFrame()->addChildAutoPos(MenuOption::createMenu(
 		getConfig("defaultHeaderSize"), 15, {
 			"View", pos_t::Down, {
@@ -145,12 +178,139 @@ KeyboardInstrument::KeyboardInstrument(
 	));
 }
 
+KeyboardInstrument::KeyboardInstrument(const InstrumentPreset& preset, unsigned maxTones)
+	:KeyboardInstrument(preset.name, preset.timbre, preset.envelope, preset.notes(), maxTones)
+{}
+
+void KeyboardInstrument::onMidiKey(unsigned key, SynthKey::State keyState, uint64_t frame)
+{
+	if (key >= generator.getNotesCount())
+		return;
+	playKey(key, keyState, frame);
+	keyboard.getSynthKeyboard()->showMidiKey(key, keyState == SynthKey::State::Pressed);
+}
+
+void KeyboardInstrument::onKeyEvent(unsigned key, SynthKey::State keyState)
+{
+	const bool scheduled = scheduleKey([](void* target, uint32_t key, double pressed, uint64_t frame) {
+		static_cast<KeyboardInstrument*>(target)->playKey(key, pressed ? SynthKey::State::Pressed : SynthKey::State::Released, frame);
+	}, this, key, keyState);
+	if (!scheduled) {
+		generator.onKeyEvent(key, keyState);
+		glider.onKeyEvent(key, keyState);
+	}
+}
+
+void KeyboardInstrument::setMainPitch(double freq)
+{
+	const bool scheduled = scheduleValue([](void* target, uint32_t, double freq, uint64_t frame) {
+		static_cast<DynamicToneSum*>(target)->playMainPitch(freq, frame);
+	}, &generator, 0, freq);
+	if (!scheduled) {
+		generator.setMainPitch(freq);
+	}
+}
+
+void KeyboardInstrument::setComponentIntensity(unsigned component, double intensity)
+{
+	const bool scheduled = scheduleValue([](void* target, uint32_t component, double intensity, uint64_t frame) {
+		static_cast<DynamicToneSum*>(target)->playComponentIntensity(component, intensity, frame);
+	}, &generator, component, intensity);
+	if (!scheduled) {
+		generator.setComponentIntensity(component, intensity);
+	}
+}
+
+void KeyboardInstrument::setComponentRatio(unsigned component, double ratio)
+{
+	const bool scheduled = scheduleValue([](void* target, uint32_t component, double ratio, uint64_t frame) {
+		static_cast<DynamicToneSum*>(target)->playComponentRatio(component, ratio, frame);
+	}, &generator, component, ratio);
+	if (!scheduled) {
+		generator.setComponentRatio(component, ratio);
+	}
+}
+
+void KeyboardInstrument::playKey(unsigned key, SynthKey::State keyState, uint64_t frame)
+{
+	generator.playKeyEvent(key, keyState, frame);
+	glider.onKeyEvent(key, keyState);
+}
+
+void KeyboardInstrument::onMidiControl(const MidiMessage& message, uint64_t frame)
+{
+	if (message.status() == 0xE0 && message.size == 3) {
+		// 14 bits, 0x2000 is the middle
+		const int value = message.bytes[1] + (message.bytes[2] << 7);
+		pitchBender.onPitchWheel(std::clamp((value - 0x2000) / 8191., -1., 1.), frame);
+	}
+}
+
+SamplerInstrument::SamplerInstrument(
+	const std::string& title,
+	const std::vector<Sampler::Zone>& zones,
+	const ADSREnvelope& env,
+	unsigned firstKey,
+	unsigned keyCount,
+	unsigned maxVoices,
+	double preloadTime
+)
+	:Instrument(title),
+	generator{ zones, env, firstKey, keyCount, maxVoices, preloadTime },
+	keyboard{ keyCount },
+	statsText{ TextDisplay::DefaultText(zones.empty() ? "No samples" : std::to_string(zones.size()) + " samples", 20) }
+{
+	auto gui = window->getContentFrame();
+	gui->setChildAlignment(10);
+	gui->setCursor(10, 10);
+
+	keyboard.outputTo(*this);
+
+	gui->addChildAutoPos(std::shared_ptr(Slider::DefaultSlider("Pan", -1, 1, pan)));
+	gui->addChildAutoPos(std::shared_ptr(Slider::DefaultSlider("Width", 0, 1, width)));
+	gui->addChildAutoPos(statsText);
+
+	auto kbAABB = keyboard.getSynthKeyboard()->AABB();
+	gui->newLine();
+	gui->addChild(keyboard.getSynthKeyboard(), 0, wHeight - kbAABB.height);
+	gui->fitToChildren();
+	window->setSize(SynthVec2(gui->getSize()));
+	watchWindow([this]() {keyboard.stopAll(); generator.releaseKeys(); });
+}
+
+void SamplerInstrument::onKeyEvent(unsigned key, SynthKey::State keyState)
+{
+	const bool scheduled = scheduleKey([](void* target, uint32_t key, double pressed, uint64_t frame) {
+		static_cast<Sampler*>(target)->playKeyEvent(key, pressed ? SynthKey::State::Pressed : SynthKey::State::Released, frame);
+	}, &generator, key, keyState);
+	if (!scheduled) {
+		generator.onKeyEvent(key, keyState);
+	}
+
+	const auto stats = generator.getStats();
+	statsText->setText(
+		"Cache hits: " + std::to_string(stats.cacheHits) + "\n" +
+		"Underruns: " + std::to_string(stats.underruns) + "\n" +
+		"Memory: " + std::to_string(stats.memory >> 10) + " KiB"
+	);
+}
+
+void SamplerInstrument::onMidiKey(unsigned key, SynthKey::State keyState, uint64_t frame)
+{
+	if (key >= generator.getKeyCount())
+		return;
+	generator.playKeyEvent(key, keyState, frame);
+	keyboard.getSynthKeyboard()->showMidiKey(key, keyState == SynthKey::State::Pressed);
+}
+
 InputInstrument::InputInstrument(const std::string& title)
 	:Instrument(title)
 {
 	auto gui = window->getContentFrame();
 	gui->addChildAutoPos(button);
-	window->setSize(SynthVec2(300, 50));
+	gui->addChildAutoPos(std::shared_ptr(Slider::DefaultSlider("Pan", -1, 1, pan)));
+	gui->fitToChildren();
+	window->setSize(SynthVec2(gui->getSize()));
 }
 
 InputInstrument::GeneratorProxy& InputInstrument::getGenerator()
@@ -163,12 +323,35 @@ void InputInstrument::GeneratorProxy::feedSample(const double& sample)
 	this->sample = sample;
 }
 
+void InputInstrument::GeneratorProxy::feedBlock(const float* in, std::size_t frames, uint64_t startFrame, float gain)
+{
+	blockStart = startFrame;
+	block.resize(frames);
+	for (std::size_t i = 0; i < frames; ++i)
+		block[i] = in[i] * gain;
+	if (frames) sample = block.back();
+}
+
 double InputInstrument::GeneratorProxy::getSampleImpl(double t) const
 {
 	return sample;
 }
 
+void InputInstrument::GeneratorProxy::renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame) const
+{
+	// The stream renders the fed block in pieces between its events, frames outside of it are silent
+	const std::size_t offset = startFrame < blockStart ? block.size() : std::size_t(std::min<uint64_t>(startFrame - blockStart, block.size()));
+	const std::size_t n = std::min(frames, block.size() - offset);
+	std::copy(block.begin() + offset, block.begin() + offset + n, out);
+	std::fill(out + n, out + frames, 0.f);
+}
+
 void InputInstrument::operator()(const double& sample)
 {
 	generator.feedSample(sample * isOn);
+}
+
+void InputInstrument::operator()(const float* in, std::size_t frames, uint64_t startFrame)
+{
+	generator.feedBlock(in, frames, startFrame, float(isOn));
 }
\ No newline at end of file
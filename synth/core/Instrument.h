@@ -9,6 +9,7 @@
 #include "tones.h"
 #include "effects.h"
 #include "SynthStream.h"
+#include "Sampler.h"
 
 class Instrument
 {
@@ -17,11 +18,35 @@ public:
 
 	const std::string& getTitle() const;
 	std::shared_ptr<Window> getGuiElement() const;
+	Panning getPanning() const { return { pan, width }; }
+	// Called by the MidiRouter on the audio thread, instruments which use controllers hide it
+	void onMidiControl(const MidiMessage& message, uint64_t frame) {}
+	// Key events of the GUI are then played at the frame they happened, one block later like MIDI,
+	// instead of at the start of the next block
+	void scheduleOn(SynthStream& stream) { this->stream = &stream; }
+	// Called on the GUI thread when the window is opened or closed, MIDI is played while it is open
+	void setOnOpen(std::function<void(bool open)> callback) { onOpen = std::move(callback); }
 
 protected:
+	// Follows the window for setOnOpen, onClose is called first when it is closed
+	void watchWindow(std::function<void()> onClose);
+
+	// Has play called with the index and value on the audio thread, at the frame of now.
+	// Returns false without a stream or if its queue is full.
+	bool scheduleValue(ScheduledEvent::apply_t play, void* target, uint32_t index, double value);
+	bool scheduleKey(ScheduledEvent::apply_t play, void* target, unsigned key, SynthKey::State keyState);
+
 	std::string title;
+	SynthStream* stream{ nullptr };
+	std::atomic<double> pan{ 0. }, width{ 0. };
 	const unsigned wWidth{ 1000 }, wHeight{ 600 }, menuHeight{ getConfig("defaultHeaderSize") };
 	std::shared_ptr<Window> window;
+
+private:
+	void setOpen(bool open);
+
+	bool isOpen{ false };
+	std::function<void(bool open)> onOpen;
 };
 
 class KeyboardInstrument : public Instrument
@@ -34,10 +59,23 @@ public:
 		const std::vector<Note>& notes,
 		unsigned maxTones
 	);
+	KeyboardInstrument(const InstrumentPreset& preset, unsigned maxTones);
 
 	DynamicToneSum& getGenerator() { return generator; }
+	// The MIDI note of key 0 and the targets of the MidiRouter
+	unsigned getFirstMidiKey() const { return 48; }
+	void onMidiKey(unsigned key, SynthKey::State keyState, uint64_t frame);
+	void onMidiControl(const MidiMessage& message, uint64_t frame);
+	void onKeyEvent(unsigned key, SynthKey::State keyState);
 
 private:
+	// Scheduled like the keys, straight to the generator without a stream
+	void setMainPitch(double freq);
+	void setComponentIntensity(unsigned component, double intensity);
+	void setComponentRatio(unsigned component, double ratio);
+	// Audio thread
+	void playKey(unsigned key, SynthKey::State keyState, uint64_t frame);
+
 	DynamicToneSum generator;
 	KeyboardOutput keyboard;
 	PitchBender<DynamicToneSum> pitchBender;
@@ -45,6 +83,32 @@ private:
 
 };
 
+// Plays multisamples from disk, see Sampler
+class SamplerInstrument : public Instrument
+{
+public:
+	SamplerInstrument(
+		const std::string& title,
+		const std::vector<Sampler::Zone>& zones,
+		const ADSREnvelope& env,
+		unsigned firstKey,
+		unsigned keyCount,
+		unsigned maxVoices,
+		double preloadTime
+	);
+
+	Sampler& getGenerator() { return generator; }
+	// Shows the streaming counters as of the last key event
+	void onKeyEvent(unsigned key, SynthKey::State keyState);
+	unsigned getFirstMidiKey() const { return generator.getFirstKey(); }
+	void onMidiKey(unsigned key, SynthKey::State keyState, uint64_t frame);
+
+private:
+	Sampler generator;
+	KeyboardOutput keyboard;
+	std::shared_ptr<TextDisplay> statsText;
+};
+
 class InputInstrument : public Instrument
 {
 public:
@@ -52,16 +116,21 @@ public:
 	{
 	public:
 		void feedSample(const double& sample);
+		void feedBlock(const float* in, std::size_t frames, uint64_t startFrame, float gain);
 		double getSampleImpl(double t) const;
+		void renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame) const;
 
 	protected:
 		double sample;
+		std::vector<float> block;
+		uint64_t blockStart = 0;
 	};
 
 	InputInstrument(const std::string& title);
 
 	GeneratorProxy& getGenerator();
 	void operator() (const double& sample);
+	void operator() (const float* in, std::size_t frames, uint64_t startFrame);
 
 private:
 	GeneratorProxy generator;
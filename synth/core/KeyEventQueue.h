@@ -0,0 +1,89 @@
+#ifndef KEYEVENTQUEUE_H_INCLUDED
+#define KEYEVENTQUEUE_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "SpscQueue.h"
+
+// Key events from one thread to the audio thread, in order through a queue. While the queue is
+// full, only the last state of every key is kept until the audio thread has caught up, so the
+// final press or release of a key is never lost; only repeats in between are merged.
+template<std::size_t Capacity>
+class KeyEventQueue
+{
+public:
+	explicit KeyEventQueue(std::size_t keyCount)
+		:keyCount(keyCount), latest(std::make_unique<std::atomic<uint8_t>[]>(keyCount))
+	{
+		for (std::size_t k = 0; k < keyCount; ++k)
+			latest[k].store(none, std::memory_order_relaxed);
+	}
+
+	// Producer
+	void push(unsigned key, bool pressed)
+	{
+		send({ key, pressed ? press : release });
+	}
+
+	// Producer. Merged into a release of every key when the queue is full.
+	void releaseAll()
+	{
+		send({ 0, all });
+	}
+
+	// Audio thread. Calls onKey(key, pressed) and onReleaseAll() in the order of the events.
+	template<class OnKey, class OnReleaseAll>
+	void apply(OnKey onKey, OnReleaseAll onReleaseAll)
+	{
+		Event event;
+		while (queue.pop(event)) {
+			if (event.type == all) onReleaseAll();
+			else onKey(event.key, event.type == press);
+		}
+		// The producer only uses the queue again once this has seen its last merged state
+		if (overflow.exchange(false, std::memory_order_acq_rel)) {
+			for (std::size_t k = 0; k < keyCount; ++k) {
+				const uint8_t type = latest[k].exchange(none, std::memory_order_relaxed);
+				if (type != none) onKey(unsigned(k), type == press);
+			}
+		}
+	}
+
+	// Events which were merged into a later one of the same key
+	uint64_t getMerged() const { return merged.load(std::memory_order_relaxed); }
+
+private:
+	enum : uint8_t { none, press, release, all };
+
+	struct Event
+	{
+		unsigned key;
+		uint8_t type;
+	};
+
+	void send(const Event& event)
+	{
+		if (!overflow.load(std::memory_order_acquire) && queue.push(event))
+			return;
+		if (event.type == all) {
+			for (std::size_t k = 0; k < keyCount; ++k)
+				latest[k].store(release, std::memory_order_relaxed);
+		}
+		else if (event.key < keyCount) {
+			latest[event.key].store(event.type, std::memory_order_relaxed);
+		}
+		merged.store(merged.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		overflow.store(true, std::memory_order_release);
+	}
+
+	SpscQueue<Event, Capacity> queue;
+	const std::size_t keyCount;
+	std::unique_ptr<std::atomic<uint8_t>[]> latest;
+	std::atomic<bool> overflow{ false };
+	std::atomic<uint64_t> merged{ 0 };
+};
+
+#endif //KEYEVENTQUEUE_H_INCLUDED
@@ -0,0 +1,29 @@
+#ifndef MIDIMESSAGE_H_INCLUDED
+#define MIDIMESSAGE_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+
+#include "SpscQueue.h"
+
+// A channel message of at most 3 bytes, small enough to be passed between threads by value.
+// The time is when it arrived, in nanoseconds of std::chrono::steady_clock.
+struct MidiMessage
+{
+	int64_t time{ 0 };
+	uint8_t size{ 0 };
+	std::array<uint8_t, 3> bytes{};
+
+	uint8_t status() const { return bytes[0] & 0xF0; }
+	uint8_t channel() const { return bytes[0] & 0x0F; }
+	uint8_t key() const { return bytes[1] & 0x7F; }
+	uint8_t velocity() const { return bytes[2] & 0x7F; }
+	// A note-on with velocity 0 is a note-off
+	bool isNoteOn() const { return size == 3 && status() == 0x90 && velocity() > 0; }
+	bool isNoteOff() const { return size == 3 && (status() == 0x80 || (status() == 0x90 && velocity() == 0)); }
+};
+
+// From the MIDI input thread to the audio thread
+using MidiQueue = SpscQueue<MidiMessage, 1024>;
+
+#endif //MIDIMESSAGE_H_INCLUDED
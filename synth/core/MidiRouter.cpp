@@ -0,0 +1,121 @@
+#include "MidiRouter.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+unsigned MidiRouter::addTarget(const std::string& name, keyCallback_t onKey, controlCallback_t onControl, const Route& route)
+{
+	if (targetCount == maxTargets) {
+		throw std::length_error("A MIDI router has at most " + std::to_string(maxTargets) + " targets.");
+	}
+	const unsigned id = targetCount;
+	targets[id] = { name, onKey, onControl, {} };
+	try {
+		++targetCount;
+		setRoute(id, route);
+	}
+	catch (...) {
+		targets[--targetCount] = {};
+		throw;
+	}
+	return id;
+}
+
+void MidiRouter::setRoute(unsigned target, const Route& route)
+{
+	if (route.channel > omni || route.lowNote > route.highNote || route.highNote >= noteCount) {
+		throw std::invalid_argument("Invalid MIDI route for " + getName(target) + ".");
+	}
+	at(target);
+	targets[target].route = route;
+	publish();
+}
+
+void MidiRouter::setEnabled(unsigned target, bool enabled)
+{
+	at(target);
+	auto& route = targets[target].route;
+	if (route.enabled == enabled) return;
+	route.enabled = enabled;
+	publish();
+}
+
+const MidiRouter::Route& MidiRouter::getRoute(unsigned target) const
+{
+	return at(target).route;
+}
+
+const std::string& MidiRouter::getName(unsigned target) const
+{
+	return at(target).name;
+}
+
+unsigned MidiRouter::getTargetCount() const
+{
+	return targetCount;
+}
+
+const MidiRouter::Target& MidiRouter::at(unsigned target) const
+{
+	if (target >= targetCount) {
+		throw std::out_of_range("There is no MIDI target " + std::to_string(target) + ".");
+	}
+	return targets[target];
+}
+
+void MidiRouter::publish()
+{
+	auto& next = table.back();
+	next = Table();
+	for (unsigned t = 0; t < targetCount; ++t) {
+		const auto& route = targets[t].route;
+		if (!route.enabled) continue;
+		const unsigned first = route.channel == omni ? 0 : route.channel;
+		const unsigned last = route.channel == omni ? channelCount - 1 : route.channel;
+		for (unsigned channel = first; channel <= last; ++channel) {
+			auto& controls = next.controls[channel];
+			if (targets[t].onControl && controls.count < maxLayers) {
+				controls.targets[controls.count++] = uint8_t(t);
+			}
+			for (unsigned note = std::max(route.lowNote, route.firstNote); note <= route.highNote; ++note) {
+				auto& layers = next.notes[channel][note];
+				if (layers.count == maxLayers) continue;
+				layers.targets[layers.count] = uint8_t(t);
+				layers.keys[layers.count] = uint8_t(note - route.firstNote);
+				++layers.count;
+			}
+		}
+	}
+	table.publish();
+}
+
+void MidiRouter::dispatch(const MidiMessage& message, uint64_t frame)
+{
+	table.update();
+	const auto& routes = table.front();
+	const uint8_t channel = message.channel();
+
+	if (message.isNoteOn()) {
+		const auto& layers = routes.notes[channel][message.key()];
+		auto& playing = sounding[channel][message.key()];
+		// A repeated note-on replaces the layers of the previous one, which are released first
+		for (uint8_t i = 0; i < playing.count; ++i) {
+			if (std::find(layers.targets.begin(), layers.targets.begin() + layers.count, playing.targets[i]) == layers.targets.begin() + layers.count)
+				targets[playing.targets[i]].onKey(playing.keys[i], SynthKey::State::Released, frame);
+		}
+		playing = layers;
+		for (uint8_t i = 0; i < layers.count; ++i)
+			targets[layers.targets[i]].onKey(layers.keys[i], SynthKey::State::Pressed, frame);
+	}
+	else if (message.isNoteOff()) {
+		auto& playing = sounding[channel][message.key()];
+		for (uint8_t i = 0; i < playing.count; ++i)
+			targets[playing.targets[i]].onKey(playing.keys[i], SynthKey::State::Released, frame);
+		playing.count = 0;
+	}
+	else if (message.size > 0 && message.status() >= 0xA0 && message.status() < 0xF0) {
+		const auto& controls = routes.controls[channel];
+		for (uint8_t i = 0; i < controls.count; ++i)
+			targets[controls.targets[i]].onControl(message, frame);
+	}
+}
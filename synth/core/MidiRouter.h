@@ -0,0 +1,84 @@
+#ifndef MIDIROUTER_H_INCLUDED
+#define MIDIROUTER_H_INCLUDED
+
+#include <functional>
+#include <string>
+#include <array>
+#include <cstdint>
+
+#include "MidiMessage.h"
+#include "TripleBuffer.h"
+#include "../gui/SynthKeyboard.h"
+
+// Sends the MIDI messages of the audio thread straight to the instruments.
+// Every target listens to one channel and a range of notes, targets with overlapping ranges
+// on a channel are layers, neighbouring ones are splits. The routes are edited on the GUI thread,
+// which rebuilds a table of every channel and note and hands it over through a triple buffer,
+// so a message costs a lookup, no matter how many instruments there are.
+class MidiRouter
+{
+public:
+	static constexpr unsigned channelCount = 16, noteCount = 128;
+	static constexpr unsigned maxTargets = 64, maxLayers = 4; // more layers on a note are dropped
+
+	// Called on the audio thread between blocks, from the given frame on
+	using keyCallback_t = std::function<void(unsigned key, SynthKey::State keyState, uint64_t frame)>;
+	// Controllers, pitch wheel and pressure of the channel
+	using controlCallback_t = std::function<void(const MidiMessage& message, uint64_t frame)>;
+
+	// The channel of a route which listens to every channel
+	static constexpr uint8_t omni = channelCount;
+
+	struct Route
+	{
+		uint8_t channel{ omni };
+		uint8_t lowNote{ 0 }, highNote{ 127 };
+		uint8_t firstNote{ 48 }; // the note of key 0 of the target, lower notes are ignored
+		bool enabled{ true };
+	};
+
+	// GUI thread
+	unsigned addTarget(const std::string& name, keyCallback_t onKey, controlCallback_t onControl, const Route& route);
+	void setRoute(unsigned target, const Route& route);
+	// A disabled target gets no new notes, those it plays are still released
+	void setEnabled(unsigned target, bool enabled);
+	const Route& getRoute(unsigned target) const;
+	const std::string& getName(unsigned target) const;
+	unsigned getTargetCount() const;
+
+	// Audio thread. A note-off goes where its note-on went, even if the routes changed since.
+	void dispatch(const MidiMessage& message, uint64_t frame);
+
+private:
+	struct Layers
+	{
+		uint8_t count{ 0 };
+		std::array<uint8_t, maxLayers> targets{}, keys{};
+	};
+
+	struct Table
+	{
+		std::array<std::array<Layers, noteCount>, channelCount> notes;
+		std::array<Layers, channelCount> controls; // keys unused
+	};
+
+	struct Target
+	{
+		std::string name;
+		keyCallback_t onKey;
+		controlCallback_t onControl;
+		Route route;
+	};
+
+	// Throws for targets which were not added
+	const Target& at(unsigned target) const;
+	void publish();
+
+	// Allocated up front, the audio thread only reaches a new target through the next table
+	std::array<Target, maxTargets> targets;
+	unsigned targetCount{ 0 };
+	TripleBuffer<Table> table;
+	std::array<std::array<Layers, noteCount>, channelCount> sounding; // audio thread only
+};
+
+#endif //MIDIROUTER_H_INCLUDED
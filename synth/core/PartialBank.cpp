@@ -0,0 +1,198 @@
+#include "PartialBank.h"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define PARTIALBANK_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PARTIALBANK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define PARTIALBANK_NEON
+#endif
+
+namespace
+{
+	// Every instruction set is wrapped into the same interface, the kernel is written once.
+	// Phases are never negative, so truncation can be used as floor.
+
+	struct ScalarOps
+	{
+		using vec = float;
+		static constexpr std::size_t width = 1;
+		static vec set1(float x) { return x; }
+		static vec lanes() { return 0.f; }
+		static vec load(const float* p) { return *p; }
+		static void store(float* p, vec x) { *p = x; }
+		static vec add(vec a, vec b) { return a + b; }
+		static vec sub(vec a, vec b) { return a - b; }
+		static vec mul(vec a, vec b) { return a * b; }
+		static vec min(vec a, vec b) { return a < b ? a : b; }
+		static vec abs(vec a) { return std::abs(a); }
+		static vec copySign(vec magnitude, vec sign) { return std::copysign(magnitude, sign); }
+		static vec frac(vec a) { return a - float(int(a)); }
+	};
+
+#if defined(PARTIALBANK_AVX2)
+	struct SimdOps
+	{
+		using vec = __m256;
+		static constexpr std::size_t width = 8;
+		static vec set1(float x) { return _mm256_set1_ps(x); }
+		static vec lanes() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+		static vec load(const float* p) { return _mm256_loadu_ps(p); }
+		static void store(float* p, vec x) { _mm256_storeu_ps(p, x); }
+		static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+		static vec sub(vec a, vec b) { return _mm256_sub_ps(a, b); }
+		static vec mul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+		static vec min(vec a, vec b) { return _mm256_min_ps(a, b); }
+		static vec abs(vec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+		static vec copySign(vec magnitude, vec sign)
+		{
+			const vec mask = _mm256_set1_ps(-0.f);
+			return _mm256_or_ps(_mm256_andnot_ps(mask, magnitude), _mm256_and_ps(mask, sign));
+		}
+		static vec frac(vec a) { return _mm256_sub_ps(a, _mm256_floor_ps(a)); }
+	};
+#elif defined(PARTIALBANK_SSE2)
+	struct SimdOps
+	{
+		using vec = __m128;
+		static constexpr std::size_t width = 4;
+		static vec set1(float x) { return _mm_set1_ps(x); }
+		static vec lanes() { return _mm_setr_ps(0, 1, 2, 3); }
+		static vec load(const float* p) { return _mm_loadu_ps(p); }
+		static void store(float* p, vec x) { _mm_storeu_ps(p, x); }
+		static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+		static vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+		static vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+		static vec min(vec a, vec b) { return _mm_min_ps(a, b); }
+		static vec abs(vec a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+		static vec copySign(vec magnitude, vec sign)
+		{
+			const vec mask = _mm_set1_ps(-0.f);
+			return _mm_or_ps(_mm_andnot_ps(mask, magnitude), _mm_and_ps(mask, sign));
+		}
+		static vec frac(vec a) { return _mm_sub_ps(a, _mm_cvtepi32_ps(_mm_cvttps_epi32(a))); }
+	};
+#elif defined(PARTIALBANK_NEON)
+	struct SimdOps
+	{
+		using vec = float32x4_t;
+		static constexpr std::size_t width = 4;
+		static vec set1(float x) { return vdupq_n_f32(x); }
+		static vec lanes() { const float l[] = { 0, 1, 2, 3 }; return vld1q_f32(l); }
+		static vec load(const float* p) { return vld1q_f32(p); }
+		static void store(float* p, vec x) { vst1q_f32(p, x); }
+		static vec add(vec a, vec b) { return vaddq_f32(a, b); }
+		static vec sub(vec a, vec b) { return vsubq_f32(a, b); }
+		static vec mul(vec a, vec b) { return vmulq_f32(a, b); }
+		static vec min(vec a, vec b) { return vminq_f32(a, b); }
+		static vec abs(vec a) { return vabsq_f32(a); }
+		static vec copySign(vec magnitude, vec sign)
+		{
+			const uint32x4_t mask = vdupq_n_u32(0x80000000u);
+			return vbslq_f32(mask, sign, vabsq_f32(magnitude));
+		}
+		static vec frac(vec a) { return vsubq_f32(a, vcvtq_f32_s32(vcvtq_s32_f32(a))); }
+	};
+#else
+	using SimdOps = ScalarOps;
+#endif
+
+	// sin(2*pi*phase) for phase in [0, 1): the phase is folded into [-1/4, 1/4]
+	// and a Taylor polynomial is evaluated (error < 1e-7)
+	template<class Ops>
+	typename Ops::vec sine(typename Ops::vec phase)
+	{
+		using vec = typename Ops::vec;
+		const vec half = Ops::set1(.5f);
+		const vec x = Ops::sub(phase, half); // sin(2*pi*phase) = -sin(2*pi*x)
+		const vec z = Ops::copySign(Ops::min(Ops::abs(x), Ops::sub(half, Ops::abs(x))), x);
+		const vec a = Ops::mul(z, Ops::set1(6.28318530718f));
+		const vec a2 = Ops::mul(a, a);
+		vec poly = Ops::set1(-1.f / 39916800);
+		poly = Ops::add(Ops::mul(poly, a2), Ops::set1(1.f / 362880));
+		poly = Ops::add(Ops::mul(poly, a2), Ops::set1(-1.f / 5040));
+		poly = Ops::add(Ops::mul(poly, a2), Ops::set1(1.f / 120));
+		poly = Ops::add(Ops::mul(poly, a2), Ops::set1(-1.f / 6));
+		poly = Ops::add(Ops::mul(poly, a2), Ops::set1(1.f));
+		return Ops::sub(Ops::set1(0.f), Ops::mul(poly, a));
+	}
+
+	// Adds one partial to the block, Ops::width samples at a time.
+	// Returns how many samples were rendered.
+	template<class Ops>
+	std::size_t addPartial(float* out, std::size_t frames, float& phase, float increment, float& amp, float ampStep)
+	{
+		using vec = typename Ops::vec;
+		constexpr std::size_t width = Ops::width;
+		const vec phaseOffsets = Ops::mul(Ops::lanes(), Ops::set1(increment));
+		const vec ampOffsets = Ops::mul(Ops::add(Ops::lanes(), Ops::set1(1.f)), Ops::set1(ampStep));
+
+		std::size_t i = 0;
+		for (; i + width <= frames; i += width) {
+			const vec p = Ops::frac(Ops::add(Ops::set1(phase), phaseOffsets));
+			const vec a = Ops::add(Ops::set1(amp), ampOffsets);
+			Ops::store(out + i, Ops::add(Ops::load(out + i), Ops::mul(sine<Ops>(p), a)));
+			phase += width * increment;
+			phase -= float(int(phase));
+			amp += width * ampStep;
+		}
+		return i;
+	}
+}
+
+PartialBank::PartialBank(std::size_t capacity)
+{
+	phase.reserve(capacity);
+	increment.reserve(capacity);
+	amplitude.reserve(capacity);
+	targetAmplitude.reserve(capacity);
+}
+
+void PartialBank::clear()
+{
+	phase.clear();
+	increment.clear();
+	amplitude.clear();
+	targetAmplitude.clear();
+}
+
+bool PartialBank::add(double p, double inc, double amp, double target)
+{
+	if (inc >= .5 || (amp == 0. && target == 0.))
+		return false;
+	phase.push_back(float(p));
+	increment.push_back(float(inc));
+	amplitude.push_back(float(amp));
+	targetAmplitude.push_back(float(target));
+	return true;
+}
+
+void PartialBank::render(float* out, std::size_t frames) const
+{
+	if (frames == 0)
+		return;
+	for (std::size_t k = 0; k < phase.size(); ++k) {
+		float p = phase[k], amp = amplitude[k];
+		const float step = (targetAmplitude[k] - amplitude[k]) / frames;
+		const std::size_t done = addPartial<SimdOps>(out, frames, p, increment[k], amp, step);
+		addPartial<ScalarOps>(out + done, frames - done, p, increment[k], amp, step);
+	}
+}
+
+const char* PartialBank::instructionSet()
+{
+#if defined(PARTIALBANK_AVX2)
+	return "AVX2";
+#elif defined(PARTIALBANK_SSE2)
+	return "SSE2";
+#elif defined(PARTIALBANK_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef PARTIALBANK_H_INCLUDED
+#define PARTIALBANK_H_INCLUDED
+
+#include <vector>
+#include <cstddef>
+
+// Structure-of-arrays bank of sine partials, rendered with SIMD over a whole block.
+// Phases and increments are normalized (cycles and cycles per sample),
+// the amplitudes ramp linearly from amplitude to targetAmplitude during the block.
+class PartialBank
+{
+public:
+	// Reserves room for capacity partials, adding more allocates
+	explicit PartialBank(std::size_t capacity = 0);
+
+	void clear();
+	// Partials above the Nyquist frequency or without amplitude are culled; returns whether it was added
+	bool add(double phase, double increment, double amplitude, double targetAmplitude);
+	std::size_t size() const { return phase.size(); }
+
+	// Adds every partial to out[0..frames)
+	void render(float* out, std::size_t frames) const;
+
+	static const char* instructionSet();
+
+private:
+	std::vector<float> phase, increment, amplitude, targetAmplitude;
+};
+
+#endif //PARTIALBANK_H_INCLUDED
@@ -0,0 +1,164 @@
+#include "RenderPool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define RENDERPOOL_PAUSE() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+	#define RENDERPOOL_PAUSE() __asm__ __volatile__("yield")
+#else
+	#define RENDERPOOL_PAUSE()
+#endif
+
+namespace
+{
+	// Waits for another thread without a system call: the pauses double every round,
+	// the time slice is given up only after that, when the other thread is likely descheduled
+	class Backoff
+	{
+	public:
+		void wait()
+		{
+			if (rounds < maxRounds) {
+				for (unsigned i = 0; i < 1u << rounds; ++i) RENDERPOOL_PAUSE();
+				++rounds;
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		void reset() { rounds = 0; }
+
+	private:
+		static constexpr unsigned maxRounds = 7;
+		unsigned rounds = 0;
+	};
+}
+
+RenderPool& RenderPool::instance()
+{
+	static RenderPool pool;
+	return pool;
+}
+
+RenderPool::~RenderPool()
+{
+	stopWorkers();
+}
+
+void RenderPool::setThreadCount(unsigned count)
+{
+	stopWorkers();
+	stopping = false;
+	for (unsigned i = 0; i < count; ++i)
+		workers.emplace_back([this]() { workerLoop(); });
+}
+
+unsigned RenderPool::getThreadCount() const
+{
+	return unsigned(workers.size());
+}
+
+void RenderPool::stopWorkers()
+{
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (auto& worker : workers) worker.join();
+	workers.clear();
+}
+
+bool RenderPool::run(std::size_t count, void(*function)(void*, std::size_t), void* context)
+{
+	Job* job = nullptr;
+	for (auto& slot : jobs) {
+		int expected = Free;
+		if (slot.state.compare_exchange_strong(expected, SettingUp)) {
+			job = &slot;
+			break;
+		}
+	}
+	if (!job) return false;
+
+	job->function = function;
+	job->context = context;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+	job->state = Running;
+	++runningJobs;
+
+	// The audio thread never waits for the mutex: if it is taken, a worker is just
+	// going to sleep and misses this job, which is then done by the others
+	if (sleepingWorkers.load()) {
+		std::unique_lock lock(sleepMutex, std::try_to_lock);
+		if (lock) wakeUp.notify_all();
+	}
+
+	while (runTask(*job)) {}
+	// Tasks taken by other threads may still be running, other jobs are helped meanwhile
+	Backoff backoff;
+	while (job->done.load() < count) {
+		if (runAnyTask()) backoff.reset();
+		else backoff.wait();
+	}
+
+	// Threads which are still looking at the job have to leave before the slot can be reused,
+	// they do not run any of its tasks any more, so this takes a few instructions at most
+	--runningJobs;
+	job->state = SettingUp;
+	for (backoff.reset(); job->users.load(); ) backoff.wait();
+	job->state = Free;
+	return true;
+}
+
+bool RenderPool::runTask(Job& job)
+{
+	++job.users;
+	bool ran = false;
+	if (job.state.load() == Running) {
+		const std::size_t i = job.next++;
+		if (i < job.count) {
+			job.function(job.context, i);
+			++job.done;
+			ran = true;
+		}
+	}
+	--job.users;
+	return ran;
+}
+
+bool RenderPool::runAnyTask()
+{
+	for (auto& job : jobs) {
+		if (job.state.load() == Running && runTask(job))
+			return true;
+	}
+	return false;
+}
+
+void RenderPool::workerLoop()
+{
+	// Spinning for a while after the last task keeps the wake-up latency low within a block
+	const unsigned spinCount = 4000;
+	unsigned idle = 0;
+	Backoff backoff;
+	while (!stopping) {
+		if (runAnyTask()) {
+			idle = 0;
+			backoff.reset();
+		}
+		else if (++idle < spinCount) {
+			backoff.wait();
+		}
+		else {
+			std::unique_lock lock(sleepMutex);
+			++sleepingWorkers;
+			wakeUp.wait(lock, [this]() { return stopping || runningJobs.load(); });
+			--sleepingWorkers;
+			idle = 0;
+			backoff.reset();
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef RENDERPOOL_H_INCLUDED
+#define RENDERPOOL_H_INCLUDED
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+// Worker threads sharing the rendering of a block with the audio thread.
+// A job is a set of independent tasks; each task writes its own output, so summing the
+// outputs in task order afterwards gives the same result with any number of threads.
+// Idle threads take tasks from any running job, including jobs started by other tasks,
+// and the thread which started a job keeps working on it (or on other jobs) until it is done.
+// Nothing is allocated and no lock is waited for while a job runs.
+class RenderPool
+{
+public:
+	static RenderPool& instance();
+	~RenderPool();
+
+	// 0 renders everything on the calling thread. Must not be called while rendering.
+	void setThreadCount(unsigned workers);
+	unsigned getThreadCount() const;
+
+	// Calls task(i) for every i in [0, count), in parallel if the job is big enough.
+	// framesPerTask is a hint of the size of a task.
+	template<class Task>
+	void parallelFor(std::size_t count, std::size_t framesPerTask, Task&& task)
+	{
+		auto trampoline = [](void* context, std::size_t i) { (*static_cast<Task*>(context))(i); };
+		if (workers.empty() || count < 2 || count * framesPerTask < minFramesPerJob || !run(count, trampoline, &task)) {
+			for (std::size_t i = 0; i < count; ++i) task(i);
+		}
+	}
+
+private:
+	// Smaller jobs are not worth waking up the workers
+	static constexpr std::size_t minFramesPerJob = 256;
+
+	struct Job
+	{
+		std::atomic<int> state{ 0 }; // JobState
+		std::atomic<int> users{ 0 }; // threads currently looking at the job
+		void(*function)(void*, std::size_t) = nullptr;
+		void* context = nullptr;
+		std::size_t count = 0;
+		std::atomic<std::size_t> next{ 0 }, done{ 0 };
+	};
+	enum JobState { Free, SettingUp, Running }; // SettingUp is also used while a job is being closed
+
+	RenderPool() = default;
+	// Returns false if every job slot is taken, the job is not run then
+	bool run(std::size_t count, void(*function)(void*, std::size_t), void* context);
+	// Runs one task of the job, returns false if it had no task left
+	bool runTask(Job& job);
+	// Runs one task of any job
+	bool runAnyTask();
+	void workerLoop();
+	void stopWorkers();
+
+	std::array<Job, 16> jobs;
+	std::vector<std::thread> workers;
+	std::atomic<bool> stopping{ false };
+	std::atomic<unsigned> runningJobs{ 0 }, sleepingWorkers{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+};
+
+#endif //RENDERPOOL_H_INCLUDED
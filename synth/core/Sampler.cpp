@@ -0,0 +1,369 @@
+#include "Sampler.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+
+namespace
+{
+	// Frames decoded by the prefetch thread before the voice may use them
+	constexpr std::size_t chunkFrames = 4096;
+
+	// Decodes to interleaved stereo, mono is played on both sides and only the first two channels of more
+	std::size_t readStereo(const AudioFileReader& file, uint64_t startFrame, std::size_t frames, float* out, std::vector<float>& decoded)
+	{
+		const std::size_t channels = file.getNumChannels();
+		decoded.resize(frames * channels);
+		const std::size_t n = file.read(startFrame, frames, decoded.data());
+		const std::size_t right = channels > 1 ? 1 : 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			out[2 * i] = decoded[i * channels];
+			out[2 * i + 1] = decoded[i * channels + right];
+		}
+		return n;
+	}
+}
+
+Sampler::Sampler(
+	const std::vector<Zone>& zones,
+	const ADSREnvelope& env,
+	unsigned firstKey,
+	unsigned keyCount,
+	unsigned maxVoices,
+	double preloadTime
+)
+	:zoneOfKey(keyCount, -1),
+	firstKey(firstKey),
+	keyEvents(keyCount)
+{
+	if (!keyCount || !maxVoices) {
+		throw std::invalid_argument("A sampler needs keys and voices.");
+	}
+
+	std::vector<float> decoded;
+	std::size_t longestHead = 0;
+	samples.reserve(zones.size());
+	for (const auto& zone : zones) {
+		Sample sample;
+		if (!sample.file.open(zone.path)) {
+			throw std::runtime_error("Unable to read " + zone.path + ".");
+		}
+		sample.frames = sample.file.getNumFrames();
+		sample.rootKey = zone.rootKey;
+		const auto headFrames = std::size_t(std::min<uint64_t>(sample.frames, uint64_t(std::ceil(preloadTime * sample.file.getSampleRate()))));
+		sample.head.resize(2 * headFrames);
+		readStereo(sample.file, 0, headFrames, sample.head.data(), decoded);
+		longestHead = std::max(longestHead, headFrames);
+		memory += sample.head.size() * sizeof(float);
+
+		for (unsigned key = std::max(zone.lowKey, firstKey); key <= zone.highKey && key - firstKey < keyCount; ++key) {
+			if (zoneOfKey[key - firstKey] < 0) zoneOfKey[key - firstKey] = int(samples.size());
+		}
+		samples.push_back(std::move(sample));
+	}
+
+	// The ring holds four heads, so two octaves up it lasts as long as a head at the root key
+	ringFrames = chunkFrames;
+	while (ringFrames < 4 * longestHead) ringFrames *= 2;
+	voices.assign(maxVoices, Voice{ env });
+	streams = std::make_unique<Stream[]>(maxVoices);
+	for (unsigned v = 0; v < maxVoices; ++v)
+		streams[v].ring.resize(2 * ringFrames);
+	memory += maxVoices * 2 * ringFrames * sizeof(float);
+
+	prefetcher = std::thread(&Sampler::prefetchLoop, this);
+}
+
+Sampler::~Sampler()
+{
+	{
+		std::lock_guard<std::mutex> lock(prefetchMutex);
+		running = false;
+	}
+	prefetchWake.notify_one();
+	if (prefetcher.joinable()) {
+		prefetcher.join();
+	}
+}
+
+std::vector<Sampler::Zone> Sampler::scanDirectory(const std::string& directory)
+{
+	namespace fs = std::filesystem;
+	std::vector<Zone> zones;
+	std::error_code error;
+	for (const auto& entry : fs::directory_iterator(directory, error)) {
+		std::string extension = entry.path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+		if (extension != ".wav" && extension != ".aif" && extension != ".aiff") continue;
+
+		const std::string name = entry.path().stem().string();
+		const auto digits = name.find_last_not_of("0123456789") + 1;
+		if (digits == name.size() || name.size() - digits > 3) continue;
+		zones.push_back({ entry.path().string(), unsigned(std::stoul(name.substr(digits))), 0, 127 });
+	}
+
+	std::sort(zones.begin(), zones.end(), [](const Zone& a, const Zone& b) { return a.rootKey < b.rootKey; });
+	for (std::size_t i = 0; i < zones.size(); ++i) {
+		if (i > 0) zones[i].lowKey = (zones[i - 1].rootKey + zones[i].rootKey) / 2 + 1;
+		if (i + 1 < zones.size()) zones[i].highKey = (zones[i].rootKey + zones[i + 1].rootKey) / 2;
+	}
+	return zones;
+}
+
+double Sampler::getSample(double t)
+{
+	float frame[2];
+	renderStereoBlock(frame, 1, uint64_t(std::llround(t * timing::getSampleRate())));
+	return (frame[0] + frame[1]) / 2.;
+}
+
+void Sampler::renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning)
+{
+	const double t = timing::frameToTime(startFrame);
+	applyCommands(t);
+	if (gains.size() < frames) gains.resize(frames);
+	std::fill(out, out + 2 * frames, 0.f);
+
+	for (std::size_t v = 0; v < voices.size(); ++v) {
+		auto& voice = voices[v];
+		// A stolen voice starts its new key once the old one has faded out
+		if (!voice.key && voice.nextKey) {
+			bind(v, *voice.nextKey, t);
+			voice.nextKey.reset();
+		}
+		if (voice.key && !renderVoice(v, out, frames, panning)) stopVoice(v);
+	}
+}
+
+bool Sampler::renderVoice(std::size_t v, float* out, std::size_t frames, const Panning& panning)
+{
+	auto& voice = voices[v];
+	auto& stream = streams[v];
+	const Sample& sample = samples[voice.sample];
+	const uint64_t headFrames = sample.head.size() / 2;
+	const uint64_t written = stream.written.load(std::memory_order_acquire);
+	const uint64_t available = written >> 32 == voice.note ? uint32_t(written) : headFrames;
+	const std::size_t mask = ringFrames - 1;
+	static const float silence[2]{};
+	auto frameAt = [&](uint64_t i) -> const float* {
+		if (i >= sample.frames) return silence;
+		if (i < headFrames) return sample.head.data() + 2 * i;
+		if (i < available) return stream.ring.data() + 2 * (i & mask);
+		return nullptr;
+	};
+
+	voice.env.renderBlock(gains.data(), frames);
+	bool fadedOut = false;
+	if (voice.fadeFrames) {
+		const float fadeLength = float(std::max(1u, unsigned(fadeTime * timing::getSampleRate())));
+		for (std::size_t j = 0; j < frames; ++j)
+			gains[j] *= j < voice.fadeFrames ? (voice.fadeFrames - j) / fadeLength : 0.f;
+		voice.fadeFrames = voice.fadeFrames > frames ? unsigned(voice.fadeFrames - frames) : 0;
+		fadedOut = !voice.fadeFrames;
+	}
+
+	const double keySpread = zoneOfKey.size() > 1 ? 2. / (zoneOfKey.size() - 1) : 0.;
+	auto [left, right] = Panning::gains(panning.pan + panning.width * (*voice.key * keySpread - 1.));
+	left *= voiceGain;
+	right *= voiceGain;
+
+	// Frames which are not streamed yet are silent, the voice keeps its time
+	bool underrun = false;
+	for (std::size_t j = 0; j < frames; ++j) {
+		const uint64_t i = uint64_t(voice.position);
+		const float* a = frameAt(i);
+		const float* b = frameAt(i + 1);
+		if (a && b) {
+			const float frac = float(voice.position - double(i));
+			out[2 * j] += (a[0] + (b[0] - a[0]) * frac) * gains[j] * left;
+			out[2 * j + 1] += (a[1] + (b[1] - a[1]) * frac) * gains[j] * right;
+		}
+		else {
+			underrun = true;
+		}
+		voice.position += voice.increment;
+	}
+	(underrun ? underruns : cacheHits).fetch_add(1, std::memory_order_relaxed);
+
+	const uint64_t position = std::min(uint64_t(voice.position), sample.frames);
+	stream.read.store(pack(voice.note, std::max(position, headFrames)), std::memory_order_release);
+	return !fadedOut && position < sample.frames && voice.env.isNonZero();
+}
+
+unsigned Sampler::getKeyCount() const
+{
+	return unsigned(zoneOfKey.size());
+}
+
+unsigned Sampler::getFirstKey() const
+{
+	return firstKey;
+}
+
+Sampler::Stats Sampler::getStats() const
+{
+	return { cacheHits.load(), underruns.load(), memory };
+}
+
+void Sampler::prefetchNow()
+{
+	std::unique_lock<std::mutex> lock(prefetchMutex);
+	// A pass which starts after this call sees the read positions of the last block
+	const uint64_t pass = passesStarted + 1;
+	passRequested = std::max(passRequested, pass);
+	prefetchWake.notify_one();
+	prefetchDone.wait(lock, [this, pass]() { return passesFinished >= pass; });
+}
+
+void Sampler::onKeyEvent(unsigned key, SynthKey::State keyState)
+{
+	if (key >= zoneOfKey.size()) {
+		throw std::out_of_range("There is no key " + std::to_string(key) + ".");
+	}
+	keyEvents.push(key, keyState == SynthKey::State::Pressed);
+}
+
+void Sampler::releaseKeys()
+{
+	keyEvents.releaseAll();
+}
+
+uint64_t Sampler::getMergedKeyEvents() const
+{
+	return keyEvents.getMerged();
+}
+
+void Sampler::playKeyEvent(unsigned key, SynthKey::State keyState, uint64_t frame)
+{
+	if (key >= zoneOfKey.size()) return;
+	const double t = timing::frameToTime(frame);
+	if (keyState == SynthKey::State::Pressed)
+		noteOn(key, t);
+	else
+		noteOff(key, t);
+}
+
+void Sampler::applyCommands(double t)
+{
+	keyEvents.apply(
+		[this, t](unsigned key, bool pressed) { pressed ? noteOn(key, t) : noteOff(key, t); },
+		[this]() {
+			for (std::size_t v = 0; v < voices.size(); ++v) {
+				stopVoice(v);
+				voices[v].nextKey.reset();
+			}
+		}
+	);
+}
+
+void Sampler::noteOff(unsigned key, double t)
+{
+	for (auto& voice : voices) {
+		if (voice.key == key && !voice.fadeFrames) voice.env.stop(t);
+		if (voice.nextKey == key) voice.nextKey.reset();
+	}
+}
+
+void Sampler::noteOn(unsigned key, double t)
+{
+	if (zoneOfKey[key] < 0) return;
+	const unsigned fadeFrames = std::max(1u, unsigned(fadeTime * timing::getSampleRate()));
+	for (auto& voice : voices) {
+		// The sample starts again after a short fade, instead of jumping back
+		if (voice.key == key && !voice.fadeFrames) {
+			voice.nextKey = key;
+			voice.fadeFrames = fadeFrames;
+			return;
+		}
+		if (voice.nextKey == key) return;
+	}
+	for (std::size_t v = 0; v < voices.size(); ++v) {
+		if (!voices[v].key && !voices[v].nextKey) {
+			bind(v, key, t);
+			return;
+		}
+	}
+
+	Voice* stolen = nullptr;
+	for (auto& voice : voices) {
+		if (voice.nextKey || voice.fadeFrames) continue; // already fading out
+		if (!stolen || voice.age < stolen->age) stolen = &voice;
+	}
+	if (stolen) {
+		stolen->nextKey = key;
+		stolen->fadeFrames = fadeFrames;
+	}
+}
+
+void Sampler::bind(std::size_t v, unsigned key, double t)
+{
+	auto& voice = voices[v];
+	voice.key = key;
+	voice.sample = std::size_t(zoneOfKey[key]);
+	const Sample& sample = samples[voice.sample];
+	voice.position = 0.;
+	voice.increment = std::pow(2., (double(firstKey + key) - sample.rootKey) / 12.)
+		* sample.file.getSampleRate() / timing::getSampleRate();
+	voice.env.reset();
+	voice.env.start(t);
+	voice.age = ++noteCounter;
+	if (++voice.note == 0) ++voice.note; // 0 is an idle stream
+
+	// The voice plays the head while the prefetch thread starts streaming after it
+	streams[v].sample.store(voice.sample, std::memory_order_relaxed);
+	streams[v].read.store(pack(voice.note, sample.head.size() / 2), std::memory_order_release);
+}
+
+void Sampler::stopVoice(std::size_t v)
+{
+	voices[v].key.reset();
+	voices[v].fadeFrames = 0;
+	streams[v].read.store(0, std::memory_order_relaxed);
+}
+
+bool Sampler::prefetch(Stream& stream, std::vector<float>& decoded)
+{
+	const uint64_t read = stream.read.load(std::memory_order_acquire);
+	const uint32_t note = uint32_t(read >> 32);
+	if (!note) return false;
+
+	const Sample& sample = samples[stream.sample.load(std::memory_order_relaxed)];
+	const uint64_t written = stream.written.load(std::memory_order_relaxed);
+	const uint64_t needed = uint32_t(read);
+	// A new note starts after its head, frames the voice has passed already are skipped
+	uint64_t from = written >> 32 == note ? uint32_t(written) : sample.head.size() / 2;
+	from = std::max(from, needed);
+	const uint64_t end = std::min(sample.frames, needed + ringFrames);
+	if (from >= end) return false;
+
+	const std::size_t mask = ringFrames - 1;
+	while (from < end) {
+		const auto n = std::size_t(std::min<uint64_t>({ end - from, ringFrames - (from & mask), chunkFrames }));
+		readStereo(sample.file, from, n, stream.ring.data() + 2 * (from & mask), decoded);
+		from += n;
+		stream.written.store(pack(note, from), std::memory_order_release);
+	}
+	return true;
+}
+
+void Sampler::prefetchLoop()
+{
+	std::vector<float> decoded;
+	std::unique_lock<std::mutex> lock(prefetchMutex);
+	while (running) {
+		const uint64_t pass = ++passesStarted;
+		lock.unlock();
+		bool busy = false;
+		for (std::size_t v = 0; v < voices.size(); ++v)
+			busy |= prefetch(streams[v], decoded);
+		lock.lock();
+		passesFinished = pass;
+		prefetchDone.notify_all();
+		if (!busy) {
+			prefetchWake.wait_for(lock, std::chrono::milliseconds(2), [this]() { return passRequested > passesFinished || !running; });
+		}
+	}
+}
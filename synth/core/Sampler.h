@@ -0,0 +1,143 @@
+#ifndef SAMPLER_H_INCLUDED
+#define SAMPLER_H_INCLUDED
+
+#include <AudioFileReader.h>
+
+#include "generators.h"
+#include "KeyEventQueue.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Multisample player which keeps only the beginning of every sample in memory.
+// The rest is streamed from the mapped files by a prefetch thread into a ring per voice,
+// so the audio thread never waits for the disk and the memory needed does not grow
+// with the length or the number of the samples beyond their beginnings.
+class Sampler
+{
+public:
+	// A sample played on the keys [lowKey, highKey], at its own pitch on rootKey.
+	// Keys are MIDI note numbers.
+	struct Zone
+	{
+		std::string path;
+		unsigned rootKey, lowKey, highKey;
+	};
+
+	struct Stats
+	{
+		uint64_t cacheHits;  // voice blocks rendered from memory
+		uint64_t underruns;  // voice blocks which needed frames that were not streamed yet
+		std::size_t memory;  // bytes of the preloaded beginnings and of the rings
+	};
+
+	// Every voice is played at this gain, so notes sound as loud with any number of voices
+	static constexpr float voiceGain = .25f;
+
+	// Key 0 of the keyboard plays the MIDI note firstKey
+	Sampler(
+		const std::vector<Zone>& zones,
+		const ADSREnvelope& env,
+		unsigned firstKey,
+		unsigned keyCount,
+		unsigned maxVoices,
+		double preloadTime = .2
+	);
+	Sampler(const Sampler&) = delete;
+	Sampler& operator=(const Sampler&) = delete;
+	~Sampler();
+
+	// The WAV and AIFF files of a directory, every name ends with the root key, like Piano_60.wav.
+	// Each sample plays up to halfway to its neighbours.
+	static std::vector<Zone> scanDirectory(const std::string& directory);
+
+	double getSample(double t);
+	void renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning = {});
+	unsigned getKeyCount() const;
+	// The MIDI note of key 0
+	unsigned getFirstKey() const;
+	Stats getStats() const;
+	// Waits until the prefetch thread has streamed what every voice needs for its next blocks,
+	// for offline rendering and tests. Never from a real time audio thread.
+	void prefetchNow();
+
+	// Control from the GUI thread, applied at the beginning of the next block
+	void onKeyEvent(unsigned key, SynthKey::State keyState);
+	void releaseKeys();
+	// Key events merged into a later one of the same key because the queue was full
+	uint64_t getMergedKeyEvents() const;
+	// From the audio thread, once the blocks up to the frame of the event are rendered: the next
+	// block starts the sample of the key from its beginning, or releases it. Keys out of range
+	// and keys without a sample are ignored.
+	void playKeyEvent(unsigned key, SynthKey::State keyState, uint64_t frame);
+
+private:
+	struct Sample
+	{
+		AudioFileReader file;
+		std::vector<float> head; // the preloaded frames, interleaved stereo
+		uint64_t frames;
+		unsigned rootKey;
+	};
+
+	// Shared by a voice and the prefetch thread. Both states hold the number of the note in
+	// the upper 32 bits and a frame in the lower ones, so frames streamed for a previous note
+	// of the voice are never played. The ring holds the frames after the head.
+	struct Stream
+	{
+		std::vector<float> ring;
+		std::atomic<std::size_t> sample{ 0 };
+		std::atomic<uint64_t> read{ 0 };    // note and first frame still needed, set by the audio thread
+		std::atomic<uint64_t> written{ 0 }; // note and end of the streamed frames, set by the prefetch thread
+	};
+
+	struct Voice
+	{
+		ADSREnvelope env;
+		std::optional<unsigned> key{}, nextKey{}; // nextKey starts when the fade-out has finished
+		std::size_t sample{ 0 };
+		uint32_t note{ 0 };
+		double position{ 0. }, increment{ 1. }; // in frames of the sample
+		uint64_t age{ 0 };
+		unsigned fadeFrames{ 0 };
+	};
+
+	static uint64_t pack(uint32_t note, uint64_t frame) { return uint64_t(note) << 32 | frame; }
+	void applyCommands(double t);
+	void noteOn(unsigned key, double t);
+	void noteOff(unsigned key, double t);
+	void bind(std::size_t v, unsigned key, double t);
+	void stopVoice(std::size_t v);
+	bool renderVoice(std::size_t v, float* out, std::size_t frames, const Panning& panning);
+	// Fills the ring of a voice, returns false if there was nothing to do
+	bool prefetch(Stream& stream, std::vector<float>& decoded);
+	void prefetchLoop();
+
+	static constexpr double fadeTime = 0.005; // of a stolen voice, in seconds
+
+	std::vector<Sample> samples;
+	std::vector<int> zoneOfKey; // sample of every key, -1 if none
+	const unsigned firstKey;
+	std::size_t ringFrames{ 0 };
+	std::vector<Voice> voices;
+	std::unique_ptr<Stream[]> streams;
+	std::vector<float> gains;
+	uint64_t noteCounter{ 0 };
+	KeyEventQueue<1024> keyEvents;
+	std::atomic<uint64_t> cacheHits{ 0 }, underruns{ 0 };
+	std::size_t memory{ 0 };
+	std::atomic<bool> running{ true };
+	// Passes of the prefetch thread over the voices, started and finished, and the one prefetchNow waits for
+	std::mutex prefetchMutex;
+	std::condition_variable prefetchWake, prefetchDone;
+	uint64_t passesStarted{ 0 }, passesFinished{ 0 }, passRequested{ 0 };
+	std::thread prefetcher;
+};
+
+#endif //SAMPLER_H_INCLUDED
@@ -0,0 +1,298 @@
+#include "Score.h"
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cctype>
+
+namespace
+{
+	void sortScore(Score& score)
+	{
+		std::stable_sort(score.begin(), score.end(), [](const NoteEvent& a, const NoteEvent& b) {
+			if (a.time != b.time) return a.time < b.time;
+			return a.velocity == 0 && b.velocity != 0;
+		});
+	}
+
+	// Big endian fields and variable length quantities of a MIDI file
+	class MidiReader
+	{
+	public:
+		MidiReader(const std::vector<uint8_t>& data, std::size_t begin, std::size_t end)
+			:data(data), pos(begin), end(end)
+		{}
+
+		bool atEnd() const { return pos >= end; }
+
+		uint8_t byte()
+		{
+			if (pos >= end) throw std::runtime_error("Unexpected end of MIDI data.");
+			return data[pos++];
+		}
+		uint8_t peek() const
+		{
+			if (pos >= end) throw std::runtime_error("Unexpected end of MIDI data.");
+			return data[pos];
+		}
+		uint32_t fixed(unsigned bytes)
+		{
+			uint32_t value = 0;
+			for (unsigned i = 0; i < bytes; ++i) value = (value << 8) | byte();
+			return value;
+		}
+		uint32_t variable()
+		{
+			uint32_t value = 0;
+			for (unsigned i = 0; i < 4; ++i) {
+				const uint8_t b = byte();
+				value = (value << 7) | (b & 0x7f);
+				if (!(b & 0x80)) return value;
+			}
+			throw std::runtime_error("Invalid variable length quantity in MIDI data.");
+		}
+		void skip(std::size_t bytes)
+		{
+			if (bytes > end - pos) throw std::runtime_error("Unexpected end of MIDI data.");
+			pos += bytes;
+		}
+
+	private:
+		const std::vector<uint8_t>& data;
+		std::size_t pos, end;
+	};
+
+	struct TempoChange
+	{
+		uint64_t tick;
+		uint32_t microsPerQuarter;
+	};
+
+	struct TickEvent
+	{
+		uint64_t tick;
+		NoteEvent event;
+	};
+
+	// Reads one MTrk chunk, running status included
+	void readTrack(MidiReader reader, std::vector<TickEvent>& events, std::vector<TempoChange>& tempos)
+	{
+		uint64_t tick = 0;
+		uint8_t status = 0;
+		while (!reader.atEnd()) {
+			tick += reader.variable();
+			if (reader.peek() & 0x80) status = reader.byte();
+			else if (!status) throw std::runtime_error("MIDI data byte without a status.");
+
+			if (status == 0xff) { // meta event
+				const uint8_t type = reader.byte();
+				const uint32_t length = reader.variable();
+				if (type == 0x2f) return; // end of track
+				if (type == 0x51 && length == 3) tempos.push_back({ tick, reader.fixed(3) });
+				else reader.skip(length);
+				status = 0; // meta and sysex events cancel the running status
+			}
+			else if (status == 0xf0 || status == 0xf7) {
+				reader.skip(reader.variable());
+				status = 0;
+			}
+			else if (status >= 0xf0) {
+				throw std::runtime_error("Unexpected system message in a MIDI track.");
+			}
+			else {
+				const uint8_t type = status & 0xf0;
+				const unsigned channel = status & 0x0f;
+				const uint8_t first = reader.byte() & 0x7f;
+				const bool twoBytes = type != 0xc0 && type != 0xd0;
+				const uint8_t second = twoBytes ? reader.byte() & 0x7f : 0;
+				if (type == 0x90) events.push_back({ tick, { 0., channel, first, second } });
+				else if (type == 0x80) events.push_back({ tick, { 0., channel, first, 0 } });
+			}
+		}
+	}
+}
+
+Score readEventScript(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("Unable to open " + path + ".");
+	}
+
+	Score score;
+	std::string line;
+	for (unsigned lineNumber = 1; std::getline(file, line); ++lineNumber) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream iss(line);
+		double time;
+		std::string type;
+		if (!(iss >> time)) {
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": the line has to start with a time.");
+		}
+		NoteEvent event{ time, 0, 0, 0 };
+		if (!(iss >> type >> event.note)) {
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": the event needs a type and a note.");
+		}
+		if (type == "on") {
+			event.velocity = 100;
+			if (iss >> event.velocity) iss >> event.channel;
+		}
+		else if (type == "off") {
+			iss >> event.channel;
+		}
+		else {
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": unknown event " + type + ".");
+		}
+		if ((iss.fail() && !iss.eof()) || time < 0 || event.note > 127 || event.velocity > 127 || event.channel > 15) {
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": invalid event.");
+		}
+		score.push_back(event);
+	}
+	sortScore(score);
+	return score;
+}
+
+Score readMidiFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Unable to open " + path + ".");
+	}
+	const std::vector<uint8_t> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	MidiReader reader(data, 0, data.size());
+	if (reader.fixed(4) != 0x4d546864 || reader.fixed(4) < 6) { // MThd
+		throw std::runtime_error(path + " is not a MIDI file.");
+	}
+	const uint32_t format = reader.fixed(2);
+	const uint32_t trackCount = reader.fixed(2);
+	const uint32_t division = reader.fixed(2);
+	if (format > 1) {
+		throw std::runtime_error(path + ": only type 0 and 1 MIDI files are supported.");
+	}
+	if (division == 0 || ((division & 0x8000) && !(division & 0xff))) {
+		throw std::runtime_error(path + ": invalid time division.");
+	}
+
+	std::vector<TickEvent> events;
+	std::vector<TempoChange> tempos;
+	std::size_t pos = 8 + MidiReader(data, 4, 8).fixed(4);
+	for (uint32_t track = 0; track < trackCount && pos + 8 <= data.size(); ) {
+		MidiReader chunk(data, pos, data.size());
+		const uint32_t id = chunk.fixed(4);
+		const std::size_t length = chunk.fixed(4);
+		const std::size_t begin = pos + 8;
+		if (length > data.size() - begin) {
+			throw std::runtime_error(path + ": truncated track.");
+		}
+		if (id == 0x4d54726b) { // MTrk, other chunks are skipped
+			readTrack(MidiReader(data, begin, begin + length), events, tempos);
+			++track;
+		}
+		pos = begin + length;
+	}
+
+	// Ticks are converted to seconds along the tempo map, tracks are merged by time
+	std::stable_sort(tempos.begin(), tempos.end(), [](const auto& a, const auto& b) { return a.tick < b.tick; });
+	std::vector<double> tempoStart; // time of every tempo change in seconds
+	if (!(division & 0x8000)) {
+		uint64_t tick = 0;
+		uint32_t micros = 500000; // 120 bpm until the first tempo change
+		double seconds = 0.;
+		for (const auto& tempo : tempos) {
+			seconds += double(tempo.tick - tick) * micros / division / 1e6;
+			tempoStart.push_back(seconds);
+			tick = tempo.tick;
+			micros = tempo.microsPerQuarter;
+		}
+	}
+	auto toSeconds = [&](uint64_t tick) {
+		if (division & 0x8000) { // SMPTE frames per second and ticks per frame
+			const int fps = -int(int8_t(division >> 8));
+			const double framesPerSecond = fps == 29 ? 29.97 : fps;
+			return tick / (framesPerSecond * (division & 0xff));
+		}
+		auto next = std::upper_bound(tempos.begin(), tempos.end(), tick, [](uint64_t t, const auto& tempo) {
+			return t < tempo.tick;
+		});
+		if (next == tempos.begin()) return tick * 0.5 / division;
+		const std::size_t i = std::size_t(next - tempos.begin()) - 1;
+		return tempoStart[i] + double(tick - tempos[i].tick) * tempos[i].microsPerQuarter / division / 1e6;
+	};
+
+	Score score;
+	score.reserve(events.size());
+	for (auto& e : events) {
+		e.event.time = toSeconds(e.tick);
+		score.push_back(e.event);
+	}
+	sortScore(score);
+	return score;
+}
+
+Score readScore(const std::string& path)
+{
+	std::string extension = path.substr(std::min(path.size(), path.rfind('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+	if (extension == ".mid" || extension == ".midi") {
+		return readMidiFile(path);
+	}
+	return readEventScript(path);
+}
+
+const std::vector<std::string>& stressPatternNames()
+{
+	static const std::vector<std::string> names{ "chords", "arpeggios", "glissandi" };
+	return names;
+}
+
+Score stressPattern(const std::string& name, double seconds, unsigned lowNote, unsigned highNote)
+{
+	if (lowNote > highNote || highNote > 127) {
+		throw std::invalid_argument("Invalid note range for the stress pattern " + name + ".");
+	}
+	const unsigned range = highNote - lowNote + 1;
+	const unsigned velocity = 100;
+	Score score;
+	auto add = [&score, seconds, velocity](double time, unsigned note, double length) {
+		if (time >= seconds) return;
+		score.push_back({ time, 0, note, velocity });
+		score.push_back({ std::min(time + length, seconds), 0, note, 0 });
+	};
+
+	if (name == "chords") {
+		// The roots walk by fifths, so consecutive clusters share only some of their notes
+		const double period = 1. / 8;
+		const unsigned size = std::min(12u, range);
+		for (unsigned i = 0; i * period < seconds; ++i) {
+			const unsigned root = (i * 7) % (range - size + 1);
+			for (unsigned j = 0; j < size; ++j)
+				add(i * period, lowNote + root + j, period);
+		}
+	}
+	else if (name == "arpeggios") {
+		const double period = 1. / 32;
+		const unsigned cycle = std::max(1u, 2 * (range - 1));
+		for (unsigned i = 0; i * period < seconds; ++i) {
+			const unsigned step = i % cycle;
+			add(i * period, lowNote + (step < range ? step : cycle - step), .25);
+		}
+	}
+	else if (name == "glissandi") {
+		const unsigned cycle = std::max(1u, 2 * (range - 1));
+		const double period = .5 / cycle;
+		for (unsigned i = 0; i * period < seconds; ++i) {
+			const unsigned step = i % cycle;
+			add(i * period, lowNote + (step < range ? step : cycle - step), .05);
+		}
+	}
+	else {
+		throw std::invalid_argument("There is no stress pattern called " + name + ".");
+	}
+	sortScore(score);
+	return score;
+}
@@ -0,0 +1,39 @@
+#ifndef SCORE_H_INCLUDED
+#define SCORE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+// A note pressed or released at a given time of a piece
+struct NoteEvent
+{
+	double time;       // in seconds
+	unsigned channel;  // MIDI channel, 0-15
+	unsigned note;     // MIDI note number
+	unsigned velocity; // 0 releases the note
+};
+
+// Note events sorted by time. At the same time releases come first,
+// so a note released and pressed again at once is retriggered.
+using Score = std::vector<NoteEvent>;
+
+// Text file, one event per line, # starts a comment:
+//   <seconds> on <note> [velocity] [channel]
+//   <seconds> off <note> [channel]
+Score readEventScript(const std::string& path);
+
+// Standard MIDI File of type 0 or 1, tempo changes are taken into account
+Score readMidiFile(const std::string& path);
+
+// Picks the reader by the extension, .mid and .midi are MIDI files
+Score readScore(const std::string& path);
+
+// Synthetic loads for profiling, the same on every run, on channel 0 within the notes [lowNote, highNote]:
+//   "chords"    12 note clusters, 8 per second, each held until the next one
+//   "arpeggios" 32 notes per second up and down the range, each held for a quarter second
+//   "glissandi" every key of the range up and back down, twice per second, each held for 50 ms
+// Throws std::invalid_argument for an unknown pattern or an empty range
+Score stressPattern(const std::string& name, double seconds, unsigned lowNote = 48, unsigned highNote = 95);
+const std::vector<std::string>& stressPatternNames();
+
+#endif //SCORE_H_INCLUDED
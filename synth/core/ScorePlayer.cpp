@@ -0,0 +1,19 @@
+#include "ScorePlayer.h"
+
+#include <cmath>
+
+ScorePlayer::ScorePlayer(const Score& score, double sampleRate)
+{
+	events.reserve(score.size());
+	for (const auto& note : score) {
+		ScheduledEvent event;
+		event.frame = uint64_t(std::llround(note.time * sampleRate));
+		event.message.size = 3;
+		event.message.bytes = {
+			uint8_t((note.velocity ? 0x90 : 0x80) | (note.channel & 0x0f)),
+			uint8_t(note.note & 0x7f),
+			uint8_t(note.velocity & 0x7f)
+		};
+		events.push_back(event);
+	}
+}
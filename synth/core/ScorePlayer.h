@@ -0,0 +1,44 @@
+#ifndef SCOREPLAYER_H_INCLUDED
+#define SCOREPLAYER_H_INCLUDED
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "Score.h"
+#include "EventScheduler.h"
+
+// Plays a score as MIDI messages at their exact frames, so it reaches the instruments the way
+// live MIDI does. Made on any thread, then used by the audio thread only, which starts it at
+// the first block it sees it, so it plays in real time or as fast as the backend pulls blocks.
+class ScorePlayer
+{
+public:
+	ScorePlayer(const Score& score, double sampleRate);
+
+	// Audio thread. Pushes the events before the frame end, and keeps the rest while the scheduler is full.
+	template<std::size_t Capacity>
+	void schedule(EventScheduler<Capacity>& pending, uint64_t frame, uint64_t end)
+	{
+		if (start == UINT64_MAX) start = frame;
+		for (; next < events.size() && start + events[next].frame < end && !pending.full(); ++next) {
+			ScheduledEvent event = events[next];
+			event.frame += start;
+			pending.push(event);
+		}
+		if (next == events.size()) done = true;
+	}
+
+	// Every event was handed to the audio thread, readable from any thread
+	bool isDone() const { return done; }
+	// Frames from the start until the last event
+	uint64_t getLength() const { return events.empty() ? 0 : events.back().frame; }
+
+private:
+	std::vector<ScheduledEvent> events; // frames from the start of the score
+	std::size_t next{ 0 };
+	uint64_t start{ UINT64_MAX };
+	std::atomic<bool> done{ false };
+};
+
+#endif //SCOREPLAYER_H_INCLUDED
@@ -0,0 +1,83 @@
+#ifndef SPSCQUEUE_H_INCLUDED
+#define SPSCQUEUE_H_INCLUDED
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <algorithm>
+
+// Wait-free single producer, single consumer ring buffer of trivially copyable items.
+// One thread may push and another one may pop at the same time without locks.
+template<class T, std::size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "The capacity has to be a power of 2.");
+
+public:
+	// Returns false if the queue is full, the item is dropped then
+	bool push(const T& item)
+	{
+		const std::size_t tail = writeIdx.load(std::memory_order_relaxed);
+		if (tail - readIdx.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[tail & (Capacity - 1)] = item;
+		writeIdx.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		const std::size_t head = readIdx.load(std::memory_order_relaxed);
+		if (head == writeIdx.load(std::memory_order_acquire))
+			return false;
+		item = items[head & (Capacity - 1)];
+		readIdx.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Copies the next item without popping it, from the consumer thread
+	bool peek(T& item) const
+	{
+		const std::size_t head = readIdx.load(std::memory_order_relaxed);
+		if (head == writeIdx.load(std::memory_order_acquire))
+			return false;
+		item = items[head & (Capacity - 1)];
+		return true;
+	}
+
+	// Pushes as many of the items as fit, returns how many were pushed
+	std::size_t pushBlock(const T* block, std::size_t count)
+	{
+		const std::size_t tail = writeIdx.load(std::memory_order_relaxed);
+		const std::size_t n = std::min(count, Capacity - (tail - readIdx.load(std::memory_order_acquire)));
+		const std::size_t first = std::min(n, Capacity - (tail & (Capacity - 1)));
+		std::copy(block, block + first, items.begin() + (tail & (Capacity - 1)));
+		std::copy(block + first, block + n, items.begin());
+		writeIdx.store(tail + n, std::memory_order_release);
+		return n;
+	}
+
+	// Pops at most count items, returns how many were popped
+	std::size_t popBlock(T* block, std::size_t count)
+	{
+		const std::size_t head = readIdx.load(std::memory_order_relaxed);
+		const std::size_t n = std::min(count, writeIdx.load(std::memory_order_acquire) - head);
+		const std::size_t first = std::min(n, Capacity - (head & (Capacity - 1)));
+		std::copy(items.begin() + (head & (Capacity - 1)), items.begin() + (head & (Capacity - 1)) + first, block);
+		std::copy(items.begin(), items.begin() + (n - first), block + first);
+		readIdx.store(head + n, std::memory_order_release);
+		return n;
+	}
+
+	// Only a snapshot when the other thread is active
+	std::size_t size() const { return writeIdx.load() - readIdx.load(); }
+	static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+	std::array<T, Capacity> items{};
+	// Separate cache lines, so the two threads do not invalidate each other's index
+	alignas(64) std::atomic<std::size_t> writeIdx{ 0 };
+	alignas(64) std::atomic<std::size_t> readIdx{ 0 };
+};
+
+#endif //SPSCQUEUE_H_INCLUDED
@@ -0,0 +1,99 @@
+#include "StreamStats.h"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace
+{
+	std::size_t histogramBin(double load)
+	{
+		if (load < 1.) return std::size_t(std::max(load, 0.) * 10);
+		if (load < 1.5) return 10;
+		if (load < 2.) return 11;
+		return 12;
+	}
+}
+
+void StreamStats::record(const CallbackInfo& info)
+{
+	const double load = info.deadline > 0. ? info.seconds / info.deadline : 0.;
+	add(callbacks, uint64_t(1));
+	add(overruns, uint64_t(load > 1.));
+	add(outputUnderflows, uint64_t(info.outputUnderflow));
+	add(outputOverflows, uint64_t(info.outputOverflow));
+	add(inputUnderflows, uint64_t(info.inputUnderflow));
+	add(inputOverflows, uint64_t(info.inputOverflow));
+	add(primingOutputs, uint64_t(info.primingOutput));
+	add(loadHistogram[histogramBin(load)], uint64_t(1));
+	add(loadSum, load);
+	lastLoad.store(load, std::memory_order_relaxed);
+	if (load > maxLoad.load(std::memory_order_relaxed)) {
+		maxLoad.store(load, std::memory_order_relaxed);
+	}
+
+	if (info.latency >= 0.) {
+		lastLatency.store(info.latency, std::memory_order_relaxed);
+		const double minimum = minLatency.load(std::memory_order_relaxed);
+		if (minimum < 0. || info.latency < minimum) minLatency.store(info.latency, std::memory_order_relaxed);
+		if (info.latency > maxLatency.load(std::memory_order_relaxed)) maxLatency.store(info.latency, std::memory_order_relaxed);
+	}
+}
+
+StreamStats::Snapshot StreamStats::snapshot() const
+{
+	Snapshot s;
+	s.callbacks = callbacks.load(std::memory_order_relaxed);
+	s.overruns = overruns.load(std::memory_order_relaxed);
+	s.outputUnderflows = outputUnderflows.load(std::memory_order_relaxed);
+	s.outputOverflows = outputOverflows.load(std::memory_order_relaxed);
+	s.inputUnderflows = inputUnderflows.load(std::memory_order_relaxed);
+	s.inputOverflows = inputOverflows.load(std::memory_order_relaxed);
+	s.primingOutputs = primingOutputs.load(std::memory_order_relaxed);
+	s.lastLoad = lastLoad.load(std::memory_order_relaxed);
+	s.maxLoad = maxLoad.load(std::memory_order_relaxed);
+	s.meanLoad = s.callbacks ? loadSum.load(std::memory_order_relaxed) / s.callbacks : 0.;
+	s.lastLatency = lastLatency.load(std::memory_order_relaxed);
+	s.minLatency = minLatency.load(std::memory_order_relaxed);
+	s.maxLatency = maxLatency.load(std::memory_order_relaxed);
+	for (std::size_t i = 0; i < histogramSize; ++i) {
+		s.loadHistogram[i] = loadHistogram[i].load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+std::string StreamStats::summary() const
+{
+	const auto s = snapshot();
+	std::ostringstream output;
+	output << std::fixed << std::setprecision(1) <<
+		"Callback load: " << s.lastLoad * 100 << "% (mean " << s.meanLoad * 100 << "%, max " << s.maxLoad * 100 << "%)\n" <<
+		"Overruns: " << s.overruns << " / " << s.callbacks << "\n" <<
+		"Output underflows: " << s.outputUnderflows << "\n" <<
+		"Output latency: " << std::max(s.lastLatency, 0.) * 1000 << " ms";
+	return output.str();
+}
+
+std::string StreamStats::report() const
+{
+	const auto s = snapshot();
+	std::ostringstream output;
+	output << std::fixed << std::setprecision(2) <<
+		"Audio callbacks: " << s.callbacks << ", overruns: " << s.overruns <<
+		", output underflows: " << s.outputUnderflows << ", output overflows: " << s.outputOverflows <<
+		", input underflows: " << s.inputUnderflows << ", input overflows: " << s.inputOverflows <<
+		", priming outputs: " << s.primingOutputs << "\n" <<
+		"Callback load: mean " << s.meanLoad * 100 << "%, max " << s.maxLoad * 100 << "%\n" <<
+		"Output latency: min " << s.minLatency * 1000 << " ms, max " << s.maxLatency * 1000 << " ms\n" <<
+		"Load histogram:";
+	for (std::size_t i = 0; i < histogramSize; ++i) {
+		output << (i ? ", " : " ") << std::setprecision(0) << histogramBinStart(i) * 100 << "%+: " << s.loadHistogram[i];
+	}
+	return output.str();
+}
+
+double StreamStats::histogramBinStart(std::size_t bin)
+{
+	if (bin <= 10) return bin / 10.;
+	return 1. + (bin - 10) / 2.;
+}
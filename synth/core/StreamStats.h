@@ -0,0 +1,62 @@
+#ifndef STREAMSTATS_H_INCLUDED
+#define STREAMSTATS_H_INCLUDED
+
+#include <atomic>
+#include <array>
+#include <string>
+#include <cstdint>
+
+// Timing of the audio callback, written by the audio thread and read by any other thread.
+// Load is the time spent in the callback as a fraction of the buffer period; above 1 the
+// callback missed its deadline. Only the audio thread records, so the counters are plain
+// relaxed atomics, nothing is locked or allocated there.
+class StreamStats
+{
+public:
+	// Loads of 0-100% in steps of 10%, then 100-150%, 150-200% and above
+	static constexpr std::size_t histogramSize = 13;
+
+	struct CallbackInfo
+	{
+		double seconds;  // wall-clock time spent in the callback
+		double deadline; // buffer period in seconds
+		double latency;  // time until the buffer reaches the DAC, negative if unknown
+		bool outputUnderflow, outputOverflow, inputUnderflow, inputOverflow, primingOutput;
+	};
+
+	struct Snapshot
+	{
+		uint64_t callbacks, overruns;
+		uint64_t outputUnderflows, outputOverflows, inputUnderflows, inputOverflows, primingOutputs;
+		double lastLoad, maxLoad, meanLoad;
+		double lastLatency, minLatency, maxLatency;
+		std::array<uint64_t, histogramSize> loadHistogram;
+	};
+
+	// Audio thread only
+	void record(const CallbackInfo& info);
+
+	Snapshot snapshot() const;
+	// Short summary for the debug window
+	std::string summary() const;
+	// Every counter and the histogram, for the log
+	std::string report() const;
+
+	static double histogramBinStart(std::size_t bin);
+
+private:
+	// A single writer, so read-modify-write is a load and a store
+	template<class T>
+	static void add(std::atomic<T>& value, T delta)
+	{
+		value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> callbacks{ 0 }, overruns{ 0 };
+	std::atomic<uint64_t> outputUnderflows{ 0 }, outputOverflows{ 0 }, inputUnderflows{ 0 }, inputOverflows{ 0 }, primingOutputs{ 0 };
+	std::atomic<double> lastLoad{ 0. }, maxLoad{ 0. }, loadSum{ 0. };
+	std::atomic<double> lastLatency{ -1. }, minLatency{ -1. }, maxLatency{ -1. };
+	std::array<std::atomic<uint64_t>, histogramSize> loadHistogram{};
+};
+
+#endif //STREAMSTATS_H_INCLUDED
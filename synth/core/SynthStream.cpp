@@ -2,78 +2,77 @@
 
 #include <algorithm>
 #include <exception>
+#include <stdexcept>
 #include <iostream>
 #include <ctime>
+#include <chrono>
 
-namespace {
-    void ErrorCheck(const PaError& err)
-    {
-        if( err != paNoError )
-            throw std::runtime_error(std::string("PortAudio exception: ")+Pa_GetErrorText(err));
-    }
-}
-
-int SynthStream::PaStreamCallbackData::callbackFunction(
-    const void*                     inputBuffer,
-    void*                           outputBuffer,
-    unsigned long                   framesPerBuffer,
-    const PaStreamCallbackTimeInfo* timeInfo,
-    PaStreamCallbackFlags           statusFlags,
-    void*                           userData)
+void SynthStream::CallbackData::render(const float* in, float* out, std::size_t framesPerBuffer, const AudioBackend::Status& status)
 {
-    auto* data = static_cast<PaStreamCallbackData*>( userData );
-    auto* out = static_cast<float*>( outputBuffer );
-	auto* in = static_cast< const float* >(inputBuffer);
+	const auto begin = std::chrono::steady_clock::now();
+	const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(begin.time_since_epoch()).count();
+	transport.startBlock({ sampleFrame, framesPerBuffer, now });
+	inputGenerator(in, framesPerBuffer, sampleFrame);
 
-    for (unsigned i=0; i<framesPerBuffer; i++) {
-		float input = *in++;
-		data->inputGenerator(input);
-        float sample1 = data->generator1(data->sampleTime);
-		float sample2 = data->generator2(data->sampleTime);
-        *out++ = sample1;
-		*out++ = sample2;
-        data->sampleTime += data->sampleTimeDif;
-    }
+	// A MIDI message which arrived d seconds before this callback plays d seconds before the end of
+	// the block. Messages and events stay in their queues while the scheduler is full.
+	ScheduledEvent event;
+	while (!pending.full() && midiQueue.peek(event.message) && event.message.time <= now) {
+		midiQueue.pop(event.message);
+		const double age = (now - event.message.time) * 1e-9 * sampleRate;
+		event.frame = sampleFrame + (age >= framesPerBuffer ? 0 : std::min<std::size_t>(framesPerBuffer - 1, std::size_t(framesPerBuffer - age)));
+		pending.push(event);
+	}
+	while (!pending.full() && scheduled.pop(event)) {
+		pending.push(event);
+	}
+	const uint64_t end = sampleFrame + framesPerBuffer;
+	if (auto* player = score.load(std::memory_order_acquire)) {
+		player->schedule(pending, sampleFrame, end);
+	}
 
-    return 0;
+	// The block is rendered in pieces between the events, straight into the interleaved output
+	std::size_t done = 0;
+	while (!pending.empty() && pending.top().frame < end) {
+		event = pending.top();
+		pending.pop();
+		if (event.frame > sampleFrame + done) {
+			const std::size_t offset = std::size_t(event.frame - sampleFrame);
+			generator(out + channelCount * done, offset - done, sampleFrame + done);
+			done = offset;
+		}
+		if (event.apply) event.apply(event.target, event.index, event.value, sampleFrame + done);
+		else if (midiCallback) midiCallback(event.message, sampleFrame + done);
+	}
+	if (done < framesPerBuffer) {
+		generator(out + channelCount * done, framesPerBuffer - done, sampleFrame + done);
+	}
+	sampleFrame = end;
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+	stats.record({
+		elapsed.count(),
+		framesPerBuffer / sampleRate,
+		status.latency,
+		status.outputUnderflow,
+		status.outputOverflow,
+		status.inputUnderflow,
+		status.inputOverflow,
+		status.primingOutput
+	});
 }
 
 SynthStream::SynthStream(
 	unsigned sampleRate, 
 	unsigned bufferSize, 
-	CallbackFunction g1, 
-	CallbackFunction g2,
-	InputCallback g3)
-    :callbackData(g1, g2, g3, 1./sampleRate)
+	CallbackFunction generator,
+	InputCallback inputGenerator,
+	MidiCallback midiCallback,
+	std::unique_ptr<AudioBackend> backend)
+    :callbackData(generator, inputGenerator, midiCallback, sampleRate),
+	backend(backend ? std::move(backend) : std::make_unique<PortAudioBackend>(sampleRate, bufferSize))
 {
-    ErrorCheck(Pa_Initialize());
-	inputParameters.device = Pa_GetDefaultInputDevice();
-	if (inputParameters.device == paNoDevice) {
-		throw std::runtime_error("PortAudio error: No default input device.\n");
-	}
-    outputParameters.device = Pa_GetDefaultOutputDevice();
-    if (outputParameters.device == paNoDevice) {
-        throw std::runtime_error("PortAudio error: No default output device.\n");
-    }
-    outputParameters.channelCount = 2;                     /* stereo output */
-    outputParameters.sampleFormat = paFloat32;
-	outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-    outputParameters.hostApiSpecificStreamInfo = NULL;
-
-	inputParameters.channelCount = 1;                     /* Mono input */
-	inputParameters.sampleFormat = paFloat32;
-	inputParameters.suggestedLatency = 0.01; Pa_GetDeviceInfo(inputParameters.device)->defaultLowInputLatency;
-	inputParameters.hostApiSpecificStreamInfo = NULL;
-
-    err = Pa_OpenStream( &stream,
-                         &inputParameters,
-                         &outputParameters,
-                         sampleRate,
-                         bufferSize,               /* Frames per buffer. */
-                         paNoFlag,         /* Automatically clip samples out of [-1, 1] */
-                         PaStreamCallbackData::callbackFunction,
-                         &callbackData );
-    ErrorCheck(err);
+	timing::setSampleRate(sampleRate);
 }
 
 SynthStream::~SynthStream()
@@ -81,17 +80,32 @@ SynthStream::~SynthStream()
 	if (running) {
 		stop();
 	}
-    ErrorCheck(Pa_Terminate());
+}
+
+bool SynthStream::schedule(const ScheduledEvent& event)
+{
+	return callbackData.scheduled.push(event);
+}
+
+void SynthStream::playScore(const Score& score)
+{
+	if (scorePlayer) {
+		throw std::logic_error("The stream already plays a score.");
+	}
+	scorePlayer = std::make_unique<ScorePlayer>(score, callbackData.sampleRate);
+	callbackData.score.store(scorePlayer.get(), std::memory_order_release);
 }
 
 void SynthStream::play()
 {
-    ErrorCheck(Pa_StartStream( stream ));
+	backend->start([data = &callbackData](const float* in, float* out, std::size_t frames, const AudioBackend::Status& status) {
+		data->render(in, out, frames, status);
+	});
 	running = true;
 }
 
 void SynthStream::stop()
 {
-    ErrorCheck(Pa_CloseStream( stream ));
+	backend->stop();
 	running = false;
 }
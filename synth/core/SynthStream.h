@@ -2,52 +2,85 @@
 #define SYNTH_H_INCLUDED
 
 #include <functional>
-#include <portaudio.h>
+#include <vector>
+#include <memory>
+#include <cstdint>
 #include "generators.h"
+#include "StreamStats.h"
+#include "MidiMessage.h"
+#include "AudioBackend.h"
+#include "EventScheduler.h"
+#include "Transport.h"
+#include "ScorePlayer.h"
 
 
 class SynthStream final
 {
 public:
-    typedef std::function<double(double)> CallbackFunction;
-	typedef std::function<void(double)> InputCallback;
+	// Fills a block of interleaved stereo frames, starting at the given frame
+    typedef std::function<void(float*, std::size_t, uint64_t)> CallbackFunction;
+	// Takes a block of input frames, starting at the given frame
+	typedef std::function<void(const float*, std::size_t, uint64_t)> InputCallback;
+	// Plays a MIDI message on the audio thread, from the given frame on
+	typedef std::function<void(const MidiMessage&, uint64_t)> MidiCallback;
 
+	// Plays through PortAudio without a backend
     SynthStream(
 		unsigned sampleRate, 
 		const unsigned bufferSize, 
-		CallbackFunction generator1, 
-		CallbackFunction generator2,
-		InputCallback generator3);
+		CallbackFunction generator,
+		InputCallback inputGenerator,
+		MidiCallback midiCallback = {},
+		std::unique_ptr<AudioBackend> backend = {});
     ~SynthStream();
     void play();
     void stop();
 
+	// Timing of the audio callback, readable from any thread
+	const StreamStats& getStats() const { return callbackData.stats; }
+	// Filled by the MIDI input thread. Every block plays the messages which arrived
+	// during the previous one, at the same distance from each other, so the latency is one block.
+	MidiQueue& getMidiQueue() { return callbackData.midiQueue; }
+	// From one thread, the GUI thread. The block is split at the frame of the event,
+	// events of past frames are applied at the start of the next block.
+	// Returns false if the queue to the audio thread is full.
+	bool schedule(const ScheduledEvent& event);
+	// From the GUI thread, the score plays through the MIDI callback from the next block on.
+	// Throws std::logic_error if the stream already has a score.
+	void playScore(const Score& score);
+	// True without a score
+	bool isScoreDone() const { return !scorePlayer || scorePlayer->isDone(); }
+	const Transport& getTransport() const { return callbackData.transport; }
+	AudioBackend& getBackend() { return *backend; }
+
+	static constexpr unsigned channelCount = 2;
+
 private:
 
-    struct PaStreamCallbackData
+    struct CallbackData
     {
-        CallbackFunction generator1, generator2;
+        CallbackFunction generator;
 		InputCallback inputGenerator;
-        double sampleTime = 0;
-        const double sampleTimeDif;
-
-        explicit PaStreamCallbackData(CallbackFunction g1, CallbackFunction g2, InputCallback g3, decltype(sampleTimeDif) s)
-            :generator1(g1), generator2(g2), inputGenerator(g3), sampleTimeDif(s) {}
-
-        static int callbackFunction(
-            const void*                     inputBuffer,
-            void*                           outputBuffer,
-            unsigned long                   framesPerBuffer,
-            const PaStreamCallbackTimeInfo* timeInfo,
-            PaStreamCallbackFlags           statusFlags,
-            void*                           userData);
-    };
+		MidiCallback midiCallback;
+		MidiQueue midiQueue;
+		SpscQueue<ScheduledEvent, 1024> scheduled;
+		EventScheduler<1024> pending; // audio thread only
+		std::atomic<ScorePlayer*> score{ nullptr };
+        uint64_t sampleFrame = 0;
+		double sampleRate;
+		Transport transport;
+		StreamStats stats;
 
-    PaStreamCallbackData callbackData;
+        explicit CallbackData(CallbackFunction g, InputCallback i, MidiCallback m, unsigned sampleRate)
+            :generator(g), inputGenerator(i), midiCallback(m), sampleRate(sampleRate), transport(sampleRate) {}
+
+		// Called by the backend on its own thread
+		void render(const float* in, float* out, std::size_t frames, const AudioBackend::Status& status);
+    };
 
-	PaStreamParameters outputParameters, inputParameters;
-    PaStream *stream;
-    PaError err;
+    CallbackData callbackData;
+	std::unique_ptr<ScorePlayer> scorePlayer;
+	std::unique_ptr<AudioBackend> backend;
 	bool running{ false };
 };
 
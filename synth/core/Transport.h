@@ -0,0 +1,76 @@
+#ifndef TRANSPORT_H_INCLUDED
+#define TRANSPORT_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// The position of a stream: the 64-bit frame counter of the block being rendered and the
+// steady-clock time its callback started. The audio thread writes it at the start of every
+// block, any thread may read it, a sequence counter tells the readers to retry a torn read.
+class Transport
+{
+public:
+	struct Position
+	{
+		uint64_t frame{ 0 };
+		std::size_t frames{ 0 }; // of the block
+		int64_t time{ 0 };       // in nanoseconds
+	};
+
+	explicit Transport(double sampleRate) : sampleRate(sampleRate) {}
+
+	// Nanoseconds of std::chrono::steady_clock, the clock MIDI input is stamped with
+	static int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Audio thread only
+	void startBlock(const Position& position)
+	{
+		const uint32_t s = sequence.load(std::memory_order_relaxed);
+		sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		frame.store(position.frame, std::memory_order_relaxed);
+		frames.store(position.frames, std::memory_order_relaxed);
+		time.store(position.time, std::memory_order_relaxed);
+		sequence.store(s + 2, std::memory_order_release);
+	}
+
+	Position getPosition() const
+	{
+		Position ret;
+		uint32_t before, after;
+		do {
+			before = sequence.load(std::memory_order_acquire);
+			ret.frame = frame.load(std::memory_order_relaxed);
+			ret.frames = frames.load(std::memory_order_relaxed);
+			ret.time = time.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = sequence.load(std::memory_order_relaxed);
+		} while (before != after || (before & 1));
+		return ret;
+	}
+
+	// The frame an event of the given time plays at, one block after it happened, like live MIDI
+	uint64_t frameAt(int64_t eventTime) const
+	{
+		const auto position = getPosition();
+		if (!position.frames) return position.frame; // not started yet
+		const double since = (eventTime - position.time) * 1e-9 * sampleRate;
+		return position.frame + position.frames + (since > 0. ? uint64_t(since) : 0);
+	}
+
+	double getSampleRate() const { return sampleRate; }
+
+private:
+	const double sampleRate;
+	std::atomic<uint32_t> sequence{ 0 };
+	std::atomic<uint64_t> frame{ 0 };
+	std::atomic<std::size_t> frames{ 0 };
+	std::atomic<int64_t> time{ 0 };
+};
+
+#endif //TRANSPORT_H_INCLUDED
@@ -0,0 +1,48 @@
+#ifndef TRIPLEBUFFER_H_INCLUDED
+#define TRIPLEBUFFER_H_INCLUDED
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+// Wait-free handover of the latest value from one writer thread to one reader thread.
+// The writer fills back() and publishes it, the reader takes the newest published value
+// with update(). Neither of them ever waits for the other, values the reader missed are skipped.
+template<class T>
+class TripleBuffer
+{
+public:
+	explicit TripleBuffer(const T& initial = T())
+		:slots{ initial, initial, initial }
+	{}
+
+	// The writer's slot, only valid until the next publish
+	T& back() { return slots[backIdx]; }
+
+	void publish()
+	{
+		backIdx = middle.exchange(uint8_t(backIdx | fresh), std::memory_order_acq_rel) & index;
+	}
+
+	// Returns false if nothing was published since the last update
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & fresh))
+			return false;
+		frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & index;
+		return true;
+	}
+
+	// The reader's slot, the value of the last update
+	const T& front() const { return slots[frontIdx]; }
+
+private:
+	static constexpr uint8_t index = 3, fresh = 4;
+
+	std::array<T, 3> slots;
+	uint8_t backIdx{ 0 }, frontIdx{ 1 };
+	// The slot between the two threads, with a flag telling if it was published since it was read
+	alignas(64) std::atomic<uint8_t> middle{ 2 };
+};
+
+#endif //TRIPLEBUFFER_H_INCLUDED
@@ -0,0 +1,148 @@
+#include "WavWriter.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+	const uint32_t maxRiffSize = 0xffffffff;
+
+	void put(std::vector<uint8_t>& out, uint32_t value, unsigned bytes)
+	{
+		for (unsigned i = 0; i < bytes; ++i) out.push_back(uint8_t(value >> (8 * i)));
+	}
+
+	void put(std::vector<uint8_t>& out, const char* id)
+	{
+		out.insert(out.end(), id, id + 4);
+	}
+
+	unsigned bytesPerSample(WavWriter::Format format)
+	{
+		return format == WavWriter::Format::Pcm16 ? 2 : format == WavWriter::Format::Pcm24 ? 3 : 4;
+	}
+
+	// Float files need the extended fmt chunk and a fact chunk
+	std::size_t headerSize(WavWriter::Format format)
+	{
+		return format == WavWriter::Format::Float32 ? 58 : 44;
+	}
+}
+
+WavWriter::WavWriter(const std::string& path, unsigned sampleRate, unsigned channels, Format format)
+	:file(path, std::ios::binary | std::ios::trunc),
+	path(path),
+	sampleRate(sampleRate),
+	channels(channels),
+	format(format)
+{
+	if (!file) {
+		throw std::runtime_error("Unable to open " + path + ".");
+	}
+	if (!sampleRate || !channels) {
+		throw std::invalid_argument("A WAV file needs a sample rate and channels.");
+	}
+	writeHeader();
+}
+
+WavWriter::~WavWriter()
+{
+	try {
+		close();
+	}
+	catch (...) {}
+}
+
+void WavWriter::writeHeader()
+{
+	const uint32_t blockAlign = channels * bytesPerSample(format);
+	const uint64_t dataSize = frames * blockAlign;
+	std::vector<uint8_t> header;
+	header.reserve(headerSize(format));
+	put(header, "RIFF");
+	put(header, uint32_t(headerSize(format) - 8 + dataSize), 4);
+	put(header, "WAVE");
+	put(header, "fmt ");
+	put(header, format == Format::Float32 ? 18 : 16, 4);
+	put(header, format == Format::Float32 ? 3 : 1, 2); // IEEE float or PCM
+	put(header, channels, 2);
+	put(header, sampleRate, 4);
+	put(header, sampleRate * blockAlign, 4);
+	put(header, blockAlign, 2);
+	put(header, 8 * bytesPerSample(format), 2);
+	if (format == Format::Float32) {
+		put(header, 0, 2);
+		put(header, "fact");
+		put(header, 4, 4);
+		put(header, uint32_t(frames), 4);
+	}
+	put(header, "data");
+	put(header, uint32_t(dataSize), 4);
+
+	const auto end = file.tellp();
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(header.data()), header.size());
+	if (end > std::streamoff(header.size())) file.seekp(end);
+}
+
+void WavWriter::write(const float* samples, std::size_t count)
+{
+	if (!file.is_open()) {
+		throw std::logic_error(path + " is already closed.");
+	}
+	if (count > remainingFrames()) {
+		throw std::length_error(path + " would be bigger than 4 GiB.");
+	}
+	const std::size_t n = count * channels;
+	encoded.resize(n * bytesPerSample(format));
+	if (format == Format::Float32) {
+		std::memcpy(encoded.data(), samples, n * sizeof(float)); // WAV is little endian like the platforms we run on
+	}
+	else if (format == Format::Pcm16) {
+		uint8_t* out = encoded.data();
+		for (std::size_t i = 0; i < n; ++i) {
+			const int32_t value = int32_t(std::lrint(std::clamp(samples[i], -1.f, 1.f) * 32767.f));
+			*out++ = uint8_t(value);
+			*out++ = uint8_t(value >> 8);
+		}
+	}
+	else {
+		uint8_t* out = encoded.data();
+		for (std::size_t i = 0; i < n; ++i) {
+			const int32_t value = int32_t(std::lrint(std::clamp(samples[i], -1.f, 1.f) * 8388607.f));
+			*out++ = uint8_t(value);
+			*out++ = uint8_t(value >> 8);
+			*out++ = uint8_t(value >> 16);
+		}
+	}
+	file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+	if (!file) {
+		throw std::runtime_error("Unable to write " + path + ".");
+	}
+	frames += count;
+}
+
+uint64_t WavWriter::remainingFrames() const
+{
+	const uint64_t blockAlign = channels * bytesPerSample(format);
+	return (maxRiffSize - (headerSize(format) - 8)) / blockAlign - frames;
+}
+
+void WavWriter::updateHeader()
+{
+	writeHeader();
+	file.flush();
+}
+
+void WavWriter::close()
+{
+	if (file.is_open()) {
+		writeHeader();
+		file.close();
+		if (!file) {
+			throw std::runtime_error("Unable to write " + path + ".");
+		}
+	}
+}
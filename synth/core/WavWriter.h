@@ -0,0 +1,38 @@
+#ifndef WAVWRITER_H_INCLUDED
+#define WAVWRITER_H_INCLUDED
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Writes a WAV file incrementally. The sizes in the header are patched by updateHeader and
+// close, so the file is readable up to the last update even if the program stops abruptly.
+class WavWriter
+{
+public:
+	enum class Format { Pcm16, Pcm24, Float32 };
+
+	WavWriter(const std::string& path, unsigned sampleRate, unsigned channels, Format format);
+	~WavWriter();
+
+	// Interleaved frames in [-1, 1], PCM is clipped
+	void write(const float* frames, std::size_t count);
+	// Frames that still fit into the 4 GiB limit of a RIFF file
+	uint64_t remainingFrames() const;
+	uint64_t getFrames() const { return frames; }
+	void updateHeader();
+	void close();
+
+private:
+	void writeHeader();
+
+	std::ofstream file;
+	std::string path;
+	unsigned sampleRate, channels;
+	Format format;
+	uint64_t frames{ 0 };
+	std::vector<uint8_t> encoded;
+};
+
+#endif //WAVWRITER_H_INCLUDED
@@ -0,0 +1,155 @@
+#define _USE_MATH_DEFINES
+#include "Wavetable.h"
+
+#include <AudioFile.h>
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	// In-place radix-2 FFT, the size has to be a power of 2
+	void fft(std::vector<std::complex<double>>& a, bool inverse)
+	{
+		const std::size_t n = a.size();
+		for (std::size_t i = 1, j = 0; i < n; ++i) {
+			std::size_t bit = n >> 1;
+			for (; j & bit; bit >>= 1) j ^= bit;
+			j ^= bit;
+			if (i < j) std::swap(a[i], a[j]);
+		}
+		for (std::size_t len = 2; len <= n; len <<= 1) {
+			const double angle = 2 * M_PI / len * (inverse ? 1 : -1);
+			for (std::size_t i = 0; i < n; i += len) {
+				for (std::size_t j = 0; j < len / 2; ++j) {
+					const std::complex<double> w = std::polar(1., angle * j);
+					const auto u = a[i + j], v = a[i + j + len / 2] * w;
+					a[i + j] = u + v;
+					a[i + j + len / 2] = u - v;
+				}
+			}
+		}
+		if (inverse) {
+			for (auto& x : a) x /= double(n);
+		}
+	}
+}
+
+Wavetable::Wavetable(spectrum_t spectrum)
+{
+	const unsigned n = tableSize;
+	spectrum[0] = 0; // no DC offset
+
+	levels.reserve(levelCount);
+	for (unsigned k = 0; k < levelCount; ++k) {
+		const unsigned maxHarmonic = (n / 2) >> k;
+		spectrum_t bandLimited(n, 0.);
+		for (unsigned h = 1; h <= maxHarmonic; ++h) {
+			bandLimited[h] = spectrum[h];
+			bandLimited[n - h] = spectrum[n - h];
+		}
+		fft(bandLimited, true);
+
+		std::vector<float> level(n + 1);
+		for (unsigned i = 0; i < n; ++i)
+			level[i] = float(bandLimited[i].real());
+		level[n] = level[0];
+		levels.push_back(std::move(level));
+	}
+}
+
+Wavetable::spectrum_t Wavetable::fromHarmonics(
+	const std::function<double(unsigned)>& cosAmp,
+	const std::function<double(unsigned)>& sinAmp)
+{
+	const unsigned n = tableSize;
+	spectrum_t spectrum(n, 0.);
+	for (unsigned h = 1; h < n / 2; ++h) {
+		const std::complex<double> bin = n / 2. * std::complex<double>(cosAmp(h), -sinAmp(h));
+		spectrum[h] = bin;
+		spectrum[n - h] = std::conj(bin);
+	}
+	return spectrum;
+}
+
+std::shared_ptr<const Wavetable> Wavetable::fromFunction(const std::function<double(double)>& waveform)
+{
+	std::vector<double> cycle(tableSize);
+	for (unsigned i = 0; i < tableSize; ++i)
+		cycle[i] = waveform(double(i) / tableSize);
+	return fromCycle(cycle);
+}
+
+std::shared_ptr<const Wavetable> Wavetable::fromCycle(const std::vector<double>& cycle)
+{
+	if (cycle.empty()) {
+		throw std::invalid_argument("A wavetable can not be created from an empty cycle.");
+	}
+
+	// Arbitrary cycles are normalized to peak at 1
+	double peak = 0;
+	for (double s : cycle) peak = std::max(peak, std::abs(s));
+	const double gain = peak > 0 ? 1. / peak : 0.;
+
+	// Resample to the table size with linear interpolation
+	spectrum_t spectrum(tableSize);
+	const double ratio = double(cycle.size()) / tableSize;
+	for (unsigned i = 0; i < tableSize; ++i) {
+		const double pos = i * ratio;
+		const std::size_t idx = std::size_t(pos);
+		const double frac = pos - idx;
+		const double a = cycle[idx % cycle.size()], b = cycle[(idx + 1) % cycle.size()];
+		spectrum[i] = gain * (a + frac * (b - a));
+	}
+	fft(spectrum, false);
+	return std::shared_ptr<const Wavetable>(new Wavetable(std::move(spectrum)));
+}
+
+std::shared_ptr<const Wavetable> Wavetable::fromFile(const std::string& fileName)
+{
+	AudioFile<double> file;
+	if (!file.load(fileName) || file.getNumChannels() == 0) {
+		throw std::runtime_error("Unable to load a wavetable from " + fileName);
+	}
+	return fromCycle(file.samples[0]);
+}
+
+const float* Wavetable::getLevel(double increment) const
+{
+	// The highest harmonic of level k is ((tableSize/2) >> k) * increment,
+	// which has to stay below 0.5 (the Nyquist frequency)
+	int octave;
+	std::frexp(std::abs(increment) * tableSize, &octave);
+	const unsigned k = unsigned(std::clamp(octave, 0, int(levelCount) - 1));
+	return levels[k].data();
+}
+
+// The analytic waveforms have the same phase as the ones in waves::
+
+std::shared_ptr<const Wavetable> Wavetable::sawtooth()
+{
+	static const std::shared_ptr<const Wavetable> table(new Wavetable(fromHarmonics(
+		[](unsigned) { return 0.; },
+		[](unsigned h) { return 2. / (M_PI * h); }
+	)));
+	return table;
+}
+
+std::shared_ptr<const Wavetable> Wavetable::square()
+{
+	static const std::shared_ptr<const Wavetable> table(new Wavetable(fromHarmonics(
+		[](unsigned) { return 0.; },
+		[](unsigned h) { return h % 2 ? 4. / (M_PI * h) : 0.; }
+	)));
+	return table;
+}
+
+std::shared_ptr<const Wavetable> Wavetable::triangle()
+{
+	static const std::shared_ptr<const Wavetable> table(new Wavetable(fromHarmonics(
+		[](unsigned h) { return h % 2 ? 8. / (M_PI * M_PI * h * h) : 0.; },
+		[](unsigned) { return 0.; }
+	)));
+	return table;
+}
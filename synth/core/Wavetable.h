@@ -0,0 +1,50 @@
+#ifndef WAVETABLE_H_INCLUDED
+#define WAVETABLE_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include <complex>
+#include <string>
+#include <functional>
+
+// One cycle of a waveform, stored as band-limited mip levels (one per octave).
+// Level k contains harmonics up to (tableSize/2) >> k, so the oscillator can
+// always pick a level whose harmonics stay below the Nyquist frequency.
+class Wavetable
+{
+public:
+	static constexpr unsigned tableSize = 2048;
+	static constexpr unsigned levelCount = 11;
+
+	static std::shared_ptr<const Wavetable> fromFunction(const std::function<double(double)>& waveform);
+	static std::shared_ptr<const Wavetable> fromCycle(const std::vector<double>& cycle);
+	// The first channel of the file is taken as a single cycle
+	static std::shared_ptr<const Wavetable> fromFile(const std::string& fileName);
+
+	static std::shared_ptr<const Wavetable> sawtooth();
+	static std::shared_ptr<const Wavetable> square();
+	static std::shared_ptr<const Wavetable> triangle();
+
+	// The mip level to be used for an oscillator advancing by the given phase per sample
+	const float* getLevel(double increment) const;
+
+	// Linear interpolation, phase is in [0, 1)
+	static double lookup(const float* level, double phase)
+	{
+		const double pos = phase * tableSize;
+		const unsigned idx = unsigned(pos);
+		const double frac = pos - idx;
+		return level[idx] + frac * (level[idx + 1] - level[idx]);
+	}
+
+private:
+	using spectrum_t = std::vector<std::complex<double>>;
+
+	explicit Wavetable(spectrum_t spectrum);
+	// Spectrum of a waveform given with its cosine and sine harmonic amplitudes
+	static spectrum_t fromHarmonics(const std::function<double(unsigned)>& cosAmp, const std::function<double(unsigned)>& sinAmp);
+
+	std::vector<std::vector<float>> levels; // tableSize+1 samples each, the last one wraps around
+};
+
+#endif //WAVETABLE_H_INCLUDED
@@ -0,0 +1,88 @@
+#include "dsp.h"
+
+#include <algorithm>
+#include <cmath>
+
+DelayLine::DelayLine(unsigned sampleRate, double maxLength, double coeff, bool pingPong)
+	:coeff(coeff),
+	length(maxLength),
+	pingPong(pingPong),
+	sampleRate(sampleRate),
+	maxDelay(std::max(1., maxLength * sampleRate)),
+	delay(maxDelay),
+	smoothing(1. - std::exp(-1. / (glideTime * sampleRate)))
+{
+	// One more frame is read for the interpolation
+	std::size_t size = 1;
+	while (size < std::size_t(maxDelay) + 2) size *= 2;
+	mask = size - 1;
+	left.assign(size, 0.f);
+	right.assign(size, 0.f);
+}
+
+void DelayLine::process(float* block, std::size_t frames)
+{
+	// The controls are read once per block
+	const float coeff = float(this->coeff.load());
+	const bool pingPong = this->pingPong.load();
+	const double target = std::clamp(length.load() * sampleRate, 1., maxDelay);
+	float* left = this->left.data();
+	float* right = this->right.data();
+	double delay = this->delay;
+	std::size_t writeIdx = this->writeIdx;
+
+	for (std::size_t i = 0; i < frames; ++i) {
+		delay += (target - delay) * smoothing;
+		const std::size_t whole = std::size_t(delay);
+		const float frac = float(delay - whole);
+		const std::size_t newer = (writeIdx - whole) & mask, older = (newer - 1) & mask;
+		const float echoLeft = left[newer] + (left[older] - left[newer]) * frac;
+		const float echoRight = right[newer] + (right[older] - right[newer]) * frac;
+
+		float& outLeft = block[2 * i];
+		float& outRight = block[2 * i + 1];
+		if (pingPong) {
+			// The input enters on the left, every echo moves to the other side
+			left[writeIdx] = (outLeft + outRight) * .5f + echoRight * coeff;
+			right[writeIdx] = echoLeft * coeff;
+		}
+		outLeft += echoLeft * coeff;
+		outRight += echoRight * coeff;
+		if (!pingPong) {
+			left[writeIdx] = outLeft;
+			right[writeIdx] = outRight;
+		}
+		writeIdx = (writeIdx + 1) & mask;
+	}
+
+	// Close enough to stop gliding, the read position stays put then
+	this->delay = std::abs(target - delay) < 1e-6 ? target : delay;
+	this->writeIdx = writeIdx;
+}
+
+VolumeRamp::VolumeRamp(double volume)
+	:amp(volume)
+{}
+
+void VolumeRamp::setVolume(double volume)
+{
+	amp.setValueLinear(volume, lastTime, rampTime);
+}
+
+void VolumeRamp::process(double t, StereoSample& sample)
+{
+	lastTime = t;
+	const double gain = amp.getValue(t);
+	sample.left *= gain;
+	sample.right *= gain;
+}
+
+void VolumeRamp::process(float* block, std::size_t frames, uint64_t startFrame)
+{
+	for (std::size_t i = 0; i < frames; ++i) {
+		StereoSample sample{ block[2 * i], block[2 * i + 1] };
+		process(timing::frameToTime(startFrame + i), sample);
+		block[2 * i] = float(sample.left);
+		block[2 * i + 1] = float(sample.right);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef DSP_H_INCLUDED
+#define DSP_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "generators.h"
+
+// The signal processing of the effects, without their sliders and buttons,
+// so it also runs where there is no window (the benchmark suite)
+
+// Feedback delay on a power of two ring buffer per channel. The delay time glides to the
+// target length, read once per block, so changing it bends the pitch instead of clicking.
+class DelayLine
+{
+public:
+	DelayLine(unsigned sampleRate, double maxLength, double coeff, bool pingPong = false);
+	DelayLine(const DelayLine&) = delete;
+	DelayLine& operator=(const DelayLine&) = delete;
+
+	// Adds the echoes to interleaved stereo frames in place
+	void process(float* block, std::size_t frames);
+
+	// Controls from any thread, read once per block. With pingPong, the echoes of the mono
+	// input bounce between the sides, otherwise the echoes of each channel stay on their side.
+	std::atomic<double> coeff;
+	std::atomic<double> length; // target delay in seconds, at most maxLength
+	std::atomic<bool> pingPong;
+
+private:
+	static constexpr double glideTime = 0.05; // time constant of the delay time, in seconds
+
+	unsigned sampleRate;
+	double maxDelay;                // in frames
+	double delay;                   // current delay in frames
+	double smoothing;               // one pole coefficient of the glide
+	std::size_t writeIdx{ 0 }, mask;
+	std::vector<float> left, right; // the same power of two length
+};
+
+// Gain which ramps to every new volume in a few ms, so a jump does not click
+class VolumeRamp
+{
+public:
+	explicit VolumeRamp(double volume = 1.);
+
+	// From any thread
+	void setVolume(double volume);
+	void process(double t, StereoSample& sample);
+	// Interleaved stereo frames in place
+	void process(float* block, std::size_t frames, uint64_t startFrame);
+
+private:
+	static constexpr double rampTime = 0.005;
+
+	std::atomic<double> lastTime{ 0. };
+	ContinuousFunction amp;
+};
+
+#endif //DSP_H_INCLUDED
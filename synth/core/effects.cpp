@@ -7,38 +7,98 @@
 #include <sstream>
 #include <filesystem>
 
-DebugEffect::DebugEffect()
+DebugEffect::DebugEffect(unsigned sampleRate)
 	:impl{ std::make_shared<Impl>() }
 {
+	auto& _impl = *impl;
+	_impl.oscilloscope = std::make_shared<Oscilloscope>(500, 200, sampleRate);
+	_impl.received.resize(_impl.scopeSamples.capacity());
 	auto aabb = impl->oscilloscope->AABB();
 	frame->setSize(SynthVec2(aabb.width+20, aabb.height+40));
 	impl->maxSampText = TextDisplay::DefaultText("0                  \n", 20);
 	impl->eventText = TextDisplay::DefaultText(getMidiEventInfo(MidiEvent()), 20);
+	impl->streamText = TextDisplay::DefaultText(StreamStats().summary(), 20);
+	impl->windowText = TextDisplay::DefaultText("20 ms     ", 20);
+	// The window is set on a logarithmic scale, from 1 ms to 10 s
+	_impl.sliderWindow = Slider::DefaultSlider("Window", std::log10(Oscilloscope::minWindow), std::log10(Oscilloscope::maxWindow),
+		[impl = impl.get()](const Slider& slider) {
+			const double window = std::pow(10., slider.getValue());
+			impl->oscilloscope->setWindow(window);
+			impl->windowText->setText(window < 1. ? std::to_string(int(std::lround(window * 1000))) + " ms" : std::to_string(window).substr(0, 4) + " s");
+		});
+	_impl.sliderWindow->setValue(std::log10(impl->oscilloscope->getWindow()));
+	_impl.triggerButton = Button::OnOffButton(_impl.trigger, [impl = impl.get()](bool on) {
+		impl->oscilloscope->setTrigger(on);
+	});
 	addToggleButton();
 
+	auto scopeReader = std::make_shared<EmptyGuiElement>();
+	scopeReader->setOnDraw([impl = this->impl]() { impl->showScope(); });
+	frame->addChild(scopeReader);
 	frame->addChildAutoPos( impl->oscilloscope );
+	frame->addChildAutoPos( _impl.sliderWindow );
+	frame->addChildAutoPos( impl->windowText );
+	frame->addChildAutoPos( TextDisplay::DefaultText("Trigger", 20) );
+	frame->addChildAutoPos( _impl.triggerButton );
 	frame->addChildAutoPos( TextDisplay::DefaultText("Max sample:", 20) );
 	frame->addChildAutoPos( impl->maxSampText );
 	frame->addChildAutoPos( impl->eventText );
+	frame->addChildAutoPos( impl->streamText );
 	frame->addChild(std::make_unique<EmptyGuiElement>([impl = this->impl](const MidiEvent & event) {
 		impl->eventText->setText(getMidiEventInfo(event));
 	}));
 	frame->fitToChildren();
 }
 
-void DebugEffect::effectImpl(double t, double & sample) const
+void DebugEffect::effectImpl(double t, StereoSample& sample) const
 {
+	impl->scopeSamples.push(float(sample.left + sample.right) / 2);
+	impl->addSample(float(std::max(sample.left, sample.right)));
+}
+
+void DebugEffect::processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const
+{
+	// The audio thread only hands the samples over, the widgets are updated when the GUI draws them
 	auto& _impl = *impl;
-	auto& lastSamples = _impl.lastSamples;
-	lastSamples[_impl.sampleId++] = sample;
-	if (_impl.sampleId == 500) {
-		_impl.oscilloscope->newSamples(lastSamples);
-		_impl.sampleId = 0;
-		_impl.maxSampText->setText(std::to_string(impl->maxSamp));
-		_impl.maxSamp = 0;
+	std::array<float, 256> mono;
+	for (std::size_t begin = 0; begin < frames; begin += mono.size()) {
+		const std::size_t n = std::min(mono.size(), frames - begin);
+		for (std::size_t j = 0; j < n; ++j) {
+			const float left = block[2 * (begin + j)], right = block[2 * (begin + j) + 1];
+			mono[j] = (left + right) / 2;
+			_impl.addSample(std::max(left, right));
+		}
+		_impl.scopeSamples.pushBlock(mono.data(), n);
 	}
-	if (sample > _impl.maxSamp) {
-		_impl.maxSamp = sample;
+}
+
+void DebugEffect::Impl::addSample(float sample)
+{
+	maxSamp = std::max(maxSamp, double(sample));
+	if (++sampleId == peakPeriod) {
+		peak.back() = maxSamp;
+		peak.publish();
+		sampleId = 0;
+		maxSamp = 0;
+	}
+}
+
+void DebugEffect::Impl::showScope()
+{
+	// The samples queued while the scope was hidden are dropped, it starts from the newest ones
+	const auto now = std::chrono::steady_clock::now();
+	if (now - lastShown > hiddenAfter) scopeSamples.popBlock(received.data(), received.size());
+	lastShown = now;
+	const std::size_t n = scopeSamples.popBlock(received.data(), received.size());
+	if (n) oscilloscope->addSamples(received.data(), n);
+	if (peak.update()) maxSampText->setText(std::to_string(peak.front()));
+	// The audio thread only counts, the text is made here when callbacks have run since the last frame
+	if (const auto* stats = streamStats.load()) {
+		const uint64_t callbacks = stats->snapshot().callbacks;
+		if (callbacks != shownCallbacks) {
+			shownCallbacks = callbacks;
+			streamText->setText(stats->summary());
+		}
 	}
 }
 
@@ -67,26 +127,23 @@ VolumeControl::VolumeControl()
 	configFrame->fitToChildren();
 }
 
-void VolumeControl::effectImpl(double t, double & sample) const
+void VolumeControl::effectImpl(double t, StereoSample& sample) const
 {
-	impl->lastTime = t;
-	sample *= impl->amp.getValue(t);
+	impl->volume.process(t, sample);
 }
 
-DelayEffect::DelayEffect(unsigned sampleRate, double echoLength, double coeffArg, unsigned nChannels)
-	:impl{ std::make_shared<Impl>() },
-	nChannels(nChannels)
+void VolumeControl::processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const
+{
+	impl->volume.process(block, frames, startFrame);
+}
+
+DelayEffect::DelayEffect(unsigned sampleRate, double echoLength, double coeffArg, Mode mode)
+	:impl{ std::make_shared<Impl>(sampleRate, echoLength, coeffArg, mode) }
 {
 	auto& _impl = *impl;
-	
-	sampleRate *= nChannels;
 
-	_impl.coeff = coeffArg;
-	_impl.length = echoLength;
-	_impl.sampleRate = sampleRate;
-	_impl.echoBuf = std::vector<double>(unsigned(sampleRate * echoLength), 0);
-	_impl.sliderCoeff = Slider::DefaultSlider("Intensity", 0, 1, _impl.coeff);
-	_impl.sliderTime = Slider::DefaultSlider("Time", 0.02, echoLength, _impl.length);
+	_impl.sliderCoeff = Slider::DefaultSlider("Intensity", 0, 1, _impl.delay.coeff);
+	_impl.sliderTime = Slider::DefaultSlider("Time", 0.02, echoLength, _impl.delay.length);
 
 	auto aabbCoeff = impl->sliderCoeff->AABB();
 	setWidth(aabbCoeff.width * 4);
@@ -94,6 +151,8 @@ DelayEffect::DelayEffect(unsigned sampleRate, double echoLength, double coeffArg
 	frame->addChildAutoPos(impl->sliderCoeff);
 	frame->addChildAutoPos(_impl.sliderTime);
 	addToggleButton();
+	frame->addChildAutoPos(TextDisplay::DefaultText("Ping-pong", 14));
+	frame->addChildAutoPos(std::shared_ptr<Button>(Button::OnOffButton(_impl.delay.pingPong)));
 	frame->fitToChildren();
 
 	configFrame->addChildAutoPos(std::make_unique<TextDisplay>("Delay settings", 0, getConfig("defaultTextHeight"), 16));
@@ -102,13 +161,17 @@ DelayEffect::DelayEffect(unsigned sampleRate, double echoLength, double coeffArg
 	configFrame->fitToChildren();
 }
 
-void DelayEffect::effectImpl(double t, double & sample) const
+void DelayEffect::effectImpl(double t, StereoSample& sample) const
 {
-	auto& _impl = *impl;
-	unsigned idx = _impl.sampleId % unsigned(_impl.sampleRate * _impl.length);
-	sample += _impl.echoBuf[idx] * _impl.coeff;
-	_impl.echoBuf[idx] = sample;
-	++_impl.sampleId;
+	float frame[2]{ float(sample.left), float(sample.right) };
+	processBlockImpl(frame, 1, 0);
+	sample.left = frame[0];
+	sample.right = frame[1];
+}
+
+void DelayEffect::processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const
+{
+	impl->delay.process(block, frames);
 }
 
 Glider::Impl::Impl(const TimbreModel& model) 
@@ -132,10 +195,10 @@ Glider::Glider(const TimbreModel& model, const std::vector<Note>& notes, unsigne
 	configFrame->fitToChildren();
 }
 
-void Glider::effectImpl(double t, double & sample) const
+void Glider::effectImpl(double t, StereoSample& sample) const
 {
 	impl->glidingTone.modifyMainPitch(t, impl->glidePitch.getValue(t));
-	sample = impl->glidingTone.getSample(t).value_or(0.) / maxNotes;
+	sample.left = sample.right = impl->glidingTone.getSample(t).value_or(0.) / maxNotes;
 	impl->lastTime = t;
 }
 void Glider::onKeyEvent(unsigned keyIdx, SynthKey::State keyState)
@@ -153,15 +216,16 @@ void Glider::onKeyEvent(unsigned keyIdx, SynthKey::State keyState)
 SaveToFile::SaveToFile(
 	const std::string& fname,
 	unsigned sampleRate,
-	unsigned channels)
+	WavWriter::Format format)
 	:impl( std::make_shared<Impl>() )
 {
 	impl->fname = fname;
 	impl->sampleRate = sampleRate;
-	impl->channels = channels;
+	impl->isFloat = format == WavWriter::Format::Float32;
 	
 	auto inputField = std::make_shared<InputField>(InputField::Alpha, 150, getConfig("defaultTextHeight"));
 	inputField->setOnEnd([impl = this->impl, inputField]() {
+		std::lock_guard lock(impl->mtx);
 		impl->fname = inputField->getText();
 	});
 
@@ -189,53 +253,148 @@ SaveToFile::SaveToFile(
 
 	// Default file name
 
-
+	auto resultReader = std::make_shared<EmptyGuiElement>();
+	resultReader->setOnDraw([impl = this->impl]() { impl->showResult(); });
+	frame->addChild(resultReader);
 	frame->setChildAlignment(15);
 	frame->addChildAutoPos(impl->onOff);
 	frame->newLine();
 	frame->addChildAutoPos(TextDisplay::DefaultText("File name: ", 14));
 	frame->addChildAutoPos(inputField);
 	frame->newLine();
+	frame->addChildAutoPos(TextDisplay::DefaultText("32-bit float: ", 14));
+	frame->addChildAutoPos(std::shared_ptr<Button>(Button::OnOffButton(impl->isFloat)));
+	frame->newLine();
 	frame->addChildAutoPos(impl->displayResult);
-	frame->setSize({450, 200});
+	frame->setSize({450, 250});
 }
 
-void SaveToFile::effectImpl(double t, double& sample) const
+void SaveToFile::effectImpl(double t, StereoSample& sample) const
+{
+	float frame[2]{ float(sample.left), float(sample.right) };
+	processBlockImpl(frame, 1, 0);
+}
+
+void SaveToFile::processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const
 {
 	auto& _impl = *impl;
-	if (_impl.isOn) {
-		std::lock_guard lock(_impl.mtx);
-		_impl.buffer[_impl.channelId].push_back(sample);
-		_impl.channelId = (_impl.channelId + 1) % _impl.channels;
+	if (!_impl.recording.load(std::memory_order_acquire)) return;
+	// Only whole frames go to the ring, the writer never sees half of one
+	const std::size_t fits = std::min(frames, (_impl.ring.capacity() - _impl.ring.size()) / 2);
+	_impl.ring.pushBlock(block, 2 * fits);
+	if (fits < frames) {
+		_impl.droppedFrames.store(_impl.droppedFrames.load(std::memory_order_relaxed) + frames - fits, std::memory_order_relaxed);
 	}
 }
 
+SaveToFile::Impl::~Impl()
+{
+	stop();
+}
+
 void SaveToFile::Impl::start()
 {
-	buffer.resize(channels);
-	for(auto& channel: buffer) channel.clear();
-	channelId = 0;
+	stop();
+	// Frames pushed while the last recording was closing
+	float stale[256];
+	while (ring.popBlock(stale, 256)) {}
+	droppedFrames = 0;
+
+	const std::string path = dirName + '/' + fname;
+	const auto format = isFloat ? WavWriter::Format::Float32 : WavWriter::Format::Pcm24;
+	std::unique_ptr<WavWriter> file;
+	try {
+		file = std::make_unique<WavWriter>(path + ".wav", sampleRate, 2, format);
+	}
+	catch (const std::exception& e) {
+		// Shown on the next draw, once the click which called this has switched the button on
+		publishResult("Failed to save: "s + e.what(), true);
+		return;
+	}
+	recording.store(true, std::memory_order_release);
+	writer = std::thread([this, path, format, file = std::move(file)]() mutable {
+		writeLoop(std::move(file), path, format);
+	});
 	displayResult->setText("Recording"s);
 }
 
 void SaveToFile::Impl::stop()
 {
-	std::size_t n = std::numeric_limits<std::size_t>::max();
-	for (const auto& channel : buffer) n = std::min(n, channel.size());
-	for (auto& channel : buffer) 
-		channel.resize(n); // keep the same amount of samples on each channel
-	if (buffer.size() && n) {
-		AudioFile<double> file;
-		file.setAudioBuffer(buffer);
-		file.setNumChannels(channels);
-		file.setNumSamplesPerChannel(n);
-		file.setBitDepth(24);
-		file.setSampleRate(sampleRate);
-		if (file.save(dirName + '/' + fname + ".wav", AudioFileFormat::Wave)) {
-			displayResult->setText("Saved"s);
-		}
-		else {
-			displayResult->setText("Failed to save"s);
+	recording.store(false);
+	if (writer.joinable()) {
+		writer.join();
+	}
+	showResult();
+}
+
+void SaveToFile::Impl::writeLoop(std::unique_ptr<WavWriter> file, std::string path, WavWriter::Format format)
+{
+	const std::size_t chunkFrames = 4096;
+	std::vector<float> chunk(2 * chunkFrames);
+	std::string current = path + ".wav";
+	unsigned part = 1;
+	uint64_t lastUpdate = 0;
+	try {
+		for (;;) {
+			// Checked before draining, so every frame pushed before the stop is written
+			const bool stopping = !recording.load();
+			const std::size_t frames = ring.popBlock(chunk.data(), chunk.size()) / 2;
+			if (!frames) {
+				if (stopping) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				continue;
+			}
+
+			for (std::size_t written = 0; written < frames;) {
+				if (!file->remainingFrames()) {
+					file->close();
+					current = path + "_" + std::to_string(++part) + ".wav";
+					file = std::make_unique<WavWriter>(current, sampleRate, 2, format);
+					lastUpdate = 0;
+				}
+				const std::size_t n = std::size_t(std::min<uint64_t>(frames - written, file->remainingFrames()));
+				file->write(chunk.data() + 2 * written, n);
+				written += n;
+			}
+			// A crash loses at most a second of the recording
+			if (file->getFrames() - lastUpdate >= sampleRate) {
+				file->updateHeader();
+				lastUpdate = file->getFrames();
+			}
 		}
+		file->close();
+		std::string saved = "Saved " + current;
+		if (droppedFrames) saved += ", " + std::to_string(droppedFrames) + " frames dropped";
+		publishResult(saved, false);
+	}
+	catch (const std::exception& e) {
+		recording = false;
+		log("Recording to "s + current + " failed: " + e.what());
+		publishResult("Failed to save: "s + e.what(), true);
+	}
+}
+
+void SaveToFile::Impl::publishResult(const std::string& text, bool failure)
+{
+	std::lock_guard lock(resultMtx);
+	result = text;
+	failed = failure;
+	hasResult.store(true, std::memory_order_release);
+}
+
+void SaveToFile::Impl::showResult()
+{
+	if (!hasResult.exchange(false, std::memory_order_acquire)) return;
+	std::string text;
+	bool failure;
+	{
+		std::lock_guard lock(resultMtx);
+		text = result;
+		failure = failed;
+	}
+	displayResult->setText(text);
+	if (failure) {
+		isOn = false;
+		onOff->setOnOff(false);
 	}
-}
\ No newline at end of file
+}
@@ -1,11 +1,11 @@
 #ifndef EFFECTS_H_DEFINED
 #define EFFECTS_H_DEFINED
 
-#include <AudioFile.h>
-
 #include <string>
 #include <memory>
 #include <tuple>
+#include <thread>
+#include <chrono>
 #include "generators.h"
 #include "../gui/Slider.h"
 #include "../gui/Button.h"
@@ -13,6 +13,11 @@
 #include "../gui/Window.h"
 #include "../gui/events.h"
 #include "utility.h"
+#include "StreamStats.h"
+#include "WavWriter.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+#include "dsp.h"
 
 class EffectBase
 {
@@ -31,12 +36,16 @@ public:
 	const std::shared_ptr<Frame> getFrame() const { return frame; }
 	const std::shared_ptr<Frame> getConfigFrame() const { return configFrame; }
 	bool isActive() const { return *active; }
+	// Called from the GUI thread when the toggle button is clicked, with the new state
+	void setOnToggle(std::function<void(bool)> callback) { *onToggle = callback; }
 
 protected:
 	void addToggleButton()
 	{
 		*active = false;
-		std::shared_ptr<Button> activateButton{ Button::OnOffButton(*active) };
+		std::shared_ptr<Button> activateButton{ Button::OnOffButton(*active, [onToggle = this->onToggle](bool on) {
+			if (*onToggle) (*onToggle)(on);
+		}) };
 		frame->addChildAutoPos(activateButton);
 	}
 	void setWidth(unsigned width) { frame->setSize(SynthVec2(width, 0)); }
@@ -45,6 +54,7 @@ protected:
 
 private:
 	std::shared_ptr< std::atomic<bool> > active{ std::make_shared<std::atomic<bool>>(true) };
+	std::shared_ptr< std::function<void(bool)> > onToggle{ std::make_shared<std::function<void(bool)>>() };
 };
 
 template<class T, class param_t>
@@ -57,16 +67,43 @@ public:
 			static_cast<const T*>(this)->effectImpl(t, sample);
 		}
 	}
+
+	// Processes interleaved stereo frames in place. Being active is up to the EffectGraph running it.
+	void processBlock(float* block, std::size_t frames, uint64_t startFrame) const
+	{
+		static_cast<const T*>(this)->processBlockImpl(block, frames, startFrame);
+	}
+
+protected:
+	// Fallback for effects which work one frame at a time
+	void processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const
+	{
+		static_assert(std::is_same_v<param_t, StereoSample>, "Only stereo effects process blocks.");
+		for (std::size_t i = 0; i < frames; ++i) {
+			StereoSample sample{ block[2 * i], block[2 * i + 1] };
+			static_cast<const T*>(this)->effectImpl(timing::frameToTime(startFrame + i), sample);
+			block[2 * i] = float(sample.left);
+			block[2 * i + 1] = float(sample.right);
+		}
+	}
 };
 
 template<class Effect_t>
 using PostSampleEffect = PerSampleEffectBase<Effect_t, double>;
 
-class DebugEffect: public PostSampleEffect<DebugEffect>
+// Effects working on whole stereo frames
+template<class Effect_t>
+using StereoEffect = PerSampleEffectBase<Effect_t, StereoSample>;
+
+class DebugEffect: public StereoEffect<DebugEffect>
 {
 public:
-	DebugEffect();
-	void effectImpl(double t, double& sample) const;
+	DebugEffect(unsigned sampleRate);
+	void effectImpl(double t, StereoSample& sample) const;
+	void processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const;
+	// Shows the timing of the audio callback, the stats must outlive the effect.
+	// They are read and formatted on the GUI thread only, while the scope is drawn.
+	void showStreamStats(const StreamStats& stats) { impl->streamStats = &stats; }
 
 private:
 
@@ -74,63 +111,85 @@ private:
 
 	struct Impl
 	{
-		const unsigned resolution = 500;
-		std::shared_ptr<Oscilloscope> oscilloscope{ std::make_shared<Oscilloscope>(500, 200, resolution) };
-		std::shared_ptr<TextDisplay> maxSampText, eventText;
-		std::vector<double> lastSamples = std::vector<double>( resolution, 0. );
-		double maxSamp;
+		const unsigned peakPeriod = 500;
+		std::shared_ptr<Oscilloscope> oscilloscope;
+		std::shared_ptr<TextDisplay> maxSampText, eventText, streamText, windowText;
+		std::shared_ptr<Slider> sliderWindow;
+		std::atomic<bool> trigger{ true };
+		std::shared_ptr<Button> triggerButton;
+		std::atomic<const StreamStats*> streamStats{ nullptr };
+		uint64_t shownCallbacks{ 0 }; // GUI thread
+		// Without a draw for that long, the scope was hidden
+		static constexpr std::chrono::milliseconds hiddenAfter{ 200 };
+		std::chrono::steady_clock::time_point lastShown{}; // GUI thread
+		// The audio thread hands every sample to the scope and the peak of every peakPeriod samples,
+		// about 1.5 seconds of samples are kept while the scope is not drawn
+		SpscQueue<float, (1 << 16)> scopeSamples;
+		TripleBuffer<double> peak;
+		double maxSamp{ 0. };
 		unsigned sampleId{ 0 };
+		std::vector<float> received;
+
+		void addSample(float mono);
+		// On the GUI thread, once per drawn frame
+		void showScope();
 	};
 
 	std::shared_ptr<Impl> impl;
 };
 
-class VolumeControl : public PostSampleEffect<VolumeControl>
+class VolumeControl : public StereoEffect<VolumeControl>
 {
 public:
 	VolumeControl();
-	void effectImpl(double t, double& sample) const;
+	void effectImpl(double t, StereoSample& sample) const;
+	void processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const;
 
 private:
 	struct Impl
 	{
-		std::atomic<double> lastTime{ 0. };
-		ContinuousFunction amp;
+		VolumeRamp volume;
 		std::shared_ptr<Slider> sliderVolume = Slider::DefaultSlider("Volume", 0, 1, [this](const Slider& sliderVolume) {
-			amp.setValueLinear(sliderVolume.getValue(), lastTime, 0.005);
+			volume.setVolume(sliderVolume.getValue());
 		});
 	};
 
 	std::shared_ptr<Impl> impl;
 };
 
-class DelayEffect: public PostSampleEffect<DelayEffect>
+// Feedback delay with sliders for the feedback and the delay time, see DelayLine
+class DelayEffect: public StereoEffect<DelayEffect>
 {
 public:
+	// Stereo keeps the echoes of each channel on their side,
+	// PingPong bounces the echoes of the mono input between the sides
+	enum class Mode { Stereo, PingPong };
+
 	DelayEffect( 
 		unsigned sampleRate, 
 		double echoLength,
 		double echoCoeff,
-		unsigned nChannels = 2
+		Mode mode = Mode::Stereo
 	);
-	void effectImpl(double t, double& sample) const;
+	void effectImpl(double t, StereoSample& sample) const;
+	void processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const;
 
 private:
 	struct Impl
 	{
-		std::atomic<double> coeff;
-		std::atomic<double> length;
-		unsigned sampleRate, sampleId{ 0 };
-		std::vector<double> echoBuf;
+		Impl(unsigned sampleRate, double echoLength, double echoCoeff, Mode mode)
+			:delay(sampleRate, echoLength, echoCoeff, mode == Mode::PingPong)
+		{}
+
+		DelayLine delay;
 		std::shared_ptr<Slider> sliderCoeff;
 		std::shared_ptr<Slider> sliderTime;
 	};
 
 	std::shared_ptr<Impl> impl;
-	const unsigned nChannels;
 };
 
-class Glider : public PostSampleEffect<Glider>
+class Glider : public StereoEffect<Glider>
 {
 public:
 	Glider(
@@ -139,7 +198,7 @@ public:
 		unsigned maxNotes
 	);
 	void onKeyEvent(unsigned keyIdx, SynthKey::State keyState);
-	void effectImpl(double t, double & sample) const;
+	void effectImpl(double t, StereoSample& sample) const;
 
 private:
 	struct Impl
@@ -157,17 +216,21 @@ private:
 	std::shared_ptr<Impl> impl;
 };
 
-class SaveToFile : public PostSampleEffect<SaveToFile>
+// Records the output to Records/<name>.wav. The audio thread only copies the frames into a
+// ring buffer, a writer thread streams them to disk and updates the header every second.
+// Recordings over 4 GiB continue in <name>_2.wav, <name>_3.wav and so on.
+class SaveToFile : public StereoEffect<SaveToFile>
 {
 public:
 
 	SaveToFile(
 		const std::string& fname,
 		unsigned sampleRate,
-		unsigned channels
+		WavWriter::Format format = WavWriter::Format::Pcm24
 	);
 
-	void effectImpl(double t, double& sample) const;
+	void effectImpl(double t, StereoSample& sample) const;
+	void processBlockImpl(float* block, std::size_t frames, uint64_t startFrame) const;
 
 	void start(){impl->isOn = true;impl->start();}
 	void stop() {impl->isOn = false;impl->stop();}
@@ -176,16 +239,32 @@ public:
 private:
 	struct Impl
 	{
+		~Impl();
+
 		const std::string dirName{"Records"};
 		std::string fname;
-		AudioFile<double>::AudioBuffer buffer;
-		unsigned channelId = 0, sampleRate, channels;
-		std::atomic<bool> isOn{ false };
+		unsigned sampleRate;
+		std::atomic<bool> isOn{ false }, isFloat{ false };
+		std::atomic<bool> recording{ false }; // the audio thread writes to the ring
 		std::mutex mtx; // fname, sampleId, sampleRate may change from other threads
 		std::shared_ptr<TextDisplay> displayResult;
 
+		// The writer thread publishes its result, the GUI thread shows it
+		std::mutex resultMtx;
+		std::string result;
+		bool failed{ false };
+		std::atomic<bool> hasResult{ false };
+
+		// About 10 seconds of stereo frames at 48 kHz, frames which do not fit are dropped
+		SpscQueue<float, (1 << 20)> ring;
+		std::atomic<uint64_t> droppedFrames{ 0 };
+		std::thread writer;
+
 		void start();
 		void stop();
+		void writeLoop(std::unique_ptr<WavWriter> file, std::string path, WavWriter::Format format);
+		void publishResult(const std::string& text, bool failure);
+		void showResult();
 
 		std::shared_ptr<Button> onOff{ Button::OnOffButton(isOn, [this](bool on) {
 			std::lock_guard lock(mtx);
@@ -217,27 +296,37 @@ public:
 		frame->fitToChildren();
 		sliderPitch->setFixed(true);
 
-		frame->addChild(std::make_unique<EmptyGuiElement>([sliderPitch = this->sliderPitch](const MidiEvent & event) {
-			if (event.getType() == MidiEvent::Type::WHEEL) {
-				sliderPitch->setValue(event.getWheelValueNorm() * 2. - 1);
-			}
-		}));
+		// The slider follows the pitch wheel when it is drawn, the wheel has bent the voices already
+		auto wheelReader = std::make_shared<EmptyGuiElement>();
+		wheelReader->setOnDraw([sliderPitch = this->sliderPitch, wheel = this->wheel]() {
+			const double bend = wheel->exchange(std::nan(""));
+			if (!std::isnan(bend)) sliderPitch->showValue(bend);
+		});
+		frame->addChild(wheelReader);
 
 		configFrame->addChildAutoPos(std::make_unique<TextDisplay>("Pitch bend settings", 0, getConfig("defaultTextHeight"), 16));
 		configFrame->addChildAutoPos(sliderPitch->getConfigFrame());
 		configFrame->fitToChildren();
 	}
 
+	// The slider sets the pitch through this, by default straight on the generator
+	void setPitchSetter(std::function<void(double freq)> setter) { setPitch = std::move(setter); }
+
+	// From the audio thread between blocks, bend in [-1, 1]
+	void onPitchWheel(double bend, uint64_t frame)
+	{
+		if (!isActive()) return;
+		generator.playMainPitch(generator.getMainFreq() + bend * 1 / 9 * generator.getMainFreq(), frame);
+		wheel->store(bend);
+	}
+
 private:
 	SampleGenerator_T& generator;
+	std::function<void(double freq)> setPitch{ [&generator = generator](double freq) { generator.setMainPitch(freq); } };
+	std::shared_ptr<std::atomic<double>> wheel{ std::make_shared<std::atomic<double>>(std::nan("")) };
 	std::shared_ptr<Slider> sliderPitch{ Slider::DefaultSlider("Pitch", -1, 1, [this](const Slider & sliderPitch) {
 		if (isActive()) {
-			std::lock_guard lock(generator);
-			//generator.q = std::pow(2., sliderPitch.getValue());
-			generator.modifyMainPitch(
-				generator.time(),
-				generator.getMainFreq() + sliderPitch.getValue() * 1 / 9 * generator.getMainFreq()
-			);
+			setPitch(generator.getMainFreq() + sliderPitch.getValue() * 1 / 9 * generator.getMainFreq());
 		}
 	}) };
 };
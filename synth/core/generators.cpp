@@ -1,111 +1,145 @@
 #include "generators.h"
+#include "PartialBank.h"
 #include "../core/tones.h"
 
-namespace waves
+namespace timing
 {
-    namespace
-    {
-        static const double TAU = M_PI*2;
-    }
-
-    double sine(double time, double amp, double freq, double phase)
-    {
-        return amp*::sin((time+phase)*freq*TAU);
-    }
+	namespace
+	{
+		unsigned currentSampleRate = 44100;
+		double currentSampleTime = 1. / currentSampleRate;
+	}
 
-    double square(double time, double amp, double freq, double phase)
-    {
-        const double period = 1/freq;
-        if (fmod(time+phase, period) < period/2)
-            return amp;
-        else
-            return -amp;
-    }
+	void setSampleRate(unsigned sampleRate)
+	{
+		currentSampleRate = sampleRate;
+		currentSampleTime = 1. / sampleRate;
+	}
 
-    double triangle(double time, double amp, double freq, double phase)
-    {
-        const double period = 1/freq;
-        const double half_period = period/2;
-        const double t = fmod(time+phase, period);
-        if (t < half_period)
-            return -t*amp*2/half_period + amp;
-        else
-            return (t-half_period)*amp*2/half_period - amp;
-    }
+	unsigned getSampleRate()
+	{
+		return currentSampleRate;
+	}
 
-    double sawtooth(double time, double amp, double freq, double phase)
-    {
-        const double period = 1/freq;
-        const double t = fmod(time+phase, period);
-        return -(t*amp*2/period - amp);
-    }
+	double frameToTime(uint64_t frame)
+	{
+		return frame * currentSampleTime;
+	}
 }
 
-void ADSREnvelope::calculateTimePoints()
+std::pair<float, float> Panning::gains(double position)
 {
-	decayTime = attackTime + decayDur;
-	sustainTime = decayTime + sustainDur;
-	releaseTime = sustainTime + releaseDur;
+	const double angle = (std::clamp(position, -1., 1.) + 1) * M_PI / 4;
+	return { float(std::cos(angle) * M_SQRT2), float(std::sin(angle) * M_SQRT2) };
 }
 
-ADSREnvelope::ADSREnvelope(double a, double d, double s, double r, double h)
-	:attackTime(a), decayDur(d), sustainDur(h), releaseDur(r), sustainLevel(s)
+ADSREnvelope::ADSREnvelope(double a, double d, double s, double r, double h, Curve curve)
+	:attackTime(a), decayDur(d), sustainDur(h), releaseDur(r), sustainLevel(s), curve(curve)
 {
 }
 
-void ADSREnvelope::start(double t)
+void ADSREnvelope::start(double /*t*/)
 {
-	calculateTimePoints();
-	startAmp = getAmplitude(t);
-	beginTime = t;
-	lastStopTime = 0;
 	nonzero = true;
-	isHeld = true;
+	enter(Stage::Attack);
 }
 
-void ADSREnvelope::stop(double t)
+void ADSREnvelope::stop(double /*t*/)
 {
 	// return if it is being called redundantly
-	if (!isHeld)
+	if (stage == Stage::Release || stage == Stage::Idle)
 		return;
+	enter(Stage::Release);
+}
 
-	// if sustain duration is indefinite, we tweak it a little bit
-	// for getAmplitude to be working
-	if (sustainDur == inf) {
-		sustainTime = t;
-		releaseTime = sustainTime + releaseDur;
+void ADSREnvelope::reset()
+{
+	level = 0.;
+	enter(Stage::Idle);
+}
+
+void ADSREnvelope::enter(Stage next)
+{
+	const double sampleRate = timing::getSampleRate();
+	// Segments shorter than a frame are skipped
+	for (stage = next; ; stage = Stage(int(stage) + 1)) {
+		double duration = 0.;
+		switch (stage) {
+		case Stage::Attack:  target = 1.;           duration = attackTime; break;
+		case Stage::Decay:   target = sustainLevel; duration = decayDur;   break;
+		case Stage::Sustain: target = sustainLevel; duration = sustainDur; break;
+		case Stage::Release: target = 0.;           duration = releaseDur; break;
+		case Stage::Idle:
+			nonzero = false;
+			level = target = add = 0.;
+			mul = 1.;
+			remaining = std::numeric_limits<uint64_t>::max();
+			return;
+		default:
+			throw std::logic_error("There is no envelope stage " + std::to_string(int(stage)) + ".");
+		}
+		const double frames = std::round(duration * sampleRate);
+		if (frames < 1) {
+			level = target;
+			continue;
+		}
+
+		remaining = frames < double(std::numeric_limits<uint64_t>::max()) ? uint64_t(frames) : std::numeric_limits<uint64_t>::max();
+		if (stage == Stage::Sustain) {
+			level = target;
+			mul = 1.;
+			add = 0.;
+		}
+		else if (curve == Curve::Exponential && stage != Stage::Attack) {
+			// level(k) = A + B * r^k, which reaches the target exactly at the last frame
+			const double r = std::exp(-4. / frames), rn = std::exp(-4.);
+			const double B = (level - target) / (1. - rn);
+			mul = r;
+			add = (level - B) * (1. - r);
+		}
+		else {
+			mul = 1.;
+			add = (target - level) / frames;
+		}
+		return;
 	}
+}
 
-	double timeUntilSustain = sustainTime - t + beginTime;
-	if (timeUntilSustain > 0)
-		lastStopTime = sustainTime - t + beginTime;
-	else
-		lastStopTime = 0;
-	isHeld = false;
-}
-
-double ADSREnvelope::getAmplitude(double t) const
-{
-	t = t - beginTime + lastStopTime;
-	if (nonzero) {
-		if (t <= attackTime)
-			currentAmp = t * (1 - startAmp) / attackTime + startAmp;
-		else if (t < decayTime)
-			currentAmp = 1 - (t - attackTime) * (1 - sustainLevel) / decayDur;
-		else if (t < sustainTime)
-			currentAmp = sustainLevel;
-		else  if (t < releaseTime)
-			// we saved currentAmp for this case:
-			// the key may have been released before reaching the sustain level,
-			// in which case we have to calculate the appropiate decay level by
-			// considering the last available amplitude
-			return currentAmp * (1 - (t-sustainTime) / releaseDur);
+void ADSREnvelope::renderBlock(float* gains, std::size_t frames)
+{
+	std::size_t i = 0;
+	while (i < frames) {
+		const std::size_t n = std::size_t(std::min<uint64_t>(remaining, frames - i));
+		double l = level;
+		const double m = mul, a = add;
+		if (m == 1.) {
+			// Linear segments do not depend on the previous gain, so the loop vectorizes
+			for (std::size_t j = 0; j < n; ++j)
+				gains[i + j] = float(l + double(j) * a);
+			l += double(n) * a;
+		}
 		else {
-			nonzero = false;
-			currentAmp = 0;
+			for (std::size_t j = 0; j < n; ++j) {
+				gains[i + j] = float(l);
+				l = l * m + a;
+			}
+		}
+		level = l;
+		i += n;
+		remaining -= n;
+		if (remaining == 0) {
+			// Every segment ends exactly on its target, rounding errors do not accumulate
+			level = target;
+			enter(Stage(int(stage) + 1));
 		}
 	}
-	return currentAmp;
+}
+
+double ADSREnvelope::nextGain()
+{
+	float gain;
+	renderBlock(&gain, 1);
+	return gain;
 }
 
 
@@ -161,23 +195,95 @@ WaveGenerator::WaveGenerator(
 	:DynamicAmp(intensity),
 	freq(note),
 	intensity(intensity),
-	waveform(waveform)
-{}
+	waveform(std::move(waveform))
+{
+	updateIncrement();
+}
+
+void WaveGenerator::updateIncrement()
+{
+	incrementSampleRate = timing::getSampleRate();
+	increment = freq / incrementSampleRate;
+}
 
-void WaveGenerator::modifyMainPitchImpl(double t, double f2)
+void WaveGenerator::modifyMainPitchImpl(double /*t*/, double f2)
 {
-	double f1 = this->freq;
-	double p = (t + this->phase) * f1 / f2 - t;
-	p = std::fmod(p, 2 * M_PI*f2);
-	this->phase = p;
 	this->freq = f2;
+	updateIncrement();
 }
 
 double WaveGenerator::getSampleImpl(double t)
 {
+	if (incrementSampleRate != timing::getSampleRate()) updateIncrement();
 	intensity = intensityFunction.getValue(t);
-    double result = waveform(t, this->intensity, this->freq, this->phase);
-    return result;
+	const double phase = nextPhase();
+	return this->intensity * std::visit([this, phase](const auto& waveform) -> double {
+		using type = std::decay_t<decltype(waveform)>;
+		if constexpr (std::is_same_v<type, waves::Shape>) {
+			switch (waveform) {
+				case waves::Shape::Sine:     return waves::sine(phase);
+				case waves::Shape::Square:   return waves::square(phase);
+				case waves::Shape::Triangle: return waves::triangle(phase);
+				case waves::Shape::Sawtooth: return waves::sawtooth(phase);
+			}
+			return 0.;
+		}
+		else if constexpr (std::is_same_v<type, waves::Custom>) {
+			return waveform.function(phase);
+		}
+		else {
+			return Wavetable::lookup(waveform->getLevel(increment), phase);
+		}
+	}, waveform);
+}
+
+// Each kernel is a distinct type, so the call below is inlined
+template<class Waveform>
+void WaveGenerator::renderWith(float* out, std::size_t frames, uint64_t startFrame, Waveform waveform)
+{
+	for (std::size_t i = 0; i < frames; ++i) {
+		intensity = intensityFunction.getValue(timing::frameToTime(startFrame + i));
+		out[i] = float(this->intensity * waveform(nextPhase()));
+	}
+}
+
+void WaveGenerator::renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame)
+{
+	if (incrementSampleRate != timing::getSampleRate()) updateIncrement();
+	std::visit([&](const auto& waveform) {
+		using type = std::decay_t<decltype(waveform)>;
+		if constexpr (std::is_same_v<type, waves::Shape>) {
+			switch (waveform) {
+				case waves::Shape::Sine:
+					renderWith(out, frames, startFrame, [](double p) { return waves::sine(p); });
+					break;
+				case waves::Shape::Square:
+					renderWith(out, frames, startFrame, [](double p) { return waves::square(p); });
+					break;
+				case waves::Shape::Triangle:
+					renderWith(out, frames, startFrame, [](double p) { return waves::triangle(p); });
+					break;
+				case waves::Shape::Sawtooth:
+					renderWith(out, frames, startFrame, [](double p) { return waves::sawtooth(p); });
+					break;
+			}
+		}
+		else if constexpr (std::is_same_v<type, waves::Custom>) {
+			renderWith(out, frames, startFrame, std::cref(waveform.function));
+		}
+		else {
+			const float* level = waveform->getLevel(increment);
+			renderWith(out, frames, startFrame, [level](double phase) {
+				return Wavetable::lookup(level, phase);
+			});
+		}
+	}, waveform);
+}
+
+bool WaveGenerator::isSine() const
+{
+	const auto* shape = std::get_if<waves::Shape>(&waveform);
+	return shape && *shape == waves::Shape::Sine;
 }
 
 double WaveGenerator::getMainFreqImpl() const
@@ -185,9 +291,65 @@ double WaveGenerator::getMainFreqImpl() const
 	return freq.getInitial();
 }
 
-constexpr double WaveGenerator::getIntensityImpl() const
+template<>
+void Composite<WaveGenerator>::renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame)
 {
-	return intensity;
+	if (frames == 0) return;
+	// Scratch of the rendering thread, reserved once for more partials than a timbre has
+	constexpr std::size_t scratchPartials = 256;
+	thread_local PartialBank bank(scratchPartials);
+	thread_local std::vector<double> sineIntensities = [] {
+		std::vector<double> ret;
+		ret.reserve(scratchPartials);
+		return ret;
+	}();
+	bank.clear();
+	sineIntensities.clear();
+	if (componentBuffer.size() < frames) componentBuffer.resize(frames);
+	std::fill(out, out + frames, 0.f);
+
+	// Everything but the sines is rendered one by one
+	double intensityBegin = 0.;
+	for (auto& c : components) {
+		intensityBegin += c.intensity;
+		if (c.isSine()) {
+			sineIntensities.push_back(c.intensity);
+		}
+		else {
+			c.renderBlock(componentBuffer.data(), frames, startFrame);
+			for (std::size_t i = 0; i < frames; ++i)
+				out[i] += componentBuffer[i];
+		}
+	}
+
+	// Intensities change linearly, so the sines only need their values at the end of the block
+	const double tEnd = timing::frameToTime(startFrame + frames - 1);
+	double intensityEnd = 0.;
+	for (auto& c : components) {
+		if (c.isSine()) {
+			if (c.incrementSampleRate != timing::getSampleRate()) c.updateIncrement();
+			c.intensity = c.intensityFunction.getValue(tEnd);
+		}
+		intensityEnd += c.intensity;
+	}
+
+	const double step = (intensityEnd - intensityBegin) / frames;
+	for (std::size_t i = 0; i < frames; ++i) {
+		const double sum = intensityBegin + step * (i + 1);
+		out[i] = float(sum != 0. ? out[i] / sum : 0.);
+	}
+
+	// The normalization is folded into the amplitudes of the partials
+	const double normBegin = intensityBegin != 0. ? 1. / intensityBegin : 0.;
+	const double normEnd = intensityEnd != 0. ? 1. / intensityEnd : 0.;
+	std::size_t sineIdx = 0;
+	for (auto& c : components) {
+		if (!c.isSine()) continue;
+		bank.add(c.phase, c.increment, sineIntensities[sineIdx++] * normBegin, c.intensity * normEnd);
+		c.phase += frames * c.increment;
+		c.phase -= std::floor(c.phase);
+	}
+	bank.render(out, frames);
 }
 
 DynamicToneSum::DynamicToneSum(
@@ -196,41 +358,133 @@ DynamicToneSum::DynamicToneSum(
 	const std::vector<Note>& notes,
 	unsigned maxTones
 )
-	:base_t(generateTones<WaveGenerator>(timbreModel, notes, env)),
-	env(env),
+	:notes(notes),
 	maxTones(maxTones),
-	timbreModel(timbreModel)
-{}
+	keyEvents(notes.size()),
+	pendingIntensity(std::make_unique<std::atomic<double>[]>(timbreModel.components.size())),
+	pendingRatio(std::make_unique<std::atomic<double>[]>(timbreModel.components.size())),
+	timbreModel(timbreModel),
+	env(env)
+{
+	if (notes.empty()) {
+		throw std::invalid_argument("An instrument needs at least one note.");
+	}
+	for (std::size_t i = 0; i < timbreModel.components.size(); ++i) {
+		componentRatio.push_back(timbreModel.components[i].relativeFreq);
+		pendingIntensity[i] = std::nan("");
+		pendingRatio[i] = std::nan("");
+	}
+	voices.reserve(maxTones);
+	activeVoices.reserve(maxTones);
+	for (unsigned i = 0; i < maxTones; ++i)
+		voices.push_back(Voice{ timbreModel(notes.front(), env) });
+}
 DynamicToneSum::DynamicToneSum(const DynamicToneSum& that)
 	:DynamicToneSum(that.timbreModel, that.env, that.getNotes(), that.maxTones)
 {}
 
-void DynamicToneSum::lock() const { mtx.lock(); }
-void DynamicToneSum::unlock() const { mtx.unlock(); }
 double DynamicToneSum::time() const { return lastTime.load(); }
 
+double DynamicToneSum::getMainFreq() const { return notes.front(); }
+
 double DynamicToneSum::getSample(double t)
 {
-	std::lock_guard lock(*this);
-	lastTime.store(t);
-	if (beforeSample) beforeSample(t, *const_cast<DynamicToneSum*>(this));
-	double result{ 0. };
-	std::size_t count{ 0 };
-	for (auto i = pressedKeys.begin(); i != pressedKeys.end();) {
-		auto& c = components[*i];
-		if (count >= maxTones) break;
-		if (auto sample = c.getSample(t)) {
-			++count;
-			result += sample.value();
-			++i;
+	float frame[2];
+	renderStereoBlock(frame, 1, uint64_t(std::llround(t * timing::getSampleRate())));
+	return (frame[0] + frame[1]) / 2.;
+}
+
+void DynamicToneSum::renderBlock(float* out, std::size_t frames, uint64_t startFrame)
+{
+	if (stereoBuffer.size() < 2 * frames) stereoBuffer.resize(2 * frames);
+	renderStereoBlock(stereoBuffer.data(), frames, startFrame);
+	for (std::size_t j = 0; j < frames; ++j)
+		out[j] = (stereoBuffer[2 * j] + stereoBuffer[2 * j + 1]) / 2;
+}
+
+void DynamicToneSum::renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning)
+{
+	const double t = timing::frameToTime(startFrame);
+	applyCommands(t);
+	lastTime.store(timing::frameToTime(startFrame + frames - 1));
+	if (beforeSample) beforeSample(t, *this);
+	if (toneBuffer.size() < voices.size() * frames) toneBuffer.resize(voices.size() * frames);
+	if (envelopeGains.size() < voices.size() * frames) envelopeGains.resize(voices.size() * frames);
+	std::fill(out, out + 2 * frames, 0.f);
+
+	activeVoices.clear();
+	for (std::size_t v = 0; v < voices.size(); ++v) {
+		auto& voice = voices[v];
+		// A stolen voice starts its new key once the old one has faded out
+		if (!voice.key && voice.nextKey) {
+			bind(voice, *voice.nextKey, t);
+			voice.nextKey.reset();
 		}
-		else {
-			i = pressedKeys.erase(i);
+		if (voice.key) activeVoices.push_back(v);
+	}
+
+	// Every voice renders to its own tone and gain buffers, on any thread.
+	// The envelopes of the voices are laid out next to each other and applied while mixing.
+	const float fadeLength = float(std::max(1u, unsigned(fadeTime * timing::getSampleRate())));
+	RenderPool::instance().parallelFor(activeVoices.size(), frames, [&](std::size_t i) {
+		const std::size_t v = activeVoices[i];
+		auto& voice = voices[v];
+		float* gains = envelopeGains.data() + v * frames;
+		voice.sounding = voice.tone.renderBlock(toneBuffer.data() + v * frames, gains, frames, startFrame);
+		voice.fadedOut = false;
+		if (voice.sounding && voice.fadeFrames) {
+			for (std::size_t j = 0; j < frames; ++j)
+				gains[j] *= j < voice.fadeFrames ? (voice.fadeFrames - j) / fadeLength : 0.f;
+			voice.fadedOut = voice.fadeFrames <= frames;
+			voice.fadeEnd = std::min<std::size_t>(voice.fadeFrames, frames);
+			voice.fadeFrames = voice.fadeFrames > frames ? unsigned(voice.fadeFrames - frames) : 0;
+		}
+	});
+
+	// Mixing in voice order gives the same output with any number of threads
+	const float norm = 1.f / maxTones;
+	const double keySpread = notes.size() > 1 ? 2. / (notes.size() - 1) : 0.;
+	const auto mix = [&](Voice& voice, const float* tone, const float* gains, std::size_t from) {
+		const double position = panning.pan + panning.width * (*voice.key * keySpread - 1.);
+		auto [left, right] = Panning::gains(position);
+		left *= norm;
+		right *= norm;
+		float level = 0.f;
+		for (std::size_t j = from; j < frames; ++j) {
+			const float sample = tone[j] * gains[j];
+			level = std::max(level, std::abs(sample));
+			out[2 * j] += sample * left;
+			out[2 * j + 1] += sample * right;
+		}
+		return level;
+	};
+	for (const std::size_t v : activeVoices) {
+		auto& voice = voices[v];
+		if (!voice.sounding) {
+			voice.key.reset();
+			voice.fadeFrames = 0;
+			continue;
 		}
+
+		float* tone = toneBuffer.data() + v * frames;
+		float* gains = envelopeGains.data() + v * frames;
+		voice.level = mix(voice, tone, gains, 0);
+		if (!voice.fadedOut) continue;
+		voice.key.reset();
+		if (!voice.nextKey) continue;
+
+		// A stolen voice starts its new key on the frame its fade-out finished
+		const std::size_t from = voice.fadeEnd;
+		bind(voice, *voice.nextKey, timing::frameToTime(startFrame + from));
+		voice.nextKey.reset();
+		if (from == frames) continue;
+		if (voice.tone.renderBlock(tone + from, gains + from, frames - from, startFrame + from))
+			voice.level = mix(voice, tone, gains, from);
+		else
+			voice.key.reset();
 	}
-	result /= maxTones;
-	if (afterSample) afterSample(t, result);
-	return result;
+
+	inserts.process(out, frames, startFrame);
 }
 
 unsigned DynamicToneSum::getMaxTones() const
@@ -240,16 +494,12 @@ unsigned DynamicToneSum::getMaxTones() const
 
 std::vector<Note> DynamicToneSum::getNotes() const
 {
-	std::vector<Note> ret;
-	ret.reserve(initialComponents.size());
-	for (const auto& component : initialComponents)
-		ret.push_back(component.getMainFreq());
-	return ret;
+	return notes;
 }
 
 unsigned DynamicToneSum::getNotesCount() const
 {
-	return initialComponents.size();
+	return notes.size();
 }
 
 const TimbreModel& DynamicToneSum::getTimbreModel() const
@@ -257,40 +507,192 @@ const TimbreModel& DynamicToneSum::getTimbreModel() const
 	return timbreModel;
 }
 
-unsigned DynamicToneSum::addAfterCallback(after_t callback) 
-{ 
-	return addCallback(afterSample, afterSampleCallbacks, callback); 
-}
-void DynamicToneSum::removeAfterCallback(unsigned id)
-{ 
-	removeCallback(afterSampleCallbacks, id); 
-}
 unsigned DynamicToneSum::addBeforeCallback(before_t callback)
 { 
 	return addCallback(beforeSample, beforeSampleCallbacks, callback);
 }
 void DynamicToneSum::removeBeforeCallback(unsigned id) 
 { 
-	removeCallback(beforeSampleCallbacks, id); 
+	removeCallback(beforeSample, beforeSampleCallbacks, id); 
 }
 
 void DynamicToneSum::onKeyEvent(unsigned keyIdx, SynthKey::State keyState)
 {
-	std::lock_guard lock(*this);
-	if (keyState == SynthKey::State::Pressed) {
-		if (pressedKeys.size() < maxTones && !pressedKeys.count(keyIdx)) {
-			pressedKeys.insert(keyIdx);
-			components.at(keyIdx).start(this->time());
+	if (keyIdx >= notes.size()) {
+		throw std::out_of_range("There is no key " + std::to_string(keyIdx) + ".");
+	}
+	keyEvents.push(keyIdx, keyState == SynthKey::State::Pressed);
+}
+
+void DynamicToneSum::releaseKeys()
+{
+	keyEvents.releaseAll();
+}
+
+void DynamicToneSum::setMainPitch(double freq)
+{
+	pendingPitch.store(freq, std::memory_order_release);
+}
+
+void DynamicToneSum::setComponentIntensity(unsigned component, double intensity)
+{
+	if (component < timbreModel.components.size())
+		pendingIntensity[component].store(intensity, std::memory_order_release);
+}
+
+void DynamicToneSum::setComponentRatio(unsigned component, double ratio)
+{
+	if (component < timbreModel.components.size())
+		pendingRatio[component].store(ratio, std::memory_order_release);
+}
+
+void DynamicToneSum::setVoiceStealing(VoiceStealing stealing)
+{
+	this->stealing = stealing;
+}
+
+uint64_t DynamicToneSum::getMergedKeyEvents() const
+{
+	return keyEvents.getMerged();
+}
+
+void DynamicToneSum::playKeyEvent(unsigned key, SynthKey::State keyState, uint64_t frame)
+{
+	if (key >= notes.size()) return;
+	const double t = timing::frameToTime(frame);
+	if (keyState == SynthKey::State::Pressed)
+		noteOn(key, t);
+	else
+		noteOff(key, t);
+}
+
+void DynamicToneSum::playMainPitch(double freq, uint64_t frame)
+{
+	const double t = timing::frameToTime(frame);
+	pitchRate = freq / getMainFreq();
+	for (auto& voice : voices)
+		if (voice.key) tune(voice, t);
+}
+
+void DynamicToneSum::playComponentIntensity(unsigned component, double intensity, uint64_t frame)
+{
+	if (component >= timbreModel.components.size()) return;
+	const double t = timing::frameToTime(frame);
+	for (auto& voice : voices)
+		voice.tone[component].modifyIntensity(t, intensity);
+}
+
+void DynamicToneSum::playComponentRatio(unsigned component, double ratio, uint64_t frame)
+{
+	if (component >= timbreModel.components.size()) return;
+	const double t = timing::frameToTime(frame);
+	// Relative to the first component, like the timbre model
+	componentRatio[component] = timbreModel.components.front().relativeFreq * ratio;
+	for (auto& voice : voices)
+		if (voice.key) tune(voice, t);
+}
+
+void DynamicToneSum::applyCommands(double t)
+{
+	keyEvents.apply(
+		[this, t](unsigned key, bool pressed) { pressed ? noteOn(key, t) : noteOff(key, t); },
+		[this]() { releaseVoices(); }
+	);
+
+	// Only the last value of a continuous change is applied,
+	// so a slider storm costs the same as one move per block
+	bool retune = false;
+	const double pitch = pendingPitch.exchange(std::nan(""), std::memory_order_acquire);
+	if (!std::isnan(pitch)) {
+		pitchRate = pitch / getMainFreq();
+		retune = true;
+	}
+	for (std::size_t i = 0; i < timbreModel.components.size(); ++i) {
+		const double intensity = pendingIntensity[i].exchange(std::nan(""), std::memory_order_acquire);
+		if (!std::isnan(intensity)) {
+			for (auto& voice : voices)
+				voice.tone[i].modifyIntensity(t, intensity);
+		}
+		const double ratio = pendingRatio[i].exchange(std::nan(""), std::memory_order_acquire);
+		if (!std::isnan(ratio)) {
+			// Relative to the first component, like the timbre model
+			componentRatio[i] = timbreModel.components.front().relativeFreq * ratio;
+			retune = true;
 		}
 	}
-	else {
-		components.at(keyIdx).stop(this->time());
+	if (retune) {
+		for (auto& voice : voices)
+			if (voice.key) tune(voice, t);
 	}
 }
 
-void DynamicToneSum::releaseKeys()
+void DynamicToneSum::releaseVoices()
+{
+	for (auto& voice : voices) {
+		voice.key.reset();
+		voice.nextKey.reset();
+		voice.fadeFrames = 0;
+	}
+}
+
+void DynamicToneSum::noteOff(unsigned key, double t)
+{
+	for (auto& voice : voices) {
+		if (voice.key == key && !voice.fadeFrames) voice.tone.stop(t);
+		if (voice.nextKey == key) voice.nextKey.reset();
+	}
+}
+
+void DynamicToneSum::noteOn(unsigned key, double t)
+{
+	for (auto& voice : voices) {
+		if (voice.key == key && !voice.fadeFrames) {
+			voice.tone.start(t);
+			voice.age = ++noteCounter;
+			return;
+		}
+		if (voice.nextKey == key) return;
+	}
+	for (auto& voice : voices) {
+		if (!voice.key && !voice.nextKey) {
+			bind(voice, key, t);
+			return;
+		}
+	}
+
+	const auto policy = stealing.load();
+	if (policy == VoiceStealing::Retrigger) return;
+	Voice* stolen = nullptr;
+	for (auto& voice : voices) {
+		if (voice.nextKey || voice.fadeFrames) continue; // already fading out
+		if (!stolen ||
+			(policy == VoiceStealing::Oldest && voice.age < stolen->age) ||
+			(policy == VoiceStealing::Quietest && voice.level < stolen->level))
+		{
+			stolen = &voice;
+		}
+	}
+	if (stolen) {
+		stolen->nextKey = key;
+		stolen->fadeFrames = std::max(1u, unsigned(fadeTime * timing::getSampleRate()));
+	}
+}
+
+void DynamicToneSum::bind(Voice& voice, unsigned key, double t)
+{
+	voice.key = key;
+	tune(voice, t);
+	voice.tone.reset();
+	voice.tone.start(t);
+	voice.age = ++noteCounter;
+	voice.level = 1.f; // not rendered yet, it should not be the quietest
+}
+
+void DynamicToneSum::tune(Voice& voice, double t)
 {
-	pressedKeys.clear();
+	const double baseFreq = notes[*voice.key] * pitchRate;
+	for (std::size_t i = 0; i < componentRatio.size(); ++i)
+		voice.tone[i].modifyMainPitch(t, baseFreq * componentRatio[i]);
 }
 
 TimbreModel::TimbreModel(
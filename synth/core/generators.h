@@ -14,43 +14,123 @@
 #include <mutex>
 #include <array>
 #include <optional>
+#include <variant>
 #include <unordered_set>
+#include <cstdint>
 #include <SFML/System.hpp>
 
 #include "../gui/SynthKeyboard.h"
+#include "Wavetable.h"
+#include "SpscQueue.h"
+#include "KeyEventQueue.h"
+#include "RenderPool.h"
+#include "EffectGraph.h"
 
 namespace waves
 {
-    using wave_t = std::function<double(double,double,double,double)>;
+	// Waveforms are evaluated at a normalized phase in [0, 1) and return a value in [-1, 1]
+
+    inline double sine(double phase)
+    {
+        return ::sin(phase*2*M_PI);
+    }
+
+    inline double square(double phase)
+    {
+        if (phase < .5)
+            return 1.;
+        else
+            return -1.;
+    }
+
+    inline double triangle(double phase)
+    {
+        if (phase < .5)
+            return 1. - 4.*phase;
+        else
+            return 4.*phase - 3.;
+    }
+
+    inline double sawtooth(double phase)
+    {
+        return 1. - 2.*phase;
+    }
+
+	// The waveform is selected once per block, the kernels above can be inlined.
+	enum class Shape { Sine, Square, Triangle, Sawtooth };
+
+	// Opt-in slow path for waveforms defined at runtime: an indirect call per sample
+	struct Custom
+	{
+		std::function<double(double)> function;
+	};
 
-    double sine(double time, double amp, double freq, double phase=0);
-    double square(double time, double amp, double freq, double phase);
-    double triangle(double time, double amp, double freq, double phase);
-    double sawtooth(double time, double amp, double freq, double phase);
+	using wave_t = std::variant<Shape, std::shared_ptr<const Wavetable>, Custom>;
+}
+
+namespace timing
+{
+	// The audio engine counts frames, generators still think in seconds.
+	// The sample rate set here is used to convert between the two.
+	void setSampleRate(unsigned sampleRate);
+	unsigned getSampleRate();
+	double frameToTime(uint64_t frame);
 }
 
+// One frame of the stereo output
+struct StereoSample
+{
+	double left, right;
+};
+
+// Placement of a mono source in the stereo field
+struct Panning
+{
+	double pan = 0.;   // -1 is left, 1 is right
+	double width = 0.; // how far the voices of an instrument are spread around pan, [0, 1]
+
+	// Constant power channel gains of a source at the given position, both are 1 in the center
+	static std::pair<float, float> gains(double position);
+};
+
+// Envelope rendered incrementally, one segment (attack, decay, sustain, release) at a time.
+// Within a segment every gain is one multiply-add away from the previous one.
 class ADSREnvelope
 {
 	static constexpr double inf = std::numeric_limits<double>::infinity();
 public:
+	// Shape of the decay and release segments, the attack is always linear
+	enum class Curve { Linear, Exponential };
 
-    ADSREnvelope(double a=.01, double d=0.01, double s=1., double r=.01, double st = inf);
+    ADSREnvelope(double a=.01, double d=0.01, double s=1., double r=.01, double st = inf, Curve curve = Curve::Linear);
 	ADSREnvelope(const ADSREnvelope& rhs) = default;
     ~ADSREnvelope() = default;
 
+	// The envelope moves with the rendered blocks, the time is only kept for the callers
     void   start(double t);
     void   stop(double t);
-    double getAmplitude(double t) const;
+	// Silences the envelope, the next start begins from 0
+	void   reset();
+	// Fills gains[0..frames) and advances the envelope by as many frames
+	void   renderBlock(float* gains, std::size_t frames);
+	// Gain of the current frame, advances the envelope by one frame
+	double nextGain();
     bool   isNonZero() const {return nonzero;}
 
 private:
-	void calculateTimePoints();
+	enum class Stage { Attack, Decay, Sustain, Release, Idle };
 
-	mutable double attackTime, decayDur, sustainDur, releaseDur, sustainLevel;
-	mutable double decayTime, sustainTime, releaseTime;
+	// Precomputes the step of the given stage, starting from the current level
+	void enter(Stage stage);
 
-    mutable bool nonzero = false, isHeld = false;
-    mutable double currentAmp = 0, beginTime = 0, startAmp = 0, lastStopTime=0;
+	double attackTime, decayDur, sustainDur, releaseDur, sustainLevel;
+	Curve curve;
+
+	Stage stage = Stage::Idle;
+	bool nonzero = false;
+	double level = 0., target = 0.;      // current gain, gain at the end of the segment
+	double mul = 1., add = 0.;           // level = level * mul + add
+	uint64_t remaining = std::numeric_limits<uint64_t>::max(); // frames until the end of the segment
 };
 
 class ContinuousFunction
@@ -131,8 +211,36 @@ public:
 	{
 		return static_cast<const T*>(this)->getMainFreqImpl();
 	}
+	// Fills out[0..frames) with the samples of frames [startFrame, startFrame+frames)
+	void renderBlock(float* out, std::size_t frames, uint64_t startFrame)
+	{
+		static_cast<T*>(this)->renderBlockImpl(out, frames, startFrame);
+	}
+	// Fills out[0..2*frames) with interleaved stereo frames
+	void renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning = {})
+	{
+		static_cast<T*>(this)->renderStereoBlockImpl(out, frames, startFrame, panning);
+	}
 
 protected:
+	// Fallback for generators which can only produce one sample at a time
+	void renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame)
+	{
+		for (std::size_t i = 0; i < frames; ++i)
+			out[i] = float(getSample(timing::frameToTime(startFrame + i)));
+	}
+	// Mono generators are placed at the pan position
+	void renderStereoBlockImpl(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning)
+	{
+		renderBlock(out, frames, startFrame);
+		const auto [left, right] = Panning::gains(panning.pan);
+		// Spreading in place, from the back
+		for (std::size_t i = frames; i-- > 0;) {
+			const float sample = out[i];
+			out[2 * i + 1] = sample * right;
+			out[2 * i] = sample * left;
+		}
+	}
 	void modifyMainPitchImpl(double t, double f2) {}
 	double getMainFreqImpl() const { return 1.; }
 	constexpr double getIntensityImpl(double t) { return 0.; }
@@ -142,15 +250,16 @@ class WaveGenerator;
 
 class SumGenerator : public SampleGenerator<SumGenerator>
 {
-	friend class SampleGenerator<WaveGenerator>;
+	friend class SampleGenerator<SumGenerator>;
 	using callback_t = std::function<double(double)>;
-	using afterSample_t = std::function<void(double, double&)>;
+	using blockCallback_t = std::function<void(float*, std::size_t, uint64_t)>;
 
 public:
 
+	// The sum of the instruments goes through the effects, if there are any
 	template<class T>
 	SumGenerator(
-		afterSample_t afterSample,
+		std::shared_ptr<EffectGraph> effects,
 		const T& instruments
 	)
 		:callback{ [instruments = std::forward<decltype(instruments)>(instruments)] (double t) mutable {
@@ -159,20 +268,53 @@ public:
 				}, instruments);
 			} 
 		},
-		afterSample(afterSample)
+		blockCallback{ [instruments = std::forward<decltype(instruments)>(instruments), buffer = std::vector<float>()]
+			(float* out, std::size_t frames, uint64_t startFrame) mutable {
+				constexpr std::size_t count = std::tuple_size_v<std::decay_t<decltype(instruments)>>;
+				const std::size_t stride = 2 * frames;
+				if (buffer.size() < count * stride) buffer.resize(count * stride);
+				// Every instrument renders to its own part of the buffer, maybe in parallel,
+				// then they are summed in order
+				RenderPool::instance().parallelFor(count, frames, [&](std::size_t k) {
+					std::size_t i = 0;
+					std::apply([&](auto& ... args) {
+						((i++ == k ? args.getGenerator().renderStereoBlock(buffer.data() + k * stride, frames, startFrame, args.getPanning()) : void()), ...);
+					}, instruments);
+				});
+				std::fill(out, out + stride, 0.f);
+				for (std::size_t k = 0; k < count; ++k)
+					addBlock(out, buffer.data() + k * stride, stride);
+			}
+		},
+		effects(std::move(effects))
 	{
 	}
 
 	double getSampleImpl(double t) const
 	{
-		double ret = callback(t);
-		if(afterSample) afterSample(t, ret);
-		return ret;
+		const float mono = float(callback(t));
+		float frame[2]{ mono, mono };
+		if (effects) effects->process(frame, 1, uint64_t(std::llround(t * timing::getSampleRate())));
+		return (frame[0] + frame[1]) / 2.;
+	}
+
+	// Every instrument and effect runs once per block
+	void renderStereoBlockImpl(float* out, std::size_t frames, uint64_t startFrame, const Panning&) const
+	{
+		blockCallback(out, frames, startFrame);
+		if (effects) effects->process(out, frames, startFrame);
 	}
 
 private:
+	static void addBlock(float* out, const float* in, std::size_t frames)
+	{
+		for (std::size_t i = 0; i < frames; ++i)
+			out[i] += in[i];
+	}
+
 	callback_t callback;
-	afterSample_t afterSample;
+	blockCallback_t blockCallback;
+	std::shared_ptr<EffectGraph> effects;
 };
 
 class DynamicAmp
@@ -189,14 +331,18 @@ protected:
 	ContinuousFunction intensityFunction;
 };
 
+template<class T>
+class Composite;
+
 class WaveGenerator : public SampleGenerator<WaveGenerator>, public DynamicAmp
 {
 	friend class SampleGenerator<WaveGenerator>;
+	friend class Composite<WaveGenerator>; // renders sine partials with PartialBank
 
 public:
     Note freq;
     double intensity;
-    double phase = 0;
+    double phase = 0; // normalized, [0, 1)
     waves::wave_t waveform;
 
     WaveGenerator(
@@ -206,10 +352,30 @@ public:
 	);
 
 private:
+	// The phase advances by freq/sampleRate every sample, so a pitch change
+	// only has to recalculate the increment.
+	void updateIncrement();
+	double nextPhase()
+	{
+		const double current = phase;
+		phase += increment;
+		// Above the sample rate the increment is more than a cycle, the tables are read in [0, 1) only
+		if (phase >= 1.) phase -= std::floor(phase);
+		return current;
+	}
+
+	bool isSine() const;
+	template<class Waveform>
+	void renderWith(float* out, std::size_t frames, uint64_t startFrame, Waveform waveform);
+
+	double increment = 0;
+	unsigned incrementSampleRate = 0;
+
 	void modifyMainPitchImpl(double t, double f2);
     double getSampleImpl(double t);
+	void renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame);
 	double getMainFreqImpl() const;
-	constexpr double getIntensityImpl() const;
+	double getIntensityImpl() const { return intensity; }
 };
 
 template<class T>
@@ -228,10 +394,14 @@ public:
 protected:
     void modifyMainPitchImpl(double t, double dest);
     double getSampleImpl(double t);
+	void renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame);
 	double getMainFreqImpl() const;
 
     const std::vector<T> initialComponents;
     std::vector<T> components;
+
+private:
+	std::vector<float> componentBuffer;
 };
 
 template<class T>
@@ -268,6 +438,33 @@ double Composite<T>::getSampleImpl(double t)
 	return result/intensitySum;
 }
 
+template<class T>
+void Composite<T>::renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame)
+{
+	if (componentBuffer.size() < frames) componentBuffer.resize(frames);
+	std::fill(out, out + frames, 0.f);
+
+	double intensityBegin = 0.;
+	for (const auto& c : components) intensityBegin += c.getIntensity();
+	for (auto& c : components) {
+		c.renderBlock(componentBuffer.data(), frames, startFrame);
+		for (std::size_t i = 0; i < frames; ++i)
+			out[i] += componentBuffer[i];
+	}
+	double intensityEnd = 0.;
+	for (const auto& c : components) intensityEnd += c.getIntensity();
+
+	// Intensities only change linearly, so interpolating the sum over the block
+	// gives the same normalization as summing them per sample
+	const double step = (intensityEnd - intensityBegin) / frames;
+	for (std::size_t i = 0; i < frames; ++i)
+		out[i] = float(out[i] / (intensityBegin + step * (i + 1)));
+}
+
+// Sine partials are rendered together with SIMD
+template<>
+void Composite<WaveGenerator>::renderBlockImpl(float* out, std::size_t frames, uint64_t startFrame);
+
 template<class T>
 const T& Composite<T>::operator[](std::size_t idx) const
 {
@@ -302,10 +499,17 @@ public:
 	);
 	void start(double t);
 	void stop(double t);
+	void reset();
 	std::optional<double> getSample(double t);
+	// Returns false (and a silent block) if the envelope has already finished
+	bool renderBlock(float* out, std::size_t frames, uint64_t startFrame);
+	// Renders the tone to out and the envelope to gains without applying it,
+	// returns false (and silent blocks) if the envelope has already finished
+	bool renderBlock(float* out, float* gains, std::size_t frames, uint64_t startFrame);
 
 private:
 	ADSREnvelope envelope;
+	std::vector<float> gainBuffer;
 };
 
 template<class T>
@@ -329,17 +533,47 @@ void Dynamic<T>::stop(double t)
 	envelope.stop(t);
 }
 
+template<class T>
+void Dynamic<T>::reset()
+{
+	envelope.reset();
+}
+
 template<class T>
 std::optional<double> Dynamic<T>::getSample(double t)
 {
 	if (envelope.isNonZero()) {
-		return T::getSample(t) * envelope.getAmplitude(t);
+		return T::getSample(t) * envelope.nextGain();
 	}
 	else {
 		return std::nullopt;
 	}
 }
 
+template<class T>
+bool Dynamic<T>::renderBlock(float* out, std::size_t frames, uint64_t startFrame)
+{
+	if (gainBuffer.size() < frames) gainBuffer.resize(frames);
+	if (!renderBlock(out, gainBuffer.data(), frames, startFrame))
+		return false;
+	for (std::size_t i = 0; i < frames; ++i)
+		out[i] *= gainBuffer[i];
+	return true;
+}
+
+template<class T>
+bool Dynamic<T>::renderBlock(float* out, float* gains, std::size_t frames, uint64_t startFrame)
+{
+	if (!envelope.isNonZero()) {
+		std::fill(out, out + frames, 0.f);
+		std::fill(gains, gains + frames, 0.f);
+		return false;
+	}
+	T::renderBlock(out, frames, startFrame);
+	envelope.renderBlock(gains, frames);
+	return true;
+}
+
 struct TimbreModel
 {
 	struct ToneSkeleton {
@@ -357,14 +591,21 @@ struct TimbreModel
 	std::vector<ToneSkeleton> components;
 };
 
-class DynamicToneSum : public Composite<Dynamic<Composite<WaveGenerator>>>
+// What happens to a note-on when every voice is busy. A key which is
+// already sounding is always retriggered on its own voice.
+enum class VoiceStealing
 {
-	using base_t = Composite<Dynamic<Composite<WaveGenerator>>>;
+	Oldest,   // the voice started the longest time ago fades out for the new note
+	Quietest, // the voice with the lowest level in the last block fades out
+	Retrigger // only retriggering, other new notes are ignored
+};
 
+// Polyphonic instrument with a fixed pool of maxTones voices,
+// which are bound to a key at note-on
+class DynamicToneSum
+{
 public:
-	friend class std::lock_guard<DynamicToneSum>;
 	using before_t = std::function<void(double, DynamicToneSum&)>;
-	using after_t = std::function<void(double, double&)>;
 
 	DynamicToneSum(
 		const TimbreModel& timbreModel,
@@ -374,26 +615,61 @@ public:
 	);
 	DynamicToneSum(const DynamicToneSum& that);
 
-	void releaseKeys();
 	double getSample(double t);
+	void renderBlock(float* out, std::size_t frames, uint64_t startFrame);
+	// The voices are spread around the pan position by their key, low keys to the left
+	void renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame, const Panning& panning = {});
 	double time() const;
+	double getMainFreq() const;
 	unsigned getMaxTones() const;
 	std::vector<Note> getNotes() const;
 	unsigned getNotesCount() const;
 	const TimbreModel& getTimbreModel() const;
 
-	unsigned addAfterCallback(after_t callback);
-	void removeAfterCallback(unsigned id);
+	// Insert effects, run on the stereo output of every block
+	EffectGraph& getInserts() { return inserts; }
 	unsigned addBeforeCallback(before_t callback);
 	void removeBeforeCallback(unsigned id);
 
+	// Control from the GUI thread, applied by the audio thread at the beginning of the next block,
+	// without locks. Key events are queued, of the parameters only the last value is kept.
 	void onKeyEvent(unsigned key, SynthKey::State keyState);
-
-	void lock() const;
-	void unlock() const;
+	void releaseKeys();
+	void setMainPitch(double freq);
+	void setComponentIntensity(unsigned component, double intensity);
+	void setComponentRatio(unsigned component, double ratio);
+	void setVoiceStealing(VoiceStealing stealing);
+	// Key events merged into a later one of the same key because the queue was full
+	uint64_t getMergedKeyEvents() const;
+
+	// From the audio thread between two blocks: the key event sounds from the given frame on.
+	// Keys out of range are ignored.
+	void playKeyEvent(unsigned key, SynthKey::State keyState, uint64_t frame);
+	void playMainPitch(double freq, uint64_t frame);
+	void playComponentIntensity(unsigned component, double intensity, uint64_t frame);
+	void playComponentRatio(unsigned component, double ratio, uint64_t frame);
 
 private:
 
+	struct Voice
+	{
+		Dynamic<Composite<WaveGenerator>> tone;
+		std::optional<unsigned> key{}, nextKey{}; // nextKey starts when the fade-out has finished
+		uint64_t age{ 0 };      // note-on counter at binding
+		float level{ 0.f };     // peak of the last block
+		unsigned fadeFrames{ 0 };
+		bool sounding{ false }, fadedOut{ false }; // results of the last block
+		std::size_t fadeEnd{ 0 }; // frame of the last block where the fade-out finished
+	};
+
+	void applyCommands(double t);
+	void releaseVoices();
+	void noteOn(unsigned key, double t);
+	void noteOff(unsigned key, double t);
+	void bind(Voice& voice, unsigned key, double t);
+	void tune(Voice& voice, double t);
+	static constexpr double fadeTime = 0.005; // of a stolen voice, in seconds
+
 	template<class T>
 	struct give_id
 	{
@@ -422,7 +698,7 @@ private:
 	}
 
 	template<class callback_t>
-	void removeCallback(std::vector<give_id<callback_t>>& arr, unsigned id)
+	void removeCallback(callback_t& raw_callback, std::vector<give_id<callback_t>>& arr, unsigned id)
 	{
 		auto found = std::find_if(arr.begin(), arr.end(), [id](const auto& elem) {
 			return elem.id == id;
@@ -433,21 +709,31 @@ private:
 		else {
 			arr.erase(found);
 			if (arr.size() == 0) {
-				afterSample = {};
+				raw_callback = {};
 			}
 		}
 	}
 
-	std::unordered_set<unsigned> pressedKeys;
+	std::vector<Voice> voices;
+	const std::vector<Note> notes;
+	std::vector<double> componentRatio;
+	double pitchRate{ 1. };
+	uint64_t noteCounter{ 0 };
+	std::atomic<VoiceStealing> stealing{ VoiceStealing::Oldest };
 	const unsigned maxTones;
 	mutable std::atomic<double> lastTime{ 0 };
-	mutable std::mutex mtx;
-	std::vector<give_id<after_t>> afterSampleCallbacks;
+	KeyEventQueue<1024> keyEvents;
+	// NaN while unchanged, per timbre component for the intensities and ratios
+	std::atomic<double> pendingPitch{ std::nan("") };
+	std::unique_ptr<std::atomic<double>[]> pendingIntensity, pendingRatio;
 	std::vector<give_id<before_t>> beforeSampleCallbacks;
 	TimbreModel timbreModel;
 	ADSREnvelope env;
 	before_t beforeSample;
-	after_t afterSample;
+	EffectGraph inserts;
+	std::vector<std::size_t> activeVoices;
+	std::vector<float> toneBuffer, envelopeGains; // one block per voice, after each other
+	std::vector<float> stereoBuffer;
 };
 
 
@@ -1,34 +1,35 @@
 #include "tones.h"
+#include "utility.h"
 
 const TimbreModel& Sine()
 {
-	static const TimbreModel ret({ {1.,1.,waves::sine} });
+	static const TimbreModel ret({ {1.,1.,waves::Shape::Sine} });
 	return ret;
 }
 const TimbreModel& Saw()
 {
-	static const TimbreModel ret({ {1.,1.,waves::sawtooth} });
+	static const TimbreModel ret({ {1.,1.,Wavetable::sawtooth()} });
 	return ret;
 }
 const TimbreModel& Square()
 {
-	static const TimbreModel ret({ {1.,1.,waves::square} });
+	static const TimbreModel ret({ {1.,1.,Wavetable::square()} });
 	return ret;
 }
 const TimbreModel& Triangle()
 {
-	static const TimbreModel ret({ {1.,1.,waves::triangle} });
+	static const TimbreModel ret({ {1.,1.,Wavetable::triangle()} });
 	return ret;
 }
 
 const TimbreModel& Sines1()
 {
 	static const TimbreModel ret({
-		{ 1., 1.,  waves::sine },
-		{ 3., 0.3, waves::sine },
-		{ 5., 0.3, waves::sine },
-		{ 7., 0.3, waves::sine },
-		{ 9., 0.3, waves::sine },
+		{ 1., 1.,  waves::Shape::Sine },
+		{ 3., 0.3, waves::Shape::Sine },
+		{ 5., 0.3, waves::Shape::Sine },
+		{ 7., 0.3, waves::Shape::Sine },
+		{ 9., 0.3, waves::Shape::Sine },
 	});
 	return ret;
 };
@@ -36,9 +37,9 @@ const TimbreModel& Sines1()
 const TimbreModel& Sines2()
 {
 	static const TimbreModel ret({
-		{ 1., 1.,  waves::sine },
-		{ 5., 0.2, waves::sine },
-		{ 1/2., 0.1, waves::sine },
+		{ 1., 1.,  waves::Shape::Sine },
+		{ 5., 0.2, waves::Shape::Sine },
+		{ 1/2., 0.1, waves::Shape::Sine },
 	});
 	return ret;
 };
@@ -46,9 +47,37 @@ const TimbreModel& Sines2()
 const TimbreModel& SinesTriangles()
 {
 	static const TimbreModel ret({
-		{ 1., 1.,  waves::sine },
-		{ 3., 0.4, waves::triangle },
-		{ 4., 0.1, waves::sine },
+		{ 1., 1.,  waves::Shape::Sine },
+		{ 3., 0.4, Wavetable::triangle() },
+		{ 4., 0.1, waves::Shape::Sine },
 	});
 	return ret;
-};
\ No newline at end of file
+};
+
+std::vector<Note> InstrumentPreset::notes() const
+{
+	return generateNotes(fromOctave, toOctave);
+}
+
+const std::vector<InstrumentPreset>& instrumentPresets()
+{
+	static const std::vector<InstrumentPreset> presets{
+		{ "Synth 1", Sines1(), ADSREnvelope(), 2, 6 },
+		{ "Soft bass", Sines2(), ADSREnvelope(), 1, 3 },
+		{ "Slow ADSR", SinesTriangles(), ADSREnvelope(0.5, 0.2, 0.5, 1., 0.5), 2, 5 },
+		{ "Sawtooth", Saw(), ADSREnvelope(0.01, 0.01, 0.5, 0.06, 0.01), 2, 5 },
+	};
+	return presets;
+}
+
+const InstrumentPreset& findPreset(const std::string& name)
+{
+	const auto& presets = instrumentPresets();
+	auto found = std::find_if(presets.begin(), presets.end(), [&name](const auto& preset) {
+		return preset.name == name;
+	});
+	if (found == presets.end()) {
+		throw std::out_of_range("There is no instrument called " + name + ".");
+	}
+	return *found;
+}
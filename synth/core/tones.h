@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <atomic>
+#include <string>
 
 #include "generators.h"
 
@@ -14,8 +15,23 @@ const TimbreModel& Sines1();
 const TimbreModel& Sines2();
 const TimbreModel& SinesTriangles();
 
+// An instrument which can be played live or rendered offline
+struct InstrumentPreset
+{
+	std::string name;
+	const TimbreModel& timbre;
+	ADSREnvelope envelope;
+	int fromOctave, toOctave;
+
+	std::vector<Note> notes() const;
+};
+
+const std::vector<InstrumentPreset>& instrumentPresets();
+// Throws std::out_of_range if there is no preset with that name
+const InstrumentPreset& findPreset(const std::string& name);
+
 template<typename T>
-std::vector<typename Dynamic<Composite<T>>> generateTones(
+std::vector<Dynamic<Composite<T>>> generateTones(
 	TimbreModel model,
 	const std::vector<Note>& notes,
 	const ADSREnvelope& env = {}
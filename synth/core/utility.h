@@ -10,12 +10,6 @@ using SynthFloat = double;
 using SynthVec2 = sf::Vector2<SynthFloat>;
 using SynthRect = sf::Rect<SynthFloat>;
 
-const sf::Font& loadCourierNew();
-
-sf::View getCroppedView(const sf::View& oldView, SynthFloat x, SynthFloat y, SynthFloat w, SynthFloat h);
-sf::View getCroppedView(const sf::View& oldView, const SynthVec2& p, const SynthVec2& s);
-sf::View getCroppedView(const sf::View& oldView, const SynthRect& box);
-
 struct Note;
 std::vector<Note> generateNotes(int fromOctave, int toOctave);
 
@@ -44,6 +44,7 @@ public:
 		};
 
 		setState(val);
+		ret->showOnOff = setState;
 		ret->clickCallback = [button = ret.get(), &val, setState, cb]() {
 			setState(!val);
 			if (cb) cb(!val);
@@ -56,6 +57,8 @@ public:
 	void setNormalColor(const sf::Color& col);
 	void setPressedColor(const sf::Color& col);
 	bool isPressed() const;
+	// Shows the state of an on/off button whose value changed without a click
+	void setOnOff(bool on) { if (showOnOff) showOnOff(on); }
 
 	virtual bool needsEvent(const SynthEvent& event) const override;
 
@@ -69,6 +72,7 @@ private:
 	void refreshCol();
 
 	std::function<void()> clickCallback;
+	std::function<void(bool)> showOnOff;
 	bool pressed{ false };
 	sf::Color normalCol{ getConfig("defaultButtonNormalColor") }, 
 		pressedCol{ getConfig("defaultButtonPressedColor") };
@@ -2,10 +2,17 @@
 #define GUIELEMENT_H_INCLUDED
 
 #include <functional>
-#include <sfml/Graphics.hpp>
+#include <memory>
+#include <SFML/Graphics.hpp>
 #include "../core/utility.h"
 #include "events.h"
 
+const sf::Font& loadCourierNew();
+
+sf::View getCroppedView(const sf::View& oldView, SynthFloat x, SynthFloat y, SynthFloat w, SynthFloat h);
+sf::View getCroppedView(const sf::View& oldView, const SynthVec2& p, const SynthVec2& s);
+sf::View getCroppedView(const sf::View& oldView, const SynthRect& box);
+
 class GuiElement : public sf::Drawable, public sf::Transformable, public std::enable_shared_from_this<GuiElement>
 {
 public:
@@ -49,6 +56,7 @@ public:
 	using midiCallback_t = std::function<void(const MidiEvent&)>;
 	using sfmlCallback_t = std::function<void(const sf::Event&)>;
 	using synthCallback_t = std::function<void(const SynthEvent&)>;
+	using drawCallback_t = std::function<void()>;
 
 	EmptyGuiElement() = default;
 	EmptyGuiElement(const sfmlCallback_t& sfml, const midiCallback_t& midi);
@@ -57,14 +65,17 @@ public:
 
 	void setCallback(const sfmlCallback_t& sfml);
 	void setCallback(const midiCallback_t& midi);
+	// Called on the GUI thread whenever the element would be drawn, while it is visible
+	void setOnDraw(const drawCallback_t& draw);
 
 protected:
-	virtual void drawImpl(sf::RenderTarget& target, sf::RenderStates states) const override {}
+	virtual void drawImpl(sf::RenderTarget& target, sf::RenderStates states) const override { if (drawCallback) drawCallback(); }
 	virtual void onSfmlEvent(const sf::Event& event) override { if (sfmlCallback) sfmlCallback(event); }
 	virtual void onMidiEvent(const MidiEvent& event) override { if (midiCallback) midiCallback(event); }
 
 	sfmlCallback_t sfmlCallback;
 	midiCallback_t midiCallback;
+	drawCallback_t drawCallback;
 };
 
 
@@ -1,22 +1,43 @@
 #include "Oscilloscope.h"
 
-Oscilloscope::Oscilloscope(SynthFloat sx, SynthFloat sy, unsigned res)
-	: resolution(res)
+namespace
+{
+	// How long before the window a rising edge is searched for, slower signals are not triggered
+	constexpr double triggerSearch = 0.1;
+	// An edge only counts after the signal was that far below the level, so noise around it does not retrigger
+	constexpr float triggerHysteresis = 0.02f;
+}
+
+Oscilloscope::Oscilloscope(SynthFloat sx, SynthFloat sy, unsigned sampleRate)
+	: sampleRate(sampleRate)
 {
 	window.setSize(sf::Vector2f(sx, sy));
 	window.setOutlineColor(sf::Color::White);
 	window.setFillColor(sf::Color::Black);
 	window.setOutlineThickness(-2.);
 
-	vArray.reserve(resolution * 2); // bigger buffer size for faster incoming samples
-	vArray.resize(resolution);
+	const std::size_t columns = std::max<std::size_t>(1, std::size_t(sx));
+	vArray.resize(2 * columns);
 	const auto& pos = window.getPosition();
 	const auto& size = window.getSize();
-	for (unsigned i = 0; i < resolution; ++i) {
-		vArray[i].position.x = pos.x + i * size.x / resolution;
+	for (std::size_t i = 0; i < vArray.size(); ++i) {
+		vArray[i].position.x = pos.x + (i / 2) * size.x / columns;
 		vArray[i].position.y = pos.y + size.y / 2;
 		vArray[i].color = sf::Color::Green;
 	}
+
+	std::size_t length = 1;
+	while (length < std::size_t((maxWindow + triggerSearch) * sampleRate) + 1) length *= 2;
+	mask = length - 1;
+	history.assign(length, 0.f);
+	// Level 0 is the history itself, the biggest blocks are about a column of the longest window
+	mins.emplace_back();
+	maxs.emplace_back();
+	for (std::size_t block = 2; block < length && block <= maxWindow * sampleRate / columns; block *= 2) {
+		mins.emplace_back(length / block, 0.f);
+		maxs.emplace_back(length / block, 0.f);
+	}
+	updateVertices();
 }
 
 SynthRect Oscilloscope::AABB() const
@@ -27,24 +48,104 @@ SynthRect Oscilloscope::AABB() const
 void Oscilloscope::drawImpl(sf::RenderTarget& target, sf::RenderStates states) const
 {
 	target.draw(window, states);
-	std::lock_guard lock(mtx);
-	target.draw(vArray.data(), resolution, sf::LineStrip, states);
+	target.draw(vArray.data(), vArray.size(), sf::LineStrip, states);
+}
+
+void Oscilloscope::addSamples(const float* samples, std::size_t count)
+{
+	for (std::size_t n = 0; n < count; ++n) {
+		const uint64_t i = written++;
+		history[i & mask] = samples[n];
+		// A block is summed up when its last sample arrives, from its two halves
+		for (std::size_t k = 1; k < mins.size() && ((i + 1) & ((uint64_t(1) << k) - 1)) == 0; ++k) {
+			const uint64_t first = (i >> (k - 1)) & ~uint64_t(1), second = first + 1;
+			const std::size_t halfMask = mask >> (k - 1);
+			const float lo = k == 1 ? std::min(history[first & mask], history[second & mask]) : std::min(mins[k - 1][first & halfMask], mins[k - 1][second & halfMask]);
+			const float hi = k == 1 ? std::max(history[first & mask], history[second & mask]) : std::max(maxs[k - 1][first & halfMask], maxs[k - 1][second & halfMask]);
+			mins[k][(i >> k) & (mask >> k)] = lo;
+			maxs[k][(i >> k) & (mask >> k)] = hi;
+		}
+	}
+	updateVertices();
+}
+
+void Oscilloscope::setWindow(double seconds)
+{
+	windowLength = std::clamp(seconds, minWindow, maxWindow);
+	updateVertices();
+}
+
+double Oscilloscope::getWindow() const
+{
+	return windowLength;
+}
+
+void Oscilloscope::setTrigger(bool on, float level)
+{
+	triggered = on;
+	triggerLevel = level;
+	updateVertices();
+}
+
+std::pair<float, float> Oscilloscope::range(uint64_t begin, uint64_t end) const
+{
+	float lo = std::numeric_limits<float>::max(), hi = std::numeric_limits<float>::lowest();
+	for (uint64_t i = begin; i < end;) {
+		// The biggest block starting at i which ends in the range
+		std::size_t k = 0;
+		while (k + 1 < mins.size() && (i & ((uint64_t(2) << k) - 1)) == 0 && i + (uint64_t(2) << k) <= end) ++k;
+		if (k == 0) {
+			lo = std::min(lo, history[i & mask]);
+			hi = std::max(hi, history[i & mask]);
+		}
+		else {
+			lo = std::min(lo, mins[k][(i >> k) & (mask >> k)]);
+			hi = std::max(hi, maxs[k][(i >> k) & (mask >> k)]);
+		}
+		i += uint64_t(1) << k;
+	}
+	return { lo, hi };
 }
 
-void Oscilloscope::newSamples(const std::vector<double>& samples) const
+uint64_t Oscilloscope::windowBegin(uint64_t frames) const
 {
-	std::lock_guard lock(mtx);
-	const double halfY = window.getSize().y / 2;
-	const unsigned dif = samples.size();
-	if (dif < vArray.size()) {
-		for (auto i = vArray.begin(); i < vArray.end() - dif; ++i)
-			i->position.y = (i + dif)->position.y;
-		const std::size_t shift = vArray.size() + dif;
-		for (auto i = vArray.end() - dif; i < vArray.end(); ++i)
-			i->position.y = window.getPosition().y + halfY + std::clamp(samples[i - vArray.begin() - shift], -1., 1.) * halfY;
+	const uint64_t newest = written > frames ? written - frames : 0;
+	if (!triggered) return newest;
+
+	// The last rising edge which still has a whole window after it, searched for at most
+	// one window before it, so the cost is that of drawing the samples
+	const uint64_t oldest = written > mask ? written - mask : 0;
+	const uint64_t search = std::min(frames, uint64_t(triggerSearch * sampleRate));
+	const uint64_t limit = std::max(oldest, newest > search ? newest - search : 0);
+	uint64_t edge = newest;
+	bool armed = false;
+	for (uint64_t i = limit; i <= newest; ++i) {
+		const float sample = history[i & mask];
+		if (sample < triggerLevel - triggerHysteresis) armed = true;
+		else if (armed && sample >= triggerLevel) {
+			edge = i;
+			armed = false;
+		}
 	}
-	else {
-		for (unsigned i = 0; i < vArray.size(); ++i)
-			vArray[i].position.y = window.getPosition().y + halfY + std::clamp(samples[i], -1., 1.) * halfY;
+	return edge;
+}
+
+void Oscilloscope::updateVertices()
+{
+	const std::size_t columns = vArray.size() / 2;
+	const uint64_t frames = std::max<uint64_t>(1, uint64_t(std::llround(windowLength * sampleRate)));
+	const uint64_t begin = windowBegin(frames);
+	const double top = window.getPosition().y, halfY = window.getSize().y / 2;
+	auto y = [top, halfY](float sample) {
+		return float(top + halfY - std::clamp(double(sample), -1., 1.) * halfY);
+	};
+
+	for (std::size_t x = 0; x < columns; ++x) {
+		const uint64_t from = begin + x * frames / columns;
+		const uint64_t to = std::max(from + 1, begin + (x + 1) * frames / columns);
+		// Nothing was recorded there yet
+		const auto [lo, hi] = to <= written ? range(from, to) : std::pair(0.f, 0.f);
+		vArray[2 * x].position.y = y(lo);
+		vArray[2 * x + 1].position.y = y(hi);
 	}
-}
\ No newline at end of file
+}
@@ -3,25 +3,45 @@
 
 #include "GuiElement.h"
 
+// Only used from the GUI thread, the samples are handed over by the caller.
+// The last maxWindow seconds are kept in a ring, with the minimum and maximum of every
+// block of 2^k samples next to it. Every pixel column is drawn from the fewest blocks which
+// cover its samples, so the cost depends on the width and not on the sample rate or window.
 class Oscilloscope : public GuiElement
 {
 public:
-	Oscilloscope(SynthFloat sx, SynthFloat sy, unsigned resolution);
+	static constexpr double minWindow = 0.001, maxWindow = 10.; // in seconds
+
+	Oscilloscope(SynthFloat sx, SynthFloat sy, unsigned sampleRate);
 
 	virtual SynthRect AABB() const override;
 
-	unsigned getResolution() const { return resolution; }
-	void newSamples(const std::vector<double>& samples) const;
+	void addSamples(const float* samples, std::size_t count);
+	// The time shown, clamped to [minWindow, maxWindow]
+	void setWindow(double seconds);
+	double getWindow() const;
+	// With the trigger on, the window starts at the last rising edge through the level within
+	// a window before the newest samples, so periodic signals stand still. Without an edge the
+	// newest samples are shown.
+	void setTrigger(bool on, float level = 0.f);
 
 private:
 	virtual void drawImpl(sf::RenderTarget& target, sf::RenderStates states) const override;
+	std::pair<float, float> range(uint64_t begin, uint64_t end) const;
+	uint64_t windowBegin(uint64_t frames) const;
+	void updateVertices();
 
 	sf::RectangleShape window;
-	mutable std::vector<sf::Vertex> vArray;
-	const unsigned resolution;
-	double currTime = 0;
-
-	mutable std::mutex mtx;
+	std::vector<sf::Vertex> vArray; // a minimum and a maximum per pixel column
+	const unsigned sampleRate;
+	double windowLength{ 0.02 };
+	bool triggered{ true };
+	float triggerLevel{ 0.f };
+
+	std::vector<float> history;
+	std::vector<std::vector<float>> mins, maxs; // level k holds blocks of 2^k samples, k > 0
+	std::size_t mask;
+	uint64_t written{ 0 };
 };
 
-#endif //OSCILLOSCOPE_H_INCLUDED
\ No newline at end of file
+#endif //OSCILLOSCOPE_H_INCLUDED
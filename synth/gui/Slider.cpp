@@ -187,6 +187,12 @@ void Slider::moveSlider(const SynthVec2& p)
 }
 
 void Slider::setValue(double newVal)
+{
+	showValue(newVal);
+	if(onMove) onMove();
+}
+
+void Slider::showValue(double newVal)
 {
 	newVal = std::clamp(newVal, from, to);
 	double newValueNormalized = -(newVal - from) / (to - from) + 1.f;
@@ -198,6 +204,5 @@ void Slider::setValue(double newVal)
 	else
 		sliderRect.setPosition(newPos.x, currentPos.y);
 	value = newVal;
-	if(onMove) onMove();
 	refreshText();
 }
\ No newline at end of file
@@ -71,6 +71,8 @@ public:
 
 	double getValue() const { return value; }
 	void setValue(double newVal);
+	// Moves the slider without calling onMove, to show a value set elsewhere
+	void showValue(double newVal);
 
 private:
 	virtual void drawImpl(sf::RenderTarget& target, sf::RenderStates states) const override;
@@ -77,7 +77,8 @@ SynthKeyboard::SynthKeyboard(unsigned keyCount, callback_t eventCallback)
 		if (keyIdx < keys.size()) {
 			eventCallback(keyIdx, keyState);
 		}
-	})
+	}),
+	midiPressed(std::make_unique<std::atomic<bool>[]>(keyCount))
 {
 	repositionKeys(keyCount);
 }
@@ -93,35 +94,6 @@ void SynthKeyboard::setSize(SynthKey::Type type, const SynthVec2& size)
 	repositionKeys(keys.size());
 }
 
-void SynthKeyboard::onMidiEvent(const MidiEvent & event)
-{
-	unsigned char eventType = event.getRawMessage()[0];
-	unsigned char keyCode = event.getRawMessage()[1];
-	unsigned char intensity = event.getRawMessage()[2];
-
-	const auto& message = event.getRawMessage();
-	uint8_t least = message[1] & 0b0111'1111;
-	uint8_t most = message[2] & 0b0111'1111;
-	uint16_t all = least + (most << 7);
-
-	unsigned char middleC = 48;
-	unsigned char value = keyCode - middleC;
-	if (value >= keys.size())
-		return;
-
-	switch (event.getType())
-	{
-	case MidiEvent::Type::KEYDOWN:
-		onKey(value, SynthKey::State::Pressed);
-		break;
-	case MidiEvent::Type::KEYUP:
-		onKey(value, SynthKey::State::Released);
-		break;
-	default:
-		break;
-	}
-}
-
 void SynthKeyboard::onSfmlEvent(const sf::Event & event)
 {
 	const auto& key = event.key.code;
@@ -191,13 +163,25 @@ void SynthKeyboard::onSfmlEvent(const sf::Event & event)
 
 void SynthKeyboard::drawImpl(sf::RenderTarget& target, sf::RenderStates states) const
 {
-	for (const auto& key : keys)
-		if (key.type == SynthKey::White)
-			target.draw(key, states);
+	// Keys held on a MIDI keyboard are drawn as pressed copies
+	const auto drawKey = [&](std::size_t i) {
+		if (midiPressed[i].load(std::memory_order_relaxed)) {
+			SynthKey pressedKey(keys[i]);
+			pressedKey.setPressed(true);
+			target.draw(pressedKey, states);
+		}
+		else {
+			target.draw(keys[i], states);
+		}
+	};
+
+	for (std::size_t i = 0; i < keys.size(); ++i)
+		if (keys[i].type == SynthKey::White)
+			drawKey(i);
 
-	for (const auto& key : keys)
-		if (key.type == SynthKey::Black)
-			target.draw(key, states);
+	for (std::size_t i = 0; i < keys.size(); ++i)
+		if (keys[i].type == SynthKey::Black)
+			drawKey(i);
 }
 
 SynthRect SynthKeyboard::AABB() const
@@ -210,7 +194,8 @@ SynthRect SynthKeyboard::AABB() const
 
 bool SynthKeyboard::needsEvent(const SynthEvent & event) const
 {
-	if (std::holds_alternative<MidiEvent>(event)) return true;
+	// MIDI notes are played and shown by the MidiRouter
+	if (std::holds_alternative<MidiEvent>(event)) return false;
 	const auto& sfEvent = std::get<sf::Event>(event);
 	if (sfEvent.type == sf::Event::KeyPressed ||
 		sfEvent.type == sf::Event::KeyReleased)
@@ -234,6 +219,12 @@ unsigned SynthKeyboard::getOctaveShift()
 	return octaveShift;
 }
 
+void SynthKeyboard::showMidiKey(unsigned key, bool pressed)
+{
+	if (key < keys.size())
+		midiPressed[key].store(pressed, std::memory_order_relaxed);
+}
+
 KeyboardOutput::KeyboardOutput(unsigned keyCount)
 	:kb(std::make_unique<SynthKeyboard>(keyCount, [this](unsigned keyIdx, SynthKey::State keyState) {
 		if (keyState == SynthKey::State::Pressed) {
@@ -39,9 +39,10 @@ public:
 	SynthKey& operator[] (std::size_t i);
 	void setOctaveShift(unsigned n);
 	unsigned getOctaveShift();
+	// Marks a key played by MIDI, from any thread. It is drawn pressed until it is released.
+	void showMidiKey(unsigned key, bool pressed);
 
 private:
-	virtual void onMidiEvent(const MidiEvent& event) override;
 	virtual void onSfmlEvent(const sf::Event& event) override;
 	virtual void drawImpl(sf::RenderTarget& target, sf::RenderStates states) const override;
 	void repositionKeys(unsigned keyCount);
@@ -50,6 +51,7 @@ private:
 	callback_t onKey;
 	SynthVec2 blackSize{ SynthKey::blackSizeDefault() }, whiteSize{ SynthKey::whiteSizeDefault() };
 	unsigned octaveShift{ 0 };
+	std::unique_ptr<std::atomic<bool>[]> midiPressed;
 };
 
 class KeyboardOutput
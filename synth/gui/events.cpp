@@ -1,12 +1,18 @@
 #include "events.h"
 #include "../core/utility.h"
+#include "../core/Transport.h"
 
 #include <exception>
+#include <algorithm>
 
 MidiEvent::MidiEvent(double t, const std::vector<unsigned char>& msg)
 	:timestamp(t), message(msg)
 {}
 
+MidiEvent::MidiEvent(const MidiMessage& msg)
+	:timestamp(msg.time * 1e-9), message(msg.bytes.begin(), msg.bytes.begin() + msg.size)
+{}
+
 double MidiEvent::getTime() const 
 { 
 	return timestamp; 
@@ -78,16 +84,8 @@ bool MidiContext::openPort(unsigned p)
 {
 	try {
 		midiInput.openPort(p);
-		midiInput.ignoreTypes(false, false, false);
-		midiInput.setCallback([](double dt, std::vector<unsigned char>* msg, void* userData) {
-			if (msg->size() > 0) {
-				auto data = static_cast<void**>(userData);
-				auto& q = *static_cast<decltype(msgQueue)*>(data[0]);
-				auto& m = *static_cast<decltype(midiMutex)*>(data[1]);
-				std::lock_guard<std::mutex> lock(m);
-				q.emplace(dt, *msg);
-			}
-		}, userData);
+		midiInput.ignoreTypes(true, false, false);
+		midiInput.setCallback(&MidiContext::onMessage, this);
 		return true;
 	}
 	catch (...) {
@@ -95,12 +93,25 @@ bool MidiContext::openPort(unsigned p)
 	}
 }
 
+void MidiContext::onMessage(double dt, std::vector<unsigned char>* msg, void* userData)
+{
+	if (msg->empty() || msg->size() > 3) return;
+	auto& context = *static_cast<MidiContext*>(userData);
+	MidiMessage message;
+	message.time = Transport::now();
+	message.size = uint8_t(msg->size());
+	std::copy(msg->begin(), msg->end(), message.bytes.begin());
+	if (context.audioQueue) context.audioQueue->push(message);
+	context.guiQueue.push(message);
+}
+
 MidiContext::~MidiContext()
 {
 	midiInput.closePort();
 }
 
-MidiContext::MidiContext(std::optional<unsigned> port)
+MidiContext::MidiContext(std::optional<unsigned> port, MidiQueue* audioQueue)
+	:audioQueue(audioQueue)
 {
 	midiInput.setErrorCallback([](RtMidiError::Type type, const std::string & errorText, void* userData) {
 		log("MidiError: "s + errorText);
@@ -116,7 +127,7 @@ MidiContext::MidiContext(std::optional<unsigned> port)
 				}
 			}
 		}
-		else {
+		else if (openPort(port.value())) {
 			// The selected port is opened
 			openedPort = port.value();
 		}
@@ -135,15 +146,12 @@ MidiContext::operator bool() const
 
 bool MidiContext::pollEvent(MidiEvent& event)
 {
-	std::lock_guard<std::mutex> lock(midiMutex);
-	if (msgQueue.empty()) {
+	MidiMessage message;
+	if (!guiQueue.pop(message)) {
 		return false;
 	}
-	else {
-		event = std::move(msgQueue.front());
-		msgQueue.pop();
-		return true;
-	}
+	event = MidiEvent(message);
+	return true;
 }
 
 
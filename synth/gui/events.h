@@ -4,11 +4,11 @@
 #include <SFML/Window.hpp>
 #include <RtMidi.h>
 
-#include <queue>
-#include <mutex>
 #include <variant>
 #include <optional>
 
+#include "../core/MidiMessage.h"
+
 class MidiEvent
 {
 public:
@@ -26,6 +26,7 @@ public:
 	static constexpr Key_t        keyMax()        { return Key_t       {0b01111111}; }
 
 	MidiEvent(double t = 0., const std::vector<unsigned char>& msg = {});
+	explicit MidiEvent(const MidiMessage& msg);
 	double getTime() const;
 	const std::vector<unsigned char>& getRawMessage() const;
 	const Type         getType() const;
@@ -41,10 +42,12 @@ private:
 	std::vector<unsigned char> message;
 };
 
+// Messages are stamped on arrival. They are handed to the audio thread through audioQueue,
+// if there is one, and to the GUI thread through pollEvent. System exclusive messages are ignored.
 class MidiContext
 {
 public:
-	MidiContext(std::optional<unsigned> port = {});
+	MidiContext(std::optional<unsigned> port = {}, MidiQueue* audioQueue = nullptr);
 	MidiContext(const MidiContext& other) = delete;
 	~MidiContext();
 
@@ -56,12 +59,12 @@ public:
 
 private:
 	bool openPort(unsigned p);
+	static void onMessage(double dt, std::vector<unsigned char>* msg, void* userData);
 
 	RtMidiIn midiInput;
 	std::optional<unsigned> openedPort;
-	std::queue<MidiEvent> msgQueue;
-	std::mutex midiMutex;
-	void* userData[2] = { &msgQueue, &midiMutex };
+	MidiQueue guiQueue;
+	MidiQueue* audioQueue;
 };
 
 using SynthEvent = std::variant<MidiEvent, sf::Event>;
@@ -2,6 +2,14 @@
 
 #ifdef __TEST__
 #include "test/test.h"
+#elif defined(__BENCHMARK__)
+#include <exception>
+#include "core/utility.h"
+#include "test/benchmarkSuite.h"
+#elif defined(__RENDER__)
+#include <exception>
+#include "core/utility.h"
+#include "renderMain/renderMain.h"
 #else
 #include <exception>
 #include "core/utility.h"
@@ -10,12 +18,17 @@
 
 int main(int argc, char** argv)
 {
+	int status = 1;
 	try {
 		log("======================= Program started =======================");
 #ifdef __TEST__
-		testMain(argc, argv);
+		status = testMain(argc, argv);
+#elif defined(__BENCHMARK__)
+		status = benchmarkMain(argc, argv);
+#elif defined(__RENDER__)
+		status = renderMain(argc, argv);
 #else
-		synthMain(argc, argv);
+		status = synthMain(argc, argv);
 #endif
 		log("Program terminated gracefully");
 	}
@@ -25,5 +38,5 @@ int main(int argc, char** argv)
 	catch (...) {
 		log("Program terminated due to an unknown error");
 	}
-	return 0;
+	return status;
 }
@@ -0,0 +1,198 @@
+#include "renderMain.h"
+
+#include "../core/tones.h"
+#include "../core/Score.h"
+#include "../core/RenderPool.h"
+#include "../core/utility.h"
+#include "../core/WavWriter.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+namespace
+{
+	// MIDI note of the first key of an instrument, the same as for live MIDI input
+	const unsigned firstKeyNote = 48;
+
+	struct Options
+	{
+		std::string preset, scorePath, outPath;
+		unsigned sampleRate = 44100;
+		unsigned blockSize = 512;
+		unsigned voices = 32;
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		unsigned bitDepth = 24;
+		double tail = 10.; // longest release rendered after the last event, in seconds
+		double length = 10.; // of a stress pattern, in seconds
+		double pan = 0., width = 0.;
+	};
+
+	void printUsage()
+	{
+		std::cerr <<
+			"Usage: Synth <preset> <score> <output.wav> [options]\n"
+			"  score: event script, a .mid file, or the stress pattern chords, arpeggios or glissandi\n"
+			"  --rate <Hz>        sample rate (44100)\n"
+			"  --block <frames>   block size (512)\n"
+			"  --voices <count>   voices of the instrument (32)\n"
+			"  --threads <count>  render threads besides this one (cores - 1)\n"
+			"  --bits <16|24>     bit depth of the output (24)\n"
+			"  --tail <seconds>   longest release after the last event (10)\n"
+			"  --length <seconds> of a stress pattern (10)\n"
+			"  --pan <-1..1>, --width <0..1>\n"
+			"Presets:";
+		for (const auto& preset : instrumentPresets())
+			std::cerr << " \"" << preset.name << "\"";
+		std::cerr << "\n";
+	}
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options options;
+		std::vector<std::string> positional;
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg = argv[i];
+			if (arg.rfind("--", 0) != 0) {
+				positional.push_back(arg);
+				continue;
+			}
+			if (i + 1 == argc) {
+				throw std::invalid_argument(arg + " needs a value.");
+			}
+			const std::string value = argv[++i];
+			if (arg == "--rate") options.sampleRate = std::stoul(value);
+			else if (arg == "--block") options.blockSize = std::stoul(value);
+			else if (arg == "--voices") options.voices = std::stoul(value);
+			else if (arg == "--threads") options.threads = std::stoul(value);
+			else if (arg == "--bits") options.bitDepth = std::stoul(value);
+			else if (arg == "--tail") options.tail = std::stod(value);
+			else if (arg == "--length") options.length = std::stod(value);
+			else if (arg == "--pan") options.pan = std::stod(value);
+			else if (arg == "--width") options.width = std::stod(value);
+			else throw std::invalid_argument("Unknown option " + arg + ".");
+		}
+		if (positional.size() != 3) {
+			throw std::invalid_argument("A preset, a score and an output file are needed.");
+		}
+		if (!options.sampleRate || !options.blockSize || !options.voices) {
+			throw std::invalid_argument("The sample rate, the block size and the voice count have to be positive.");
+		}
+		if (options.bitDepth != 16 && options.bitDepth != 24) {
+			throw std::invalid_argument("The bit depth has to be 16 or 24.");
+		}
+		options.preset = positional[0];
+		options.scorePath = positional[1];
+		options.outPath = positional[2];
+		return options;
+	}
+
+	int render(const Options& options)
+	{
+		const auto& preset = findPreset(options.preset);
+		// Stress patterns cover the keys of the instrument
+		const auto& patterns = stressPatternNames();
+		const bool isPattern = std::find(patterns.begin(), patterns.end(), options.scorePath) != patterns.end();
+		const unsigned lastNote = firstKeyNote + unsigned(std::max<std::size_t>(1, preset.notes().size())) - 1;
+		const Score score = isPattern
+			? stressPattern(options.scorePath, options.length, firstKeyNote, std::min(127u, lastNote))
+			: readScore(options.scorePath);
+		const unsigned rate = options.sampleRate;
+		timing::setSampleRate(rate);
+		RenderPool::instance().setThreadCount(options.threads);
+		DynamicToneSum generator{ preset.timbre, preset.envelope, preset.notes(), options.voices };
+		const Panning panning{ options.pan, options.width };
+
+		auto frameOf = [rate](double t) { return uint64_t(std::llround(t * rate)); };
+		const uint64_t lastEventFrame = score.empty() ? 0 : frameOf(score.back().time);
+		const uint64_t endFrame = lastEventFrame + std::max<uint64_t>(1, uint64_t(options.tail * rate));
+		WavWriter output(options.outPath, rate, 2, options.bitDepth == 16 ? WavWriter::Format::Pcm16 : WavWriter::Format::Pcm24);
+		std::vector<float> block(2 * std::size_t(options.blockSize)), silence(block.size());
+		float peak = 0.f;
+
+		// Blocks are written as they are rendered. Silence after the last event is held back, so the
+		// file ends at the last sound and its length does not depend on the block size.
+		uint64_t heldFrames = 0;
+		auto writeSilence = [&]() {
+			while (heldFrames) {
+				const std::size_t n = std::size_t(std::min<uint64_t>(heldFrames, options.blockSize));
+				output.write(silence.data(), n);
+				heldFrames -= n;
+			}
+		};
+
+		// Blocks end at the events, so every event is applied at its exact frame
+		const auto begin = std::chrono::steady_clock::now();
+		uint64_t frame = 0;
+		std::size_t next = 0;
+		unsigned skipped = 0;
+		while (frame < endFrame) {
+			for (; next < score.size() && frameOf(score[next].time) <= frame; ++next) {
+				const auto& event = score[next];
+				if (event.note < firstKeyNote || event.note - firstKeyNote >= generator.getNotesCount()) {
+					skipped += event.velocity != 0;
+					continue;
+				}
+				generator.onKeyEvent(event.note - firstKeyNote, event.velocity ? SynthKey::State::Pressed : SynthKey::State::Released);
+			}
+			const uint64_t until = next < score.size() ? frameOf(score[next].time) : endFrame;
+			const std::size_t frames = std::size_t(std::min<uint64_t>(options.blockSize, until - frame));
+			generator.renderStereoBlock(block.data(), frames, frame, panning);
+
+			// Frames up to the last sound or the last event are written
+			std::size_t sounding = frames;
+			while (sounding && block[2 * sounding - 1] == 0.f && block[2 * sounding - 2] == 0.f)
+				--sounding;
+			const std::size_t kept = std::max(sounding, std::size_t(std::min<uint64_t>(frames, lastEventFrame - std::min(frame, lastEventFrame))));
+			if (kept) {
+				writeSilence();
+				output.write(block.data(), kept);
+				for (std::size_t i = 0; i < 2 * kept; ++i)
+					peak = std::max(peak, std::abs(block[i]));
+			}
+			heldFrames += frames - kept;
+			frame += frames;
+
+			// The piece ends with the first silent block after the last event
+			if (next == score.size() && !sounding)
+				break;
+		}
+		output.close();
+		const std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - begin;
+
+		const double seconds = double(output.getFrames()) / rate;
+		std::ostringstream report;
+		report << "Rendered " << score.size() << " events of " << options.scorePath << " with " << preset.name
+			<< " to " << options.outPath << ": " << seconds << " s of audio in " << renderTime.count()
+			<< " s, realtime factor " << seconds / std::max(renderTime.count(), 1e-9)
+			<< ", peak " << peak;
+		if (skipped) report << ", " << skipped << " notes out of the range of the instrument";
+		if (generator.getMergedKeyEvents()) report << ", " << generator.getMergedKeyEvents() << " key events merged";
+		std::cout << report.str() << "\n";
+		log(report.str());
+		return 0;
+	}
+}
+
+int renderMain(int argc, char** argv)
+{
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		printUsage();
+		return 1;
+	}
+
+	try {
+		return render(options);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		throw;
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef RENDERMAIN_H
+#define RENDERMAIN_H
+
+// Renders a score with an instrument preset to a WAV file as fast as possible,
+// without a window or an audio device
+int renderMain(int argc, char** argv);
+
+#endif
\ No newline at end of file
@@ -4,18 +4,23 @@
 #include "../gui/Window.h"
 #include "../gui/Slider.h"
 #include "../core/Instrument.h"
+#include "../core/MidiRouter.h"
 
 #include <unordered_map>
 #include <optional>
 #include <vector>
 #include <numeric>
+#include <iostream>
+#include <thread>
+#include <chrono>
 
 
 namespace
 {
 	using pos_t = MenuOption::OptionList::ChildPos_t;
 
-	std::vector<std::function<void(double, double&)>> afterEffects;
+	// The master effects, after the sum of the instruments
+	std::shared_ptr<EffectGraph> masterEffects = std::make_shared<EffectGraph>();
 
 	auto& getInputInstrument()
 	{
@@ -27,71 +32,144 @@ namespace
 
 	auto& getInstruments()
 	{
-		static KeyboardInstrument inst1{
-			"Synth 1",
-			Sines1(),
-			ADSREnvelope(),
-			generateNotes(2, 6),
-			getConfig("maxNoteCount")
+		static KeyboardInstrument inst1{ findPreset("Synth 1"), getConfig("maxNoteCount") };
+		static KeyboardInstrument inst2{ findPreset("Soft bass"), getConfig("maxNoteCount") };
+		static auto& inst3 = getInputInstrument();
+		static KeyboardInstrument inst4{ findPreset("Slow ADSR"), getConfig("maxNoteCount") };
+		static KeyboardInstrument inst5{ findPreset("Sawtooth"), getConfig("maxNoteCount") };
+		// Files like Samples/Piano_60.wav, named after their MIDI note, from C2 up
+		static SamplerInstrument inst6{
+			"Sampler",
+			Sampler::scanDirectory("Samples"),
+			ADSREnvelope(.005, .1, 1., .3),
+			36,
+			49,
+			getConfig("maxNoteCount"),
+			getConfig("samplerPreloadMs") / 1000.
 		};
 
-		static KeyboardInstrument inst2{
-			"Soft bass",
-			Sines2(),
-			ADSREnvelope(),
-			generateNotes(1, 3),
-			getConfig("maxNoteCount")
-		};
-		static auto& inst3 = getInputInstrument();
+		static auto instruments = std::forward_as_tuple(inst1, inst2, inst3, inst4, inst5, inst6); 
+		return instruments;
+	}
 
-		static KeyboardInstrument inst4{
-			"Slow ADSR",
-			SinesTriangles(),
-			ADSREnvelope(0.5, 0.2, 0.5, 1., 0.5),
-			generateNotes(2, 5),
-			getConfig("maxNoteCount")
-		};
+	MidiRouter& getMidiRouter()
+	{
+		static MidiRouter router;
+		return router;
+	}
 
-		static KeyboardInstrument inst5{
-			"Sawtooth",
-			Saw(),
-			ADSREnvelope(0.01, 0.01, 0.5, 0.06, 0.01),
-			generateNotes(2, 5),
-			getConfig("maxNoteCount")
-		};
+	// Instruments which play MIDI notes are targets of the router. By default they listen to every
+	// channel while their window is open, like GUI events only reach open windows.
+	template<class Instrument_t>
+	void connectMidi(Instrument_t& instrument)
+	{
+		auto& router = getMidiRouter();
+		MidiRouter::Route route;
+		route.firstNote = uint8_t(instrument.getFirstMidiKey());
+		route.enabled = false;
+		const unsigned target = router.addTarget(
+			instrument.getTitle(),
+			[&instrument](unsigned key, SynthKey::State keyState, uint64_t frame) { instrument.onMidiKey(key, keyState, frame); },
+			[&instrument](const MidiMessage& message, uint64_t frame) { instrument.onMidiControl(message, frame); },
+			route
+		);
+		instrument.setOnOpen([&router, target](bool open) { router.setEnabled(target, open); });
+	}
 
-		static auto instruments = std::forward_as_tuple(inst1, inst2, inst3, inst4, inst5); 
-		return instruments;
+	void connectMidi(InputInstrument& instrument) {}
+
+	// Once, before the stream plays. The instruments get the MIDI of the router and schedule
+	// the events of their widgets on the stream.
+	void connectInstruments(SynthStream& stream)
+	{
+		std::apply([&stream](auto&... instruments) {
+			(connectMidi(instruments), ...);
+			(instruments.scheduleOn(stream), ...);
+		}, getInstruments());
 	}
 
-	auto& getSynth()
+	// The backend is only used by the first call, which creates the stream
+	auto& getSynth(std::unique_ptr<AudioBackend> backend = {})
 	{
 		static SumGenerator generator(
-			[](double t, double& sample) {
-				for (auto f : afterEffects)
-					f(t, sample);
-			},
+			masterEffects,
 			getInstruments()
 		);
 		static SynthStream synthStream{
 			getConfig("sampleRate"),
 			getConfig("bufferSize"),
-			[](double t) -> double {
-				return generator.getSample(t);
+			[](float* out, std::size_t frames, uint64_t startFrame) {
+				generator.renderStereoBlock(out, frames, startFrame);
 			},
-			[](double t) -> double {
-				return generator.getSample(t);
+			[](const float* in, std::size_t frames, uint64_t startFrame) {
+				getInputInstrument()(in, frames, startFrame);
 			},
-			[](double t) {
-				getInputInstrument()(t);
-			}
+			[](const MidiMessage& message, uint64_t frame) {
+				getMidiRouter().dispatch(message, frame);
+			},
+			std::move(backend)
 		};
 		return synthStream;
 	}
 
+	// A row per instrument: channel, lowest and highest note, and the note of its first key.
+	// Overlapping ranges on a channel are layers, neighbouring ones are splits.
+	// Channels are shown from 1 like on the devices, 0 is every channel.
+	std::shared_ptr<Window> createMidiRouting()
+	{
+		auto& router = getMidiRouter();
+		auto frame = std::make_shared<Frame>();
+		frame->setBgColor(sf::Color::Black);
+		frame->setChildAlignment(10);
+		frame->setCursor(10, 10);
+
+		using member_t = uint8_t MidiRouter::Route::*;
+		const auto addField = [&](unsigned target, member_t member) {
+			const bool isChannel = member == &MidiRouter::Route::channel;
+			const auto show = [isChannel](uint8_t value) {
+				return std::to_string(isChannel ? (value + 1) % (MidiRouter::omni + 1) : value);
+			};
+			auto input = std::make_shared<InputField>(InputField::Int, 60, getConfig("defaultTextHeight"));
+			input->setTextCentered(show(router.getRoute(target).*member));
+			input->setOnEnd([&router, target, member, isChannel, show, input]() {
+				auto route = router.getRoute(target);
+				try {
+					int value = std::stoi(std::string(input->getText()));
+					if (isChannel) value = value ? value - 1 : MidiRouter::omni;
+					if (value < 0 || value > 127) {
+						throw std::out_of_range("MIDI values are 7 bits");
+					}
+					route.*member = uint8_t(value);
+					router.setRoute(target, route);
+				}
+				catch (...) {
+					route = router.getRoute(target);
+				}
+				input->setTextCentered(show(route.*member));
+			});
+			frame->addChildAutoPos(input);
+		};
+
+		frame->addChildAutoPos(TextDisplay::DefaultText("Channel (0 is every one), lowest note, highest note, note of the first key", 20));
+		for (unsigned target = 0; target < router.getTargetCount(); ++target) {
+			frame->newLine();
+			addField(target, &MidiRouter::Route::channel);
+			addField(target, &MidiRouter::Route::lowNote);
+			addField(target, &MidiRouter::Route::highNote);
+			addField(target, &MidiRouter::Route::firstNote);
+			frame->addChildAutoPos(TextDisplay::DefaultText(router.getName(target), 20));
+		}
+		frame->fitToChildren();
+
+		auto window = std::make_shared<Window>(frame);
+		window->setHeader(getConfig("defaultHeaderSize"), "MIDI routing");
+		window->setVisibility(false);
+		return window;
+	}
+
 	void addAfterEffects(std::shared_ptr<Window> mainWindow)
 	{
-		if (afterEffects.size()) {
+		if (masterEffects->size()) {
 			throw std::logic_error("This function should not be called more than once.");
 		}
 
@@ -107,13 +185,14 @@ namespace
 		delayWindow->setVisibility(false);
 		gui->addChildAutoPos(delayWindow);
 
-		auto debugEffect = DebugEffect();
+		auto debugEffect = DebugEffect(getConfig("sampleRate"));
+		debugEffect.showStreamStats(getSynth().getStats());
 		auto debugWindow = std::make_shared<Window>(debugEffect.getFrame());
 		debugWindow->setHeader(getConfig("defaultHeaderSize"), "Debug");
 		debugWindow->setVisibility(false);
 		gui->addChildAutoPos(debugWindow);
 
-		auto saveEffect = SaveToFile("Test.wav", getConfig("sampleRate"), 2);
+		auto saveEffect = SaveToFile("Test.wav", getConfig("sampleRate"));
 		auto saveWindow = std::make_shared<Window>(saveEffect.getFrame());
 		saveWindow->setHeader(getConfig("defaultHeaderSize"), "Record");
 		saveWindow->setVisibility(false);
@@ -132,6 +211,9 @@ namespace
 		configWindow->setVisibility(false);
 		gui->addChildAutoPos(configWindow);
 
+		auto routingWindow = createMidiRouting();
+		gui->addChildAutoPos(routingWindow);
+
 		menu->addChildAutoPos(MenuOption::createMenu(
 			getConfig("defaultHeaderSize"), 15, {
 				"View", pos_t::Down, {{
@@ -140,20 +222,24 @@ namespace
 						"Delay", delayWindow},
 					}},
 					{"Input settings", configWindow},
+					{"MIDI routing", routingWindow},
 					{"Record", saveWindow},
 				}
 			}
 		));
 
-		afterEffects.push_back(delay);
-		afterEffects.push_back(volume);
-		afterEffects.push_back(debugEffect);
-		afterEffects.push_back(saveEffect);
+		// The debug view and the recorder only listen, so they run side by side after the volume
+		masterEffects->appendEffect("Delay", delay);
+		const auto volumeNode = masterEffects->appendEffect("Volume", volume);
+		masterEffects->addEffect("Debug", debugEffect, { volumeNode });
+		masterEffects->addEffect("Record", saveEffect, { volumeNode });
 	}
 }
 
-void setupGui(std::shared_ptr<Window> mainWindow, sf::RenderWindow& renderWindow)
+void setupGui(std::shared_ptr<Window> mainWindow, sf::RenderWindow& renderWindow, std::unique_ptr<AudioBackend> backend)
 {
+	connectInstruments(getSynth(std::move(backend)));
+
 	renderWindow.setKeyRepeatEnabled(false);
 	renderWindow.setVerticalSyncEnabled(true);
 	auto setup = std::make_shared<EmptyGuiElement>([&](const sf::Event& event) {
@@ -206,5 +292,41 @@ void setupGui(std::shared_ptr<Window> mainWindow, sf::RenderWindow& renderWindow
 	}, getInstruments());
 
 	addAfterEffects(mainWindow);
+	RenderPool::instance().setThreadCount(getConfig("renderThreads"));
 	getSynth().play();
 }
+
+MidiQueue& getMidiQueue()
+{
+	return getSynth().getMidiQueue();
+}
+
+void playScore(const Score& score)
+{
+	getSynth().playScore(score);
+}
+
+std::string runHeadless(std::unique_ptr<AudioBackend> backend, const Score& score)
+{
+	auto& synth = getSynth(std::move(backend));
+	connectInstruments(synth);
+	// No window is opened, which would choose the instruments
+	getMidiRouter().setEnabled(0, true);
+	RenderPool::instance().setThreadCount(getConfig("renderThreads"));
+	if (!score.empty()) {
+		synth.playScore(score);
+	}
+	synth.play();
+	while (!synth.getBackend().isDone()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	synth.stop();
+	return synth.getBackend().getError();
+}
+
+void logStreamStats()
+{
+	const std::string report = getSynth().getStats().report();
+	std::cout << report << "\n";
+	log(report);
+}
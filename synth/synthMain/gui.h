@@ -2,9 +2,22 @@
 #define GUI_H_INCLUDED
 
 #include <SFML/Graphics.hpp>
+#include "../core/MidiMessage.h"
+#include "../core/AudioBackend.h"
+#include "../core/Score.h"
 
 class Window;
 
-void setupGui(std::shared_ptr<Window> gui, sf::RenderWindow& window);
+// Plays through PortAudio without a backend
+void setupGui(std::shared_ptr<Window> gui, sf::RenderWindow& window, std::unique_ptr<AudioBackend> backend = {});
+// MIDI input for the audio thread, routed to the instruments with sample accuracy
+MidiQueue& getMidiQueue();
+// Plays the score through the MIDI routing, like a MIDI keyboard, once per run
+void playScore(const Score& score);
+// Plays without windows, for the null and freewheel backends. The score plays on the first
+// instrument until the backend is done. Returns why the backend stopped early, empty if it did not.
+std::string runHeadless(std::unique_ptr<AudioBackend> backend, const Score& score);
+// Writes the timing of the audio callback to the log and stdout
+void logStreamStats();
 
 #endif // GUI_H_INCLUDED
\ No newline at end of file
@@ -4,21 +4,116 @@
 
 #include "gui.h"
 
+#include <iostream>
+#include <algorithm>
+#include <optional>
+#include <cmath>
+
+namespace
+{
+	// After the last event of a score, for the releases of its notes
+	constexpr double scoreTail = 1.;
+
+	struct Options
+	{
+		std::unique_ptr<AudioBackend> backend;
+		Score score;
+		bool headless{ false };
+	};
+
+	// Synth [--backend portaudio|null|freewheel] [--out <file.wav>] [--play <score>] [--length <seconds>]
+	// The null and freewheel backends run without sound hardware and without a window, freewheel
+	// renders into the file. They stop after --length seconds, or after the score.
+	// The score is an event script, a .mid file or a stress pattern, which lasts --length seconds.
+	Options parseOptions(int argc, char** argv)
+	{
+		std::string name = "portaudio", path = "Freewheel.wav", scorePath;
+		std::optional<double> length;
+		for (int i = 1; i < argc; i += 2) {
+			const std::string arg = argv[i];
+			if (i + 1 == argc) {
+				throw std::invalid_argument(arg + " needs a value.");
+			}
+			if (arg == "--backend") name = argv[i + 1];
+			else if (arg == "--out") path = argv[i + 1];
+			else if (arg == "--play") scorePath = argv[i + 1];
+			else if (arg == "--length") length = std::stod(argv[i + 1]);
+			else throw std::invalid_argument("Unknown option " + arg + ".");
+		}
+		if (name == "freewheel" && !length && scorePath.empty()) {
+			throw std::invalid_argument("The freewheel backend needs --length or --play.");
+		}
+		if (length && !(*length > 0.)) {
+			throw std::invalid_argument("The length has to be positive.");
+		}
+
+		Options options;
+		const auto& patterns = stressPatternNames();
+		if (std::find(patterns.begin(), patterns.end(), scorePath) != patterns.end()) {
+			options.score = stressPattern(scorePath, length.value_or(10.));
+		}
+		else if (!scorePath.empty()) {
+			options.score = readScore(scorePath);
+		}
+
+		options.headless = name == "null" || name == "freewheel";
+		const unsigned sampleRate = getConfig("sampleRate");
+		uint64_t maxFrames = UINT64_MAX;
+		if (length) {
+			maxFrames = uint64_t(std::llround(*length * sampleRate));
+		}
+		else if (options.headless && !options.score.empty()) {
+			const auto last = std::max_element(options.score.begin(), options.score.end(),
+				[](const NoteEvent& a, const NoteEvent& b) { return a.time < b.time; });
+			maxFrames = uint64_t(std::llround((last->time + scoreTail) * sampleRate));
+		}
+		options.backend = AudioBackend::create(name, sampleRate, getConfig("bufferSize"), path, maxFrames);
+		return options;
+	}
+}
+
 int synthMain(int argc, char** argv)
 {
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::invalid_argument& e) {
+		std::cerr << e.what() << "\n"
+			<< "Usage: Synth [--backend portaudio|null|freewheel] [--out <file.wav>] [--play <score>] [--length <seconds>]\n"
+			<< "  score: event script, .mid file, or the stress pattern chords, arpeggios or glissandi\n"
+			<< "  null and freewheel run without a window until the length or the end of the score,\n"
+			<< "  freewheel needs one of them\n";
+		return 1;
+	}
+
+	if (options.headless) {
+		const std::string error = runHeadless(std::move(options.backend), options.score);
+		logStreamStats();
+		if (!error.empty()) {
+			std::cerr << error << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
 	const unsigned wWidth{ 1100 }, wHeight{ 600 }, menuHeight{ getConfig("defaultHeaderSize") };
 	sf::RenderWindow window(sf::VideoMode(wWidth, wHeight), "Synth");
 	std::shared_ptr mainWindow = std::make_shared<Window>(0, menuHeight, sf::Color::Black);
 	mainWindow->setSize({ SynthFloat(wWidth), SynthFloat(wHeight - menuHeight) });
 	mainWindow->setMenuBar(menuHeight);
 
-	setupGui(mainWindow, window);
+	setupGui(mainWindow, window, std::move(options.backend));
+	if (!options.score.empty()) {
+		playScore(options.score);
+	}
 
-	MidiContext midiContext;
+	MidiContext midiContext({}, &getMidiQueue());
 	sf::Event event;
 	MidiEvent midiEvent;
 	while (window.isOpen()) {
 
+		// Only for the debug view, the MidiRouter already played the messages on the audio thread
 		while (midiContext.pollEvent(midiEvent)) {
 			mainWindow->forwardEvent(midiEvent);
 		}
@@ -31,5 +126,6 @@ int synthMain(int argc, char** argv)
 		window.display();
 	}
 
+	logStreamStats();
 	return 0;
 }
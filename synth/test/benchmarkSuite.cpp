@@ -0,0 +1,442 @@
+#include "benchmarkSuite.h"
+#include "../core/tones.h"
+#include "../core/dsp.h"
+#include "../core/PartialBank.h"
+#include "../core/RenderPool.h"
+#include "../core/SynthStream.h"
+#include "../core/Score.h"
+#include "../core/utility.h"
+#include "playback.h"
+
+#include <array>
+#include <limits>
+#include <iostream>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+
+// Benchmark suite for tracking the DSP cost between releases.
+// Everything runs on the calling thread unless --threads is given, no window or audio device is used,
+// and only the core is linked: the effects are measured by their signal processing, without the GUI.
+// The results are written as JSON: the cost of every benchmark in ns per sample (a stereo frame for
+// the stereo parts), the realtime factor it allows at 44.1 and 96 kHz, and the most voices
+// of every preset which render within a part of the buffer period.
+namespace
+{
+	struct Options
+	{
+		std::string outPath;       // stdout if empty
+		double seconds = 2.;       // of audio per benchmark
+		std::size_t blockSize = 256;
+		double budget = .5;        // part of the buffer period the voices may take
+		unsigned threads = 0;
+	};
+
+	struct Result
+	{
+		std::string name;
+		double nsPerSample;
+	};
+
+	struct VoiceLimit
+	{
+		std::string preset;
+		unsigned sampleRate, voices;
+	};
+
+	const unsigned baseRate = 44100;
+	const std::array<unsigned, 2> reportedRates{ 44100, 96000 };
+
+	// The best of a few runs, the others are disturbed by the rest of the system
+	template<class Render>
+	double nsPerSample(uint64_t samples, Render render)
+	{
+		double best = std::numeric_limits<double>::infinity();
+		for (int run = 0; run < 3; ++run) {
+			const auto begin = std::chrono::steady_clock::now();
+			render();
+			const auto end = std::chrono::steady_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::nano>(end - begin).count() / samples);
+		}
+		return best;
+	}
+
+	template<class Wave>
+	Result benchmarkWave(const std::string& name, Wave wave, uint64_t samples)
+	{
+		volatile double sink = 0.;
+		const double increment = 220. / baseRate;
+		return { name, nsPerSample(samples, [&]() {
+			double phase = 0., sum = 0.;
+			for (uint64_t i = 0; i < samples; ++i) {
+				sum += wave(phase);
+				phase += increment;
+				phase -= phase >= 1.;
+			}
+			sink = sum;
+		}) };
+	}
+
+	// Every segment is rendered: 0.3 s held, released, started again after 0.5 s
+	std::vector<Result> benchmarkEnvelope(const Options& options, uint64_t frames)
+	{
+		const uint64_t period = baseRate / 2, hold = baseRate * 3 / 10;
+		const ADSREnvelope prototype(.02, .05, .6, .1, std::numeric_limits<double>::infinity(), ADSREnvelope::Curve::Exponential);
+		std::vector<float> gains(options.blockSize);
+		volatile double sink = 0.;
+
+		std::vector<Result> results;
+		results.push_back({ "ADSREnvelope::nextGain", nsPerSample(frames, [&]() {
+			ADSREnvelope env = prototype;
+			double sum = 0.;
+			for (uint64_t i = 0; i < frames; ++i) {
+				if (i % period == 0) env.start(0.);
+				if (i % period == hold) env.stop(0.);
+				sum += env.nextGain();
+			}
+			sink = sum;
+		}) });
+		results.push_back({ "ADSREnvelope::renderBlock", nsPerSample(frames, [&]() {
+			ADSREnvelope env = prototype;
+			for (uint64_t i = 0; i < frames; ) {
+				// The blocks end at the events, as in DynamicToneSum
+				const uint64_t inPeriod = i % period;
+				if (inPeriod == 0) env.start(0.);
+				if (inPeriod == hold) env.stop(0.);
+				const uint64_t untilEvent = inPeriod < hold ? hold - inPeriod : period - inPeriod;
+				const std::size_t n = std::size_t(std::min<uint64_t>({ options.blockSize, untilEvent, frames - i }));
+				env.renderBlock(gains.data(), n);
+				i += n;
+			}
+			sink = gains[0];
+		}) });
+		return results;
+	}
+
+	std::vector<Result> benchmarkComposite(const Options& options, uint64_t frames)
+	{
+		std::vector<Result> results;
+		std::vector<float> block(options.blockSize);
+		volatile double sink = 0.;
+		for (const auto& preset : instrumentPresets()) {
+			auto tone = preset.timbre(220.);
+			results.push_back({ "Composite<WaveGenerator>::getSample " + preset.name, nsPerSample(frames, [&]() {
+				double sum = 0.;
+				for (uint64_t i = 0; i < frames; ++i)
+					sum += tone.getSample(timing::frameToTime(i));
+				sink = sum;
+			}) });
+			results.push_back({ "Composite<WaveGenerator>::renderBlock " + preset.name, nsPerSample(frames, [&]() {
+				for (uint64_t i = 0; i < frames; i += options.blockSize)
+					tone.renderBlock(block.data(), options.blockSize, i);
+				sink = block[0];
+			}) });
+		}
+		return results;
+	}
+
+	// Polyphonic instrument of the timbre of the given preset with the first keys held.
+	// The envelope sustains, so the voices sound during the whole measurement.
+	// With more voices than keys the notes are spread microtonally, a voice per key.
+	std::unique_ptr<DynamicToneSum> heldVoices(const InstrumentPreset& preset, unsigned voices)
+	{
+		auto notes = preset.notes();
+		if (notes.size() < voices) {
+			notes.clear();
+			for (unsigned key = 0; key < voices; ++key)
+				notes.push_back(Note(55. * std::pow(2., key / 192.)));
+		}
+		auto gen = std::make_unique<DynamicToneSum>(preset.timbre, ADSREnvelope(), notes, voices);
+		for (unsigned key = 0; key < voices; ++key)
+			gen->onKeyEvent(key, SynthKey::State::Pressed);
+		return gen;
+	}
+
+	std::vector<Result> benchmarkPolyphony(const Options& options, uint64_t frames)
+	{
+		std::vector<Result> results;
+		std::vector<float> block(2 * options.blockSize);
+		volatile double sink = 0.;
+		const auto& preset = findPreset("Synth 1");
+		for (unsigned voices : { 1u, 5u, 15u, 64u }) {
+			const std::string suffix = " " + preset.name + " x" + std::to_string(voices);
+			// The per sample path renders one frame blocks, it is measured on a shorter piece
+			const uint64_t perSampleFrames = frames / 10;
+			auto perSample = heldVoices(preset, voices);
+			results.push_back({ "DynamicToneSum::getSample" + suffix, nsPerSample(perSampleFrames, [&]() {
+				double sum = 0.;
+				for (uint64_t i = 0; i < perSampleFrames; ++i)
+					sum += perSample->getSample(timing::frameToTime(i));
+				sink = sum;
+			}) });
+			auto perBlock = heldVoices(preset, voices);
+			results.push_back({ "DynamicToneSum::renderStereoBlock" + suffix, nsPerSample(frames, [&]() {
+				for (uint64_t i = 0; i < frames; i += options.blockSize)
+					perBlock->renderStereoBlock(block.data(), options.blockSize, i);
+				sink = block[0];
+			}) });
+		}
+		return results;
+	}
+
+	Result benchmarkEffect(const std::string& name, const EffectGraph::process_t& effect, const Options& options, uint64_t frames)
+	{
+		std::vector<float> block(2 * options.blockSize);
+		volatile double sink = 0.;
+		return { name, nsPerSample(frames, [&]() {
+			double sum = 0.;
+			for (uint64_t i = 0; i < frames; i += options.blockSize) {
+				for (std::size_t j = 0; j < options.blockSize; ++j)
+					block[2 * j] = block[2 * j + 1] = float((((i + j) * 7919) % 2000) / 1000. - 1.);
+				effect(block.data(), options.blockSize, i);
+				sum += block[0];
+			}
+			sink = sum;
+		}) };
+	}
+
+	struct HeadlessInstrument
+	{
+		std::unique_ptr<DynamicToneSum> generator;
+		DynamicToneSum& getGenerator() { return *generator; }
+		Panning getPanning() const { return {}; }
+	};
+
+	// The instruments of the GUI with 5 held keys each, through the delay and the volume control.
+	// Through the stream, the blocks are pulled by the freewheel backend's thread, with the MIDI
+	// and timing bookkeeping of the audio callback, as on a machine without sound hardware.
+	Result benchmarkChain(const Options& options, uint64_t frames, bool throughStream)
+	{
+		auto make = [](const std::string& name) { return HeadlessInstrument{ heldVoices(findPreset(name), 5) }; };
+		HeadlessInstrument synth1 = make("Synth 1"), bass = make("Soft bass"), slow = make("Slow ADSR"), saw = make("Sawtooth");
+		DelayLine delay(baseRate, 1., .6);
+		VolumeRamp volume;
+		auto effects = std::make_shared<EffectGraph>();
+		effects->append("Delay", [&delay](float* block, std::size_t frames, uint64_t) { delay.process(block, frames); });
+		effects->append("Volume", [&volume](float* block, std::size_t frames, uint64_t startFrame) {
+			volume.process(block, frames, startFrame);
+		});
+		SumGenerator chain(effects, std::forward_as_tuple(synth1, bass, slow, saw));
+
+		if (throughStream) {
+			return { "SynthStream freewheel 4 instruments x5, delay, volume", nsPerSample(frames, [&]() {
+				auto backend = std::make_unique<FreewheelBackend>(baseRate, unsigned(options.blockSize), "", frames);
+				auto& freewheel = *backend;
+				SynthStream stream(
+					baseRate,
+					unsigned(options.blockSize),
+					[&chain](float* out, std::size_t n, uint64_t startFrame) { chain.renderStereoBlock(out, n, startFrame); },
+					[](const float*, std::size_t, uint64_t) {},
+					{},
+					std::move(backend)
+				);
+				playUntilDone(stream, freewheel);
+			}) };
+		}
+
+		std::vector<float> block(2 * options.blockSize);
+		volatile double sink = 0.;
+		return { "SumGenerator 4 instruments x5, delay, volume", nsPerSample(frames, [&]() {
+			for (uint64_t i = 0; i < frames; i += options.blockSize)
+				chain.renderStereoBlock(block.data(), options.blockSize, i);
+			sink = block[0];
+		}) };
+	}
+
+	// The stress patterns played by a score player through the stream, as fast as the freewheel backend pulls
+	// the blocks, the notes starting and ending at their exact frames
+	std::vector<Result> benchmarkStressPatterns(const Options& options, uint64_t frames)
+	{
+		const unsigned firstNote = 48, voices = 64;
+		const auto& preset = findPreset("Synth 1");
+		const unsigned lastNote = firstNote + unsigned(preset.notes().size()) - 1;
+		std::vector<Result> results;
+		for (const auto& name : stressPatternNames()) {
+			const Score score = stressPattern(name, double(frames) / baseRate, firstNote, lastNote);
+			results.push_back({ "SynthStream freewheel " + name + " " + preset.name + " x" + std::to_string(voices), nsPerSample(frames, [&]() {
+				DynamicToneSum generator{ preset.timbre, preset.envelope, preset.notes(), voices };
+				auto backend = std::make_unique<FreewheelBackend>(baseRate, unsigned(options.blockSize), "", frames);
+				auto& freewheel = *backend;
+				SynthStream stream(
+					baseRate,
+					unsigned(options.blockSize),
+					[&generator](float* out, std::size_t n, uint64_t startFrame) { generator.renderStereoBlock(out, n, startFrame); },
+					[](const float*, std::size_t, uint64_t) {},
+					[&generator, firstNote](const MidiMessage& message, uint64_t frame) {
+						if (message.isNoteOn() || message.isNoteOff())
+							generator.playKeyEvent(message.key() - firstNote, message.isNoteOn() ? SynthKey::State::Pressed : SynthKey::State::Released, frame);
+					},
+					std::move(backend)
+				);
+				stream.playScore(score);
+				playUntilDone(stream, freewheel);
+			}) });
+		}
+		return results;
+	}
+
+	// Mean time of a block in ms
+	double blockTime(const InstrumentPreset& preset, unsigned voices, const Options& options)
+	{
+		const std::size_t blocks = 50;
+		auto gen = heldVoices(preset, voices);
+		std::vector<float> block(2 * options.blockSize);
+		const auto begin = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < blocks; ++i)
+			gen->renderStereoBlock(block.data(), options.blockSize, i * options.blockSize);
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(end - begin).count() / blocks;
+	}
+
+	unsigned maxVoices(const InstrumentPreset& preset, unsigned sampleRate, const Options& options)
+	{
+		timing::setSampleRate(sampleRate);
+		const double budget = options.budget * options.blockSize * 1000. / sampleRate; // ms
+		// Doubling until the budget is exceeded, then bisecting
+		unsigned fits = 0, exceeds = 8;
+		while (exceeds <= 4096 && blockTime(preset, exceeds, options) <= budget) {
+			fits = exceeds;
+			exceeds *= 2;
+		}
+		while (exceeds - fits > 4) {
+			const unsigned voices = (fits + exceeds) / 2;
+			(blockTime(preset, voices, options) <= budget ? fits : exceeds) = voices;
+		}
+		return fits;
+	}
+
+	std::string quoted(const std::string& str)
+	{
+		std::string ret = "\"";
+		for (char c : str) {
+			if (c == '"' || c == '\\') ret += '\\';
+			ret += c;
+		}
+		return ret + "\"";
+	}
+
+	std::string toJson(const Options& options, const std::vector<Result>& results, const std::vector<VoiceLimit>& limits)
+	{
+		std::ostringstream json;
+		json << std::setprecision(6)
+			<< "{\n"
+			<< "  \"instructionSet\": " << quoted(PartialBank::instructionSet()) << ",\n"
+			<< "  \"blockSize\": " << options.blockSize << ",\n"
+			<< "  \"threads\": " << options.threads << ",\n"
+			<< "  \"results\": [\n";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const auto& result = results[i];
+			json << "    { \"name\": " << quoted(result.name) << ", \"nsPerSample\": " << result.nsPerSample;
+			for (unsigned rate : reportedRates)
+				json << ", \"realtimeFactor" << rate << "\": " << 1e9 / (result.nsPerSample * rate);
+			json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		json << "  ],\n"
+			<< "  \"maxVoices\": {\n"
+			<< "    \"budget\": " << options.budget << ",\n"
+			<< "    \"presets\": [\n";
+		for (std::size_t i = 0; i < limits.size(); ++i) {
+			const auto& limit = limits[i];
+			json << "      { \"preset\": " << quoted(limit.preset) << ", \"sampleRate\": " << limit.sampleRate
+				<< ", \"voices\": " << limit.voices << " }" << (i + 1 < limits.size() ? "," : "") << "\n";
+		}
+		json << "    ]\n"
+			<< "  }\n"
+			<< "}\n";
+		return json.str();
+	}
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options options;
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg = argv[i];
+			if (arg.rfind("--", 0) != 0) {
+				options.outPath = arg;
+				continue;
+			}
+			if (i + 1 == argc) {
+				throw std::invalid_argument(arg + " needs a value.");
+			}
+			const std::string value = argv[++i];
+			if (arg == "--seconds") options.seconds = std::stod(value);
+			else if (arg == "--block") options.blockSize = std::stoul(value);
+			else if (arg == "--budget") options.budget = std::stod(value);
+			else if (arg == "--threads") options.threads = std::stoul(value);
+			else throw std::invalid_argument("Unknown option " + arg + ".");
+		}
+		if (options.seconds <= 0. || !options.blockSize || options.budget <= 0.) {
+			throw std::invalid_argument("The length, the block size and the budget have to be positive.");
+		}
+		return options;
+	}
+}
+
+int benchmarkMain(int argc, char** argv)
+{
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n"
+			<< "Usage: Synth [results.json] [--seconds <of audio per benchmark>] [--block <frames>]"
+			<< " [--budget <part of the buffer period>] [--threads <count>]\n";
+		return 1;
+	}
+	RenderPool::instance().setThreadCount(options.threads);
+	timing::setSampleRate(baseRate);
+	const uint64_t frames = uint64_t(options.seconds * baseRate);
+
+	std::vector<Result> results;
+	auto add = [&results](std::vector<Result> more) {
+		for (auto& result : more) {
+			std::cerr << "  " << result.name << ": " << result.nsPerSample << " ns/sample\n";
+			results.push_back(std::move(result));
+		}
+	};
+	std::cerr << "Running the benchmark suite ...\n";
+	add({
+		benchmarkWave("waves::sine", [](double phase) { return waves::sine(phase); }, frames),
+		benchmarkWave("waves::square", [](double phase) { return waves::square(phase); }, frames),
+		benchmarkWave("waves::triangle", [](double phase) { return waves::triangle(phase); }, frames),
+		benchmarkWave("waves::sawtooth", [](double phase) { return waves::sawtooth(phase); }, frames),
+	});
+	add(benchmarkEnvelope(options, frames));
+	add(benchmarkComposite(options, frames));
+	add(benchmarkPolyphony(options, frames));
+	add({
+		benchmarkEffect("DelayEffect", [delay = std::make_shared<DelayLine>(baseRate, 1., .6)](float* block, std::size_t frames, uint64_t) {
+			delay->process(block, frames);
+		}, options, frames),
+		benchmarkEffect("VolumeControl", [volume = std::make_shared<VolumeRamp>()](float* block, std::size_t frames, uint64_t startFrame) {
+			volume->process(block, frames, startFrame);
+		}, options, frames),
+		benchmarkChain(options, frames, false),
+		benchmarkChain(options, frames, true),
+	});
+	add(benchmarkStressPatterns(options, frames));
+
+	std::vector<VoiceLimit> limits;
+	for (const auto& preset : instrumentPresets()) {
+		for (unsigned rate : reportedRates) {
+			limits.push_back({ preset.name, rate, maxVoices(preset, rate, options) });
+			std::cerr << "  " << preset.name << " at " << rate << " Hz: " << limits.back().voices << " voices\n";
+		}
+	}
+	RenderPool::instance().setThreadCount(0);
+
+	const std::string json = toJson(options, results, limits);
+	if (options.outPath.empty()) {
+		std::cout << json;
+	}
+	else {
+		std::ofstream file(options.outPath);
+		if (!(file << json)) {
+			throw std::runtime_error("Unable to write " + options.outPath + ".");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef SYNTH_BENCHMARKSUITE_DEFINED
+#define SYNTH_BENCHMARKSUITE_DEFINED
+
+// Writes the results of the benchmark suite as JSON, to the file given or to stdout
+int benchmarkMain(int argc, char** argv);
+
+#endif
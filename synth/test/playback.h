@@ -0,0 +1,17 @@
+#ifndef SYNTH_PLAYBACK_DEFINED
+#define SYNTH_PLAYBACK_DEFINED
+
+#include "../core/SynthStream.h"
+
+#include <thread>
+#include <chrono>
+
+// Plays the stream until its freewheel or null backend has rendered all its frames
+inline void playUntilDone(SynthStream& stream, const AudioBackend& backend)
+{
+	stream.play();
+	while (!backend.isDone())
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+#endif
@@ -2,9 +2,62 @@
 #define SYNTH_TEST_DEFINED
 
 #include "../core/Instrument.h"
+#include "../core/MidiMessage.h"
+
+#include <string>
+#include <filesystem>
+#include <system_error>
+
+// A file of a test in the temp directory, removed once the test is done with it
+class TempFile
+{
+public:
+	explicit TempFile(const std::string& name)
+		:path((std::filesystem::temp_directory_path() / name).string())
+	{}
+	~TempFile()
+	{
+		std::error_code error;
+		std::filesystem::remove(path, error);
+	}
+	TempFile(const TempFile&) = delete;
+	TempFile& operator=(const TempFile&) = delete;
+
+	const std::string path;
+};
+
+// A 3 byte channel message
+inline MidiMessage midiMessage(uint8_t status, uint8_t key, uint8_t velocity)
+{
+	MidiMessage message;
+	message.size = 3;
+	message.bytes = { status, key, velocity };
+	return message;
+}
 
 int testMain(int argc, char** argv);
 void testGui();
 void testGenerator();
+void testOscillatorDrift();
+void testEnvelope();
+void testVoiceStealing();
+void testKeyEventQueue();
+void testMidiFile();
+void testStreamStats();
+void testEffectGraph();
+void testDelayEffect();
+void testWavWriter();
+void testAudioFileReader();
+void testSampler();
+void testTripleBuffer();
+void testMidiTiming();
+void testMidiRouter();
+void testAudioBackends();
+void testEventScheduler();
+void testScorePlayer();
+void testInputBlock();
+void benchmarkWaveforms();
+void benchmarkSliderStorm();
+void benchmarkPolyphony();
 
 #endif
\ No newline at end of file
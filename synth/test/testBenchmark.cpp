@@ -0,0 +1,284 @@
+#include "test.h"
+#include "../core/tones.h"
+#include "../core/PartialBank.h"
+#include "../core/RenderPool.h"
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <set>
+#include <atomic>
+
+namespace
+{
+	using waves::Custom;
+
+	// The presets as they were before the waveforms got dispatched per block:
+	// every partial calls its waveform through a std::function
+	const TimbreModel& Sines1Functions()
+	{
+		static const TimbreModel ret({
+			{ 1., 1.,  Custom{ waves::sine } },
+			{ 3., 0.3, Custom{ waves::sine } },
+			{ 5., 0.3, Custom{ waves::sine } },
+			{ 7., 0.3, Custom{ waves::sine } },
+			{ 9., 0.3, Custom{ waves::sine } },
+		});
+		return ret;
+	}
+	const TimbreModel& SawFunctions()
+	{
+		static const TimbreModel ret({ {1., 1., Custom{ waves::sawtooth } } });
+		return ret;
+	}
+	const TimbreModel& SinesTrianglesFunctions()
+	{
+		static const TimbreModel ret({
+			{ 1., 1.,  Custom{ waves::sine } },
+			{ 3., 0.4, Custom{ waves::triangle } },
+			{ 4., 0.1, Custom{ waves::sine } },
+		});
+		return ret;
+	}
+
+	template<class Render>
+	double nsPerSample(uint64_t frames, Render render)
+	{
+		const auto begin = std::chrono::steady_clock::now();
+		render();
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / frames;
+	}
+
+	void benchmarkTimbre(const std::string& name, const TimbreModel& before, const TimbreModel& after)
+	{
+		const unsigned sampleRate = 44100;
+		const uint64_t frames = sampleRate * 10;
+		const std::size_t blockSize = 64;
+		const double freq = 220.;
+		timing::setSampleRate(sampleRate);
+		std::vector<float> block(blockSize);
+
+		auto perSampleVoice = before(freq);
+		volatile double sink = 0.;
+		const double perSample = nsPerSample(frames, [&]() {
+			for (uint64_t frame = 0; frame < frames; ++frame)
+				sink = perSampleVoice.getSample(timing::frameToTime(frame));
+		});
+
+		auto functionVoice = before(freq);
+		const double function = nsPerSample(frames, [&]() {
+			for (uint64_t frame = 0; frame < frames; frame += blockSize)
+				functionVoice.renderBlock(block.data(), blockSize, frame);
+		});
+
+		auto dispatchedVoice = after(freq);
+		const double dispatched = nsPerSample(frames, [&]() {
+			for (uint64_t frame = 0; frame < frames; frame += blockSize)
+				dispatchedVoice.renderBlock(block.data(), blockSize, frame);
+		});
+
+		std::cout << "  " << name << ":\n"
+			<< "    std::function, per sample: " << perSample << " ns/sample\n"
+			<< "    std::function, per block:  " << function << " ns/sample\n"
+			<< "    dispatched, per block:     " << dispatched << " ns/sample\n";
+	}
+
+	struct StormResult
+	{
+		unsigned blocks = 0, contended = 0, xruns = 0;
+		double worstBlock = 0.; // ms
+	};
+
+	// DynamicToneSum as it was before the lock-free handover: a tone per key, rendered under
+	// a mutex which the GUI thread holds while it changes that component of every key
+	class LockedToneSum
+	{
+	public:
+		LockedToneSum(const TimbreModel& timbreModel, const std::vector<Note>& notes, unsigned maxTones)
+			:tones(generateTones<WaveGenerator>(timbreModel, notes)),
+			maxTones(maxTones)
+		{}
+
+		void onKeyEvent(unsigned key, SynthKey::State keyState)
+		{
+			std::lock_guard lock(mtx);
+			if (keyState == SynthKey::State::Pressed) {
+				if (pressedKeys.size() < maxTones && !pressedKeys.count(key)) {
+					pressedKeys.insert(key);
+					tones.at(key).start(lastTime);
+				}
+			}
+			else {
+				tones.at(key).stop(lastTime);
+			}
+		}
+
+		void setComponentIntensity(unsigned component, double intensity)
+		{
+			std::lock_guard lock(mtx);
+			for (auto& tone : tones)
+				tone[component].modifyIntensity(lastTime, intensity);
+		}
+
+		void renderStereoBlock(float* out, std::size_t frames, uint64_t startFrame)
+		{
+			std::unique_lock lock(mtx, std::try_to_lock);
+			if (!lock) {
+				++contended;
+				lock.lock();
+			}
+			lastTime = timing::frameToTime(startFrame + frames - 1);
+			if (toneBuffer.size() < frames) toneBuffer.resize(frames);
+			std::fill(out, out + 2 * frames, 0.f);
+			const float norm = 1.f / maxTones;
+			for (auto i = pressedKeys.begin(); i != pressedKeys.end();) {
+				if (tones[*i].renderBlock(toneBuffer.data(), frames, startFrame)) {
+					for (std::size_t j = 0; j < frames; ++j) {
+						out[2 * j] += toneBuffer[j] * norm;
+						out[2 * j + 1] += toneBuffer[j] * norm;
+					}
+					++i;
+				}
+				else {
+					i = pressedKeys.erase(i);
+				}
+			}
+		}
+
+		unsigned contended{ 0 }; // blocks which had to wait for the GUI thread
+
+	private:
+		std::vector<Dynamic<Composite<WaveGenerator>>> tones;
+		std::set<unsigned> pressedKeys;
+		const unsigned maxTones;
+		double lastTime{ 0. };
+		std::vector<float> toneBuffer;
+		std::mutex mtx;
+	};
+
+	// Renders blocks in real time on an audio thread, while a GUI thread moves every
+	// component slider of the tone sum as fast as it can
+	template<class ToneSum>
+	StormResult sliderStorm(ToneSum& gen, unsigned componentCount)
+	{
+		const unsigned sampleRate = 44100;
+		const std::size_t blockSize = 256;
+		const auto period = std::chrono::duration<double>(double(blockSize) / sampleRate);
+		const auto duration = std::chrono::seconds(2);
+		timing::setSampleRate(sampleRate);
+
+		for (unsigned key = 20; key < 30; ++key)
+			gen.onKeyEvent(key, SynthKey::State::Pressed);
+
+		std::atomic<bool> running{ true };
+		std::thread gui([&]() {
+			for (unsigned step = 0; running; ++step) {
+				const double value = (step % 100) / 100.;
+				for (unsigned i = 0; i < componentCount; ++i)
+					gen.setComponentIntensity(i, value);
+				std::this_thread::yield();
+			}
+		});
+
+		StormResult result;
+		std::vector<float> block(2 * blockSize);
+		const auto begin = std::chrono::steady_clock::now();
+		auto deadline = begin;
+		for (uint64_t frame = 0; deadline - begin < duration; frame += blockSize) {
+			deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+			const auto start = std::chrono::steady_clock::now();
+			gen.renderStereoBlock(block.data(), blockSize, frame);
+			const auto end = std::chrono::steady_clock::now();
+			result.worstBlock = std::max(result.worstBlock, std::chrono::duration<double, std::milli>(end - start).count());
+			if (end > deadline) ++result.xruns;
+			++result.blocks;
+			std::this_thread::sleep_until(deadline);
+		}
+		running = false;
+		gui.join();
+		return result;
+	}
+
+	// Renders blocks of the given number of voices, returns the output and the mean block time in ms
+	std::pair<std::vector<float>, double> renderVoices(unsigned voices, std::size_t blocks)
+	{
+		const std::size_t blockSize = 256;
+		// Every voice needs its own key, so the keyboard has 192 keys per octave from 55 Hz
+		std::vector<Note> notes;
+		for (unsigned key = 0; key < voices; ++key)
+			notes.push_back(Note(55. * std::pow(2., key / 192.)));
+		DynamicToneSum gen(SinesTriangles(), ADSREnvelope(), notes, voices);
+		for (unsigned key = 0; key < voices; ++key)
+			gen.onKeyEvent(key, SynthKey::State::Pressed);
+
+		std::vector<float> output(2 * blockSize * blocks);
+		const auto begin = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < blocks; ++i)
+			gen.renderStereoBlock(output.data() + 2 * blockSize * i, blockSize, i * blockSize);
+		const auto end = std::chrono::steady_clock::now();
+		return { output, std::chrono::duration<double, std::milli>(end - begin).count() / blocks };
+	}
+}
+
+void benchmarkWaveforms()
+{
+	std::cout << "Waveform benchmark (one voice at 220 Hz, 44.1 kHz, "
+		<< PartialBank::instructionSet() << ")\n";
+	benchmarkTimbre("Sines1", Sines1Functions(), Sines1());
+	benchmarkTimbre("Saw", SawFunctions(), Saw());
+	benchmarkTimbre("SinesTriangles", SinesTrianglesFunctions(), SinesTriangles());
+}
+
+void benchmarkSliderStorm()
+{
+	std::cout << "Slider storm (10 voices, 256 frame blocks, every component slider moved continuously)\n";
+	const auto& timbre = Sines1();
+	const auto notes = generateNotes(2, 6);
+	const auto print = [](const char* name, const StormResult& result) {
+		std::cout << "  " << name
+			<< " blocks " << result.blocks
+			<< ", contended " << result.contended
+			<< ", xruns " << result.xruns
+			<< ", worst block " << result.worstBlock << " ms\n";
+	};
+
+	LockedToneSum locked(timbre, notes, 10);
+	StormResult result = sliderStorm(locked, timbre.components.size());
+	result.contended = locked.contended;
+	print("mutex:    ", result);
+
+	DynamicToneSum lockFree(timbre, ADSREnvelope(), notes, 10);
+	print("lock-free:", sliderStorm(lockFree, timbre.components.size()));
+}
+
+void benchmarkPolyphony()
+{
+	// The most voices which render in half of the block period, for every thread count
+	const unsigned sampleRate = 96000;
+	const double budget = .5 * 256 * 1000. / sampleRate; // ms
+	const unsigned maxThreads = std::max(3u, std::thread::hardware_concurrency());
+	timing::setSampleRate(sampleRate);
+
+	std::cout << "Polyphony benchmark (SinesTriangles, 96 kHz, 256 frame blocks, budget " << budget << " ms)\n";
+	auto& pool = RenderPool::instance();
+	pool.setThreadCount(0);
+	const auto reference = renderVoices(32, 100).first;
+	for (unsigned threads = 0; threads <= maxThreads; ++threads) {
+		pool.setThreadCount(threads);
+		const bool identical = renderVoices(32, 100).first == reference;
+		// Doubling until the budget is exceeded, then bisecting
+		unsigned fits = 0, exceeds = 8;
+		while (exceeds <= 4096 && renderVoices(exceeds, 50).second <= budget) {
+			fits = exceeds;
+			exceeds *= 2;
+		}
+		while (exceeds - fits > 4) {
+			const unsigned voices = (fits + exceeds) / 2;
+			(renderVoices(voices, 50).second <= budget ? fits : exceeds) = voices;
+		}
+		std::cout << "  " << threads << " worker threads: " << fits << " voices"
+			<< ", output " << (identical ? "bit-identical" : "DIFFERENT") << "\n";
+	}
+	pool.setThreadCount(0);
+}
@@ -1,6 +1,20 @@
 #include <AudioFile.h>
+#include <AudioFileReader.h>
 
 #include "test.h"
+#include "../core/Score.h"
+#include "../core/StreamStats.h"
+#include "../core/WavWriter.h"
+#include "../core/Sampler.h"
+#include "../core/TripleBuffer.h"
+#include "../core/MidiMessage.h"
+#include "../core/MidiRouter.h"
+#include "../core/SynthStream.h"
+#include "../core/Instrument.h"
+#include "playback.h"
+
+#include <fstream>
+#include <thread>
 
 template<class Instrument_t, class Arr_t>
 void test(
@@ -17,21 +31,754 @@ void test(
 	// Record 
 	auto& gen = inst.getGenerator();
 
-	auto save = SaveToFile("Test"s + std::to_string(testId), sampleRate, 2);
+	auto save = SaveToFile("Test"s + std::to_string(testId), sampleRate);
 
-	gen.addAfterCallback(save);
-	for (auto key : keys) gen[key].start(0.);
+	gen.getInserts().appendEffect("Record", save);
+	for (auto key : keys) gen.onKeyEvent(key, SynthKey::State::Pressed);
 	save.start();
-	double dt = 1. / double(sampleRate);
-	double t = 0.;
-	for (unsigned i = 0; i < sampleRate * seconds; ++i) {
-		gen.getSample(t);
-		t += dt;
+	timing::setSampleRate(sampleRate);
+	const std::size_t blockSize = 64;
+	std::vector<float> block(2 * blockSize);
+	for (uint64_t frame = 0; frame < sampleRate * seconds; frame += blockSize) {
+		gen.renderStereoBlock(block.data(), blockSize, frame, inst.getPanning());
 	}
 	save.stop();
 	std::cout << "Test " << testId << " ended.\n";
 }
 
+void testOscillatorDrift()
+{
+	// 24 hours of a 440 Hz sawtooth at 44.1 kHz. The sawtooth is linear in the phase,
+	// so the rendered sample gives the oscillator phase back, which is compared
+	// to the exact phase calculated with integers once every simulated hour
+	// (a few frames later, so that the exact phase is not a trivial 0).
+	const uint64_t sampleRate = 44100, freq = 440, hours = 24;
+	const uint64_t framesPerHour = sampleRate * 3600;
+	const std::size_t blockSize = 4096;
+
+	std::cout << "Running oscillator drift test ...\n";
+	timing::setSampleRate(sampleRate);
+	WaveGenerator osc(double(freq), 1., waves::Shape::Sawtooth);
+	std::vector<float> block(blockSize);
+	double maxError = 0.;
+
+	uint64_t frame = 0;
+	for (uint64_t hour = 1; hour <= hours; ++hour) {
+		const uint64_t end = hour * framesPerHour + 50;
+		while (frame + blockSize < end) {
+			osc.renderBlock(block.data(), blockSize, frame);
+			frame += blockSize;
+		}
+		const std::size_t rest = std::size_t(end - frame) + 1;
+		osc.renderBlock(block.data(), rest, frame);
+		frame += rest;
+
+		const double rendered = (1. - block[rest - 1]) / 2.;
+		const double exact = double((end * freq) % sampleRate) / sampleRate;
+		double error = std::abs(rendered - exact);
+		error = std::min(error, 1. - error); // the phase wraps around
+		maxError = std::max(maxError, error);
+		std::cout << "  hour " << hour << ": phase error " << error << " cycles\n";
+	}
+
+	const double tolerance = 1e-5;
+	std::cout << "Oscillator drift test " << (maxError < tolerance ? "passed" : "FAILED") 
+		<< " (max error: " << maxError << " cycles)\n";
+}
+
+void testEnvelope()
+{
+	// The segments have to end exactly on their levels, whatever the block size is
+	const unsigned sampleRate = 44100;
+	const std::size_t attack = 441, decay = 882, sustain = 2000, release = 4410;
+	const double sustainLevel = .5;
+	timing::setSampleRate(sampleRate);
+
+	std::cout << "Running envelope test ...\n";
+	bool passed = true;
+	for (auto curve : { ADSREnvelope::Curve::Linear, ADSREnvelope::Curve::Exponential }) {
+		std::vector<float> perFrame(attack + decay + sustain + release + 1), perBlock(perFrame.size() + 64);
+		ADSREnvelope a(.01, .02, sustainLevel, .1, std::numeric_limits<double>::infinity(), curve), b = a;
+		a.start(0.);
+		b.start(0.);
+		for (std::size_t i = 0; i < perFrame.size(); ++i) {
+			if (i == attack + decay + sustain) a.stop(0.);
+			perFrame[i] = float(a.nextGain());
+		}
+		b.renderBlock(perBlock.data(), attack + decay + sustain);
+		b.stop(0.);
+		for (std::size_t i = attack + decay + sustain; i < perFrame.size(); i += 64)
+			b.renderBlock(perBlock.data() + i, 64);
+
+		passed = passed &&
+			perFrame[attack] == 1.f &&
+			perFrame[attack + decay] == float(sustainLevel) &&
+			perFrame[attack + decay + sustain] == float(sustainLevel) &&
+			perFrame.back() == 0.f && !a.isNonZero() &&
+			std::equal(perFrame.begin(), perFrame.end(), perBlock.begin());
+	}
+	std::cout << "Envelope test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testVoiceStealing()
+{
+	// Two voices, three keys. When only retriggering, the third key is ignored, so the output
+	// has to match an instrument which got the first two keys only. When the oldest voice is
+	// stolen, the first key is gone after the fade, so releasing it must not change the output.
+	const unsigned sampleRate = 44100;
+	const std::size_t blockSize = 64, blocks = 200;
+	const auto notes = generateNotes(2, 6);
+	const auto press = [](DynamicToneSum& gen, unsigned key) { gen.onKeyEvent(key, SynthKey::State::Pressed); };
+
+	std::cout << "Running voice stealing test ...\n";
+	timing::setSampleRate(sampleRate);
+
+	// The script runs on every generator: two keys, a third one at block 10, first key released at block 20
+	const auto maxDifference = [&](DynamicToneSum& a, DynamicToneSum& b, bool pressThird, bool releaseFirst) {
+		std::vector<float> blockA(2 * blockSize), blockB(2 * blockSize);
+		double ret = 0.;
+		press(a, 10); press(a, 20);
+		press(b, 10); press(b, 20);
+		for (std::size_t i = 0; i < blocks; ++i) {
+			if (i == 10) {
+				press(a, 30);
+				if (pressThird) press(b, 30);
+			}
+			if (i == 20 && releaseFirst) b.onKeyEvent(10, SynthKey::State::Released);
+			a.renderStereoBlock(blockA.data(), blockSize, i * blockSize);
+			b.renderStereoBlock(blockB.data(), blockSize, i * blockSize);
+			for (std::size_t j = 0; j < 2 * blockSize; ++j)
+				ret = std::max(ret, double(std::abs(blockA[j] - blockB[j])));
+		}
+		return ret;
+	};
+
+	DynamicToneSum retrigger(Sines1(), ADSREnvelope(), notes, 2), twoKeys(Sines1(), ADSREnvelope(), notes, 2);
+	retrigger.setVoiceStealing(VoiceStealing::Retrigger);
+	const double retriggerError = maxDifference(retrigger, twoKeys, false, false);
+
+	DynamicToneSum oldest(Sines1(), ADSREnvelope(), notes, 2), oldestReleased(Sines1(), ADSREnvelope(), notes, 2);
+	const double stealError = maxDifference(oldest, oldestReleased, true, true);
+
+	// A stolen voice sounds its new key from the frame its fade-out finished, in the same block,
+	// like a free voice which gets the key on that frame. The phases differ, so only compare where it sounds.
+	const uint64_t stealFrame = 10 * blockSize, fadeEnd = stealFrame + unsigned(0.005 * sampleRate);
+	DynamicToneSum stolen(Sines1(), ADSREnvelope(), notes, 1), free(Sines1(), ADSREnvelope(), notes, 1);
+	std::vector<float> blockA(2 * blockSize), blockB(2 * blockSize);
+	unsigned silentFrames = 0;
+	press(stolen, 10);
+	for (uint64_t frame = 0; frame <= fadeEnd; frame += blockSize) {
+		if (frame == stealFrame) press(stolen, 30);
+		stolen.renderStereoBlock(blockA.data(), blockSize, frame);
+		if (fadeEnd < frame + blockSize) {
+			// The block is split at the key, the way the stream does it for scheduled events
+			const std::size_t split = std::size_t(fadeEnd - frame);
+			free.renderStereoBlock(blockB.data(), split, frame);
+			free.playKeyEvent(30, SynthKey::State::Pressed, fadeEnd);
+			free.renderStereoBlock(blockB.data() + 2 * split, blockSize - split, fadeEnd);
+			for (std::size_t j = 2 * split; j < 2 * blockSize; ++j)
+				silentFrames += (blockA[j] == 0.f) != (blockB[j] == 0.f);
+		}
+		else {
+			free.renderStereoBlock(blockB.data(), blockSize, frame);
+		}
+	}
+
+	const bool passed = retriggerError == 0. && stealError == 0. && silentFrames == 0;
+	std::cout << "Voice stealing test " << (passed ? "passed" : "FAILED")
+		<< " (retrigger difference: " << retriggerError << ", stolen key difference: " << stealError
+		<< ", frames the new key is late or early: " << silentFrames << ")\n";
+}
+
+void testKeyEventQueue()
+{
+	// More events than the queue holds: the last state of every key still arrives, after the
+	// events queued before, and the queue is used again once the audio thread has caught up
+	std::cout << "Running key event queue test ...\n";
+	KeyEventQueue<16> queue(8);
+	std::vector<std::pair<unsigned, bool>> applied;
+	unsigned releasedAll = 0;
+	const auto apply = [&]() {
+		queue.apply([&](unsigned key, bool pressed) { applied.push_back({ key, pressed }); }, [&]() { ++releasedAll; });
+	};
+
+	queue.push(7, true);
+	for (unsigned i = 0; i < 100; ++i)
+		queue.push(3, i % 2 == 0);
+	queue.push(5, true);
+	apply();
+	bool passed = applied.size() == 18 && applied.front() == std::make_pair(7u, true);
+	passed &= applied[16] == std::make_pair(3u, false) && applied[17] == std::make_pair(5u, true);
+	passed &= queue.getMerged() == 86;
+
+	applied.clear();
+	queue.releaseAll();
+	queue.push(2, true);
+	apply();
+	passed &= releasedAll == 1 && applied.size() == 1 && applied.front() == std::make_pair(2u, true);
+
+	// Merged while full, a release of every key is a release of each of them
+	applied.clear();
+	for (unsigned i = 0; i < 16; ++i)
+		queue.push(1, true);
+	queue.releaseAll();
+	apply();
+	passed &= releasedAll == 1 && applied.size() == 16 + 8 && std::all_of(applied.begin() + 16, applied.end(), [](const auto& event) {
+		return !event.second;
+	});
+
+	std::cout << "Key event queue test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testMidiFile()
+{
+	// Type 1 file, 480 ticks per quarter. The first track holds the tempo map:
+	// 120 bpm, then 60 bpm from the second beat. The second track plays a note on every beat
+	// with running status, note-ons of velocity 0 release the notes.
+	const std::vector<uint8_t> file{
+		'M','T','h','d', 0,0,0,6, 0,1, 0,2, 0x01,0xe0,
+		'M','T','r','k', 0,0,0,19,
+		0x00, 0xff,0x51,0x03, 0x07,0xa1,0x20,
+		0x87,0x40, 0xff,0x51,0x03, 0x0f,0x42,0x40,
+		0x00, 0xff,0x2f,0x00,
+		'M','T','r','k', 0,0,0,31,
+		0x00, 0x91,60,100,
+		0x83,0x60, 60,0,
+		0x00, 64,90,
+		0x83,0x60, 64,0,
+		0x00, 0xc1,5,
+		0x00, 0x91,67,80,
+		0x83,0x60, 0x81,67,64,
+		0x00, 0xff,0x2f,0x00,
+	};
+	const TempFile midiFile("TestMidiFile.mid");
+	const std::string& path = midiFile.path;
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+
+	std::cout << "Running MIDI file test ...\n";
+	const Score expected{
+		{ 0., 1, 60, 100 }, { .5, 1, 60, 0 }, { .5, 1, 64, 90 },
+		{ 1., 1, 64, 0 }, { 1., 1, 67, 80 }, { 2., 1, 67, 0 },
+	};
+	const Score score = readMidiFile(path);
+	const bool passed = score.size() == expected.size() && std::equal(score.begin(), score.end(), expected.begin(),
+		[](const NoteEvent& a, const NoteEvent& b) {
+			return std::abs(a.time - b.time) < 1e-9 && a.channel == b.channel && a.note == b.note && a.velocity == b.velocity;
+		});
+	std::cout << "MIDI file test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testStreamStats()
+{
+	// Four callbacks of a 10 ms buffer: two within the deadline, one overrun and one xrun
+	StreamStats stats;
+	stats.record({ .001, .01, .02, false, false, false, false, true });
+	stats.record({ .005, .01, .03, false, false, false, false, false });
+	stats.record({ .025, .01, .025, true, false, false, false, false });
+	stats.record({ .0099, .01, -1., true, false, true, false, false });
+
+	std::cout << "Running stream stats test ...\n";
+	const auto s = stats.snapshot();
+	const std::array<uint64_t, StreamStats::histogramSize> histogram{ 0,1,0,0,0,1,0,0,0,1,0,0,1 };
+	const bool passed = s.callbacks == 4 && s.overruns == 1 && s.outputUnderflows == 2 && s.inputUnderflows == 1
+		&& s.primingOutputs == 1 && std::abs(s.maxLoad - 2.5) < 1e-9 && std::abs(s.meanLoad - (.1 + .5 + 2.5 + .99) / 4) < 1e-9
+		&& s.minLatency == .02 && s.maxLatency == .03 && s.lastLatency == .025 && s.loadHistogram == histogram;
+	std::cout << "Stream stats test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testEffectGraph()
+{
+	// Two branches from the input: a doubling then an offset on one side, tripling on the other
+	EffectGraph graph;
+	auto node = [](float mul, float add) {
+		return [mul, add](float* block, std::size_t frames, uint64_t) {
+			for (std::size_t i = 0; i < 2 * frames; ++i) block[i] = block[i] * mul + add;
+		};
+	};
+	const auto doubled = graph.addNode("Double", node(2.f, 0.f));
+	const auto offset = graph.addNode("Offset", node(1.f, 1.f), { doubled });
+	const auto tripled = graph.addNode("Triple", node(3.f, 0.f));
+	graph.setOutputs({ offset, tripled });
+
+	std::cout << "Running effect graph test ...\n";
+	auto output = [&graph](unsigned threads) {
+		RenderPool::instance().setThreadCount(threads);
+		std::vector<float> block(2 * 512, 1.f);
+		graph.process(block.data(), 512, 0);
+		RenderPool::instance().setThreadCount(0);
+		return std::all_of(block.begin(), block.end(), [&](float s) { return s == block[0]; }) ? block[0] : -1.f;
+	};
+	const float all = output(0), parallel = output(2);
+	graph.setBypassed(doubled, true);
+	const float withoutDouble = output(0);
+	graph.setBypassed(offset, true);
+	graph.setBypassed(tripled, true);
+	const float dry = output(0);
+	bool cycleRefused = false;
+	try {
+		graph.connect(offset, doubled);
+	}
+	catch (const std::logic_error&) {
+		cycleRefused = true;
+	}
+	graph.setBypassed(doubled, false);
+	graph.setBypassed(offset, false);
+	graph.setBypassed(tripled, false);
+	const float afterCycle = output(0);
+
+	const bool passed = all == 6.f && parallel == 6.f && withoutDouble == 5.f && dry == 2.f && cycleRefused && afterCycle == 6.f;
+	std::cout << "Effect graph test " << (passed ? "passed" : "FAILED") << " (outputs: " << all << ", " << parallel
+		<< ", " << withoutDouble << ", " << dry << ", " << afterCycle << ")\n";
+}
+
+void testDelayEffect()
+{
+	// An impulse through a 10 ms delay at 1 kHz, rendered in uneven blocks
+	auto echoes = [](DelayEffect::Mode mode) {
+		auto delay = DelayEffect(1000, .01, .5, mode);
+		std::vector<float> block(2 * 40, 0.f);
+		block[0] = block[1] = 1.f;
+		delay.processBlock(block.data(), 7, 0);
+		delay.processBlock(block.data() + 14, 33, 7);
+		return block;
+	};
+	auto matches = [](const std::vector<float>& block, const std::vector<std::pair<float, float>>& expected) {
+		for (std::size_t i = 0; i < 40; ++i) {
+			const auto want = i % 10 ? std::pair(0.f, 0.f) : expected[i / 10];
+			if (std::abs(block[2 * i] - want.first) > 1e-6 || std::abs(block[2 * i + 1] - want.second) > 1e-6) return false;
+		}
+		return true;
+	};
+
+	std::cout << "Running delay effect test ...\n";
+	const bool stereo = matches(echoes(DelayEffect::Mode::Stereo), { {1.f, 1.f}, {.5f, .5f}, {.25f, .25f}, {.125f, .125f} });
+	const bool pingPong = matches(echoes(DelayEffect::Mode::PingPong), { {1.f, 1.f}, {.5f, 0.f}, {0.f, .25f}, {.125f, 0.f} });
+	std::cout << "Delay effect test " << (stereo && pingPong ? "passed" : "FAILED") << "\n";
+}
+
+void testWavWriter()
+{
+	// The file has to be readable after every header update, not only once it is closed
+	std::cout << "Running WAV writer test ...\n";
+	auto write = [](const std::string& path, WavWriter::Format format, auto&& afterUpdate) {
+		WavWriter writer(path, 44100, 2, format);
+		std::vector<float> block(2 * 441);
+		for (unsigned b = 0; b < 150; ++b) {
+			for (unsigned i = 0; i < 441; ++i)
+				block[2 * i] = -(block[2 * i + 1] = float(std::sin((b * 441 + i) * .01) / 2));
+			writer.write(block.data(), 441);
+			if (b == 99) {
+				writer.updateHeader();
+				afterUpdate();
+			}
+		}
+	};
+
+	bool passed = true;
+	const TempFile file("TestWavWriter.wav"), file16("TestWavWriter16.wav"), floatFile("TestWavWriterFloat.wav");
+	const std::string& path = file.path;
+	write(path, WavWriter::Format::Pcm24, [&]() {
+		AudioFile<float> partial;
+		passed &= partial.load(path) && partial.getNumSamplesPerChannel() == 44100;
+	});
+	AudioFile<float> whole;
+	passed &= whole.load(path) && whole.getNumSamplesPerChannel() == 66150 && whole.getNumChannels() == 2
+		&& std::abs(whole.samples[1][1000] - float(std::sin(10.) / 2)) < 1e-6f && whole.samples[0][1000] == -whole.samples[1][1000];
+	write(file16.path, WavWriter::Format::Pcm16, []() {});
+	AudioFile<float> whole16;
+	passed &= whole16.load(file16.path) && whole16.getBitDepth() == 16 && whole16.getNumSamplesPerChannel() == 66150
+		&& std::abs(whole16.samples[1][1000] - float(std::sin(10.) / 2)) < 1e-4f;
+
+	// AudioFile only reads PCM, the sizes in the header are checked directly
+	auto riffSize = [](const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		uint8_t bytes[8]{};
+		file.read(reinterpret_cast<char*>(bytes), 8);
+		return bytes[4] | bytes[5] << 8 | bytes[6] << 16 | uint32_t(bytes[7]) << 24;
+	};
+	const std::string& floatPath = floatFile.path;
+	write(floatPath, WavWriter::Format::Float32, [&]() {
+		passed &= riffSize(floatPath) == 58 - 8 + 44100 * 8;
+	});
+	passed &= riffSize(floatPath) == 58 - 8 + 66150 * 8;
+	std::cout << "WAV writer test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testAudioFileReader()
+{
+	// Ranges are decoded without loading the file, into the same samples AudioFile::load gives
+	std::cout << "Running audio file reader test ...\n";
+	const unsigned frames = 10000;
+	auto sample = [](unsigned frame, unsigned channel) { return float(std::sin(frame * .01 + channel) / 2); };
+	bool passed = true;
+
+	const TempFile floatFile("TestReaderFloat.wav"), aiffFile("TestReader.aif");
+	const std::string& floatPath = floatFile.path;
+	{
+		WavWriter writer(floatPath, 48000, 3, WavWriter::Format::Float32);
+		std::vector<float> samples(3 * frames);
+		for (unsigned i = 0; i < samples.size(); ++i) samples[i] = sample(i / 3, i % 3);
+		writer.write(samples.data(), frames);
+	}
+	AudioFileReader reader;
+	std::vector<float> block(3 * 1000);
+	passed &= reader.open(floatPath) && reader.isFloatingPoint() && reader.getNumChannels() == 3
+		&& reader.getNumFrames() == frames && reader.getSampleRate() == 48000;
+	passed &= reader.read(9500, 1000, block.data()) == 500 && block[3 * 499 + 2] == sample(9999, 2);
+	reader.seek(4000);
+	passed &= reader.readNext(1000, block.data()) == 1000 && block[0] == sample(4000, 0) && reader.tell() == 5000;
+
+	const std::string& aiffPath = aiffFile.path;
+	AudioFile<float> saved;
+	AudioFile<float>::AudioBuffer buffer(2, std::vector<float>(frames));
+	for (unsigned c = 0; c < 2; ++c)
+		for (unsigned i = 0; i < frames; ++i) buffer[c][i] = sample(i, c);
+	saved.setAudioBuffer(buffer);
+	saved.setBitDepth(24);
+	saved.save(aiffPath, AudioFileFormat::Aiff);
+	AudioFile<float> loaded;
+	std::vector<std::vector<float>> channels;
+	passed &= loaded.load(aiffPath) && reader.open(aiffPath) && reader.getFormat() == AudioFileFormat::Aiff
+		&& reader.readChannels(2000, 3000, channels) == 3000 && channels.size() == 2
+		&& std::equal(channels[1].begin(), channels[1].end(), loaded.samples[1].begin() + 2000);
+	std::cout << "Audio file reader test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testSampler()
+{
+	// A sample much longer than its head plays through, from the prefetched ring
+	std::cout << "Running sampler test ...\n";
+	const unsigned sampleRate = 8000, frames = 3 * sampleRate;
+	auto sample = [](unsigned frame) { return float(std::sin(frame * .01) / 2); };
+	const TempFile file("TestSampler_60.wav");
+	const std::string& path = file.path;
+	{
+		WavWriter writer(path, sampleRate, 2, WavWriter::Format::Float32);
+		std::vector<float> samples(2 * frames);
+		for (unsigned i = 0; i < frames; ++i) samples[2 * i + 1] = -(samples[2 * i] = sample(i));
+		writer.write(samples.data(), frames);
+	}
+
+	timing::setSampleRate(sampleRate);
+	Sampler sampler({ { path, 60, 60, 60 } }, ADSREnvelope(0., 0., 1., 0.), 60, 1, 1, .05);
+	sampler.onKeyEvent(0, SynthKey::State::Pressed);
+	const std::size_t blockSize = 64;
+	std::vector<float> block(2 * blockSize);
+	bool matches = true;
+	for (uint64_t frame = 0; frame < frames; frame += blockSize) {
+		sampler.renderStereoBlock(block.data(), blockSize, frame);
+		for (std::size_t j = 0; j < blockSize && frame + j < frames; ++j) {
+			const float expected = sample(unsigned(frame + j)) * Sampler::voiceGain;
+			matches &= std::abs(block[2 * j] - expected) < 1e-6f && std::abs(block[2 * j + 1] + expected) < 1e-6f;
+		}
+		sampler.prefetchNow();
+	}
+	const auto stats = sampler.getStats();
+	const bool passed = matches && stats.underruns == 0 && stats.cacheHits == (frames + blockSize - 1) / blockSize
+		&& stats.memory < 2 * frames * sizeof(float);
+	std::cout << "Sampler test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testTripleBuffer()
+{
+	// The reader never sees a half written value and the values it sees only get newer
+	std::cout << "Running triple buffer test ...\n";
+	TripleBuffer<std::array<uint64_t, 64>> buffer;
+	const uint64_t count = 200000;
+	std::thread writer([&]() {
+		for (uint64_t i = 1; i <= count; ++i) {
+			buffer.back().fill(i);
+			buffer.publish();
+		}
+	});
+	bool passed = true;
+	uint64_t last = 0;
+	while (last < count) {
+		if (!buffer.update()) continue;
+		const auto& value = buffer.front();
+		passed &= value.front() > last && std::all_of(value.begin(), value.end(), [&](uint64_t v) { return v == value.front(); });
+		last = value.front();
+	}
+	writer.join();
+	passed &= !buffer.update();
+	std::cout << "Triple buffer test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testMidiTiming()
+{
+	// A note played between two pieces of a block sounds from its frame on, not from the block start
+	std::cout << "Running MIDI timing test ...\n";
+	const unsigned sampleRate = 44100;
+	const std::size_t blockSize = 512, noteFrame = 1000;
+	timing::setSampleRate(sampleRate);
+
+	bool passed = midiMessage(0x90, 60, 100).isNoteOn() && midiMessage(0x90, 60, 0).isNoteOff() && midiMessage(0x81, 60, 64).isNoteOff()
+		&& !midiMessage(0xB0, 60, 100).isNoteOn() && midiMessage(0x93, 60, 1).channel() == 3;
+
+	DynamicToneSum generator(Sines1(), ADSREnvelope(), generateNotes(2, 6), 4);
+	std::vector<float> out(2 * 4 * blockSize);
+	generator.renderStereoBlock(out.data(), blockSize, 0);
+	generator.renderStereoBlock(out.data() + 2 * blockSize, noteFrame - blockSize, blockSize);
+	generator.playKeyEvent(12, SynthKey::State::Pressed, noteFrame);
+	generator.playKeyEvent(1000, SynthKey::State::Pressed, noteFrame); // ignored
+	generator.renderStereoBlock(out.data() + 2 * noteFrame, 2 * blockSize - noteFrame, noteFrame);
+	generator.renderStereoBlock(out.data() + 4 * blockSize, 2 * blockSize, 2 * blockSize);
+
+	const auto firstSound = std::find_if(out.begin(), out.end(), [](float v) { return v != 0.f; }) - out.begin();
+	passed &= std::size_t(firstSound) / 2 >= noteFrame && std::size_t(firstSound) / 2 <= noteFrame + 2;
+	std::cout << "MIDI timing test " << (passed ? "passed" : "FAILED") << " (first sound at frame " << firstSound / 2 << ")\n";
+}
+
+void testMidiRouter()
+{
+	// A split and a layer on channel 1 and an instrument of its own on channel 2
+	std::cout << "Running MIDI router test ...\n";
+	std::vector<std::string> played;
+	const auto target = [&played](std::string name) {
+		return [&played, name](unsigned key, SynthKey::State keyState, uint64_t frame) {
+			played.push_back(name + (keyState == SynthKey::State::Pressed ? "+" : "-") + std::to_string(key) + "@" + std::to_string(frame));
+		};
+	};
+	unsigned wheels = 0;
+
+	MidiRouter router;
+	MidiRouter::Route bass, lead, pad, other;
+	bass.channel = lead.channel = pad.channel = 0;
+	bass.highNote = 59; bass.firstNote = 24;
+	lead.lowNote = 60;
+	pad.lowNote = 48; pad.firstNote = 48;
+	other.channel = 1;
+	router.addTarget("bass", target("bass"), {}, bass);
+	router.addTarget("lead", target("lead"), [&wheels](const MidiMessage&, uint64_t) { ++wheels; }, lead);
+	const unsigned padId = router.addTarget("pad", target("pad"), {}, pad);
+	router.addTarget("other", target("other"), {}, other);
+
+	router.dispatch(midiMessage(0x90, 36, 100), 1);
+	router.dispatch(midiMessage(0x90, 64, 100), 2);
+	router.dispatch(midiMessage(0x91, 64, 100), 3);
+	router.dispatch(midiMessage(0xE0, 0, 64), 4);
+	router.dispatch(midiMessage(0xE1, 0, 64), 5);
+	// The pad moves to channel 2 while its note sounds, the note-off still reaches it
+	pad.channel = 1;
+	router.setRoute(padId, pad);
+	router.dispatch(midiMessage(0x80, 64, 0), 6);
+	router.dispatch(midiMessage(0x90, 36, 0), 7);
+	router.dispatch(midiMessage(0x81, 64, 0), 8);
+
+	const std::vector<std::string> expected = {
+		"bass+12@1", "lead+16@2", "pad+16@2", "other+16@3",
+		"lead-16@6", "pad-16@6", "bass-12@7", "other-16@8"
+	};
+	bool passed = played == expected && wheels == 1;
+	try {
+		pad.highNote = 128;
+		router.setRoute(padId, pad);
+		passed = false;
+	}
+	catch (const std::invalid_argument&) {}
+
+	// An omni target plays every channel, once disabled it gets no new notes but still its note-offs
+	MidiRouter omniRouter;
+	played.clear();
+	const unsigned omniId = omniRouter.addTarget("omni", target("omni"), {}, MidiRouter::Route());
+	omniRouter.dispatch(midiMessage(0x95, 60, 100), 1);
+	omniRouter.setEnabled(omniId, false);
+	omniRouter.dispatch(midiMessage(0x90, 62, 100), 2);
+	omniRouter.dispatch(midiMessage(0x85, 60, 0), 3);
+	passed &= played == std::vector<std::string>{ "omni+12@1", "omni-12@3" };
+	std::cout << "MIDI router test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testAudioBackends()
+{
+	// The freewheel backend writes exactly the frames of the stream, the null backend keeps the pace of a device
+	std::cout << "Running audio backend test ...\n";
+	const unsigned sampleRate = 44100, bufferSize = 64;
+	const uint64_t frames = 10000;
+	const auto ramp = [](float* out, std::size_t n, uint64_t startFrame) {
+		for (std::size_t i = 0; i < n; ++i)
+			out[2 * i] = out[2 * i + 1] = float((startFrame + i) % 1000) / 1000.f;
+	};
+	const auto noInput = [](const float* in, std::size_t n, uint64_t startFrame) {};
+
+	bool passed = true;
+	uint64_t midiFrame = UINT64_MAX;
+	const TempFile file("TestFreewheel.wav");
+	{
+		auto backend = std::make_unique<FreewheelBackend>(sampleRate, bufferSize, file.path, frames);
+		auto& freewheel = *backend;
+		SynthStream stream(sampleRate, bufferSize, ramp, noInput, [&midiFrame](const MidiMessage& message, uint64_t frame) {
+			midiFrame = frame;
+		}, std::move(backend));
+		stream.getMidiQueue().push(midiMessage(0x90, 60, 100));
+		playUntilDone(stream, freewheel);
+		passed &= stream.getStats().snapshot().callbacks == (frames + bufferSize - 1) / bufferSize;
+	}
+	AudioFileReader reader;
+	std::vector<float> read(2 * frames);
+	passed &= reader.open(file.path) && reader.read(0, frames, read.data()) == frames && midiFrame == 0;
+	for (uint64_t i = 0; i < frames; ++i)
+		passed &= read[2 * i] == float(i % 1000) / 1000.f;
+
+	// The null backend is never faster than a device, it may be slower on a busy machine
+	const uint64_t nullFrames = sampleRate / 4;
+	auto nullBackend = std::make_unique<NullBackend>(sampleRate, bufferSize, nullFrames);
+	auto& null = *nullBackend;
+	SynthStream stream(sampleRate, bufferSize, ramp, noInput, {}, std::move(nullBackend));
+	const auto start = std::chrono::steady_clock::now();
+	playUntilDone(stream, null);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	stream.stop();
+	passed &= null.getFrames() == nullFrames && stream.getStats().snapshot().callbacks == (nullFrames + bufferSize - 1) / bufferSize
+		&& elapsed.count() >= double(nullFrames - bufferSize) / sampleRate;
+
+	std::cout << "Audio backend test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testEventScheduler()
+{
+	// Events come out earliest first and those of a frame in order, a scheduled call lands on its exact frame
+	std::cout << "Running event scheduler test ...\n";
+	bool passed = true;
+	EventScheduler<8> scheduler;
+	const uint64_t frames[] = { 50, 7, 50, 3, 7, 50, 0, 9 };
+	for (uint32_t i = 0; i < 8; ++i) {
+		ScheduledEvent event;
+		event.frame = frames[i];
+		event.index = i;
+		passed &= scheduler.push(event);
+	}
+	passed &= scheduler.full() && !scheduler.push(ScheduledEvent());
+	std::string order;
+	while (!scheduler.empty()) {
+		order += std::to_string(scheduler.top().index);
+		scheduler.pop();
+	}
+	passed &= order == "63147025";
+
+	const unsigned sampleRate = 44100, bufferSize = 64;
+	struct Level { float value{ 0.f }; } level;
+	const auto hold = [&level](float* out, std::size_t n, uint64_t startFrame) {
+		for (std::size_t i = 0; i < n; ++i)
+			out[2 * i] = out[2 * i + 1] = level.value;
+	};
+	const auto noInput = [](const float* in, std::size_t n, uint64_t startFrame) {};
+	const auto setLevel = [](void* target, uint32_t index, double value, uint64_t frame) {
+		static_cast<Level*>(target)->value = float(value);
+	};
+	const uint64_t eventFrames[] = { 100, 1000, 1000, 5003 };
+	const double values[] = { 1., 2., 3., 4. };
+	const TempFile file("TestScheduler.wav");
+	{
+		auto backend = std::make_unique<FreewheelBackend>(sampleRate, bufferSize, file.path, 6000);
+		auto& freewheel = *backend;
+		SynthStream stream(sampleRate, bufferSize, hold, noInput, {}, std::move(backend));
+		passed &= stream.getTransport().frameAt(Transport::now()) == 0;
+		for (int i = 0; i < 4; ++i) {
+			ScheduledEvent event;
+			event.frame = eventFrames[i];
+			event.apply = setLevel;
+			event.target = &level;
+			event.value = values[i];
+			passed &= stream.schedule(event);
+		}
+		playUntilDone(stream, freewheel);
+		passed &= stream.getTransport().getPosition().frame + stream.getTransport().getPosition().frames == 6000;
+	}
+	AudioFileReader reader;
+	std::vector<float> read(2 * 6000);
+	passed &= reader.open(file.path) && reader.read(0, 6000, read.data()) == 6000;
+	for (uint64_t i = 0; i < 6000; ++i) {
+		const float expected = i < 100 ? 0.f : i < 1000 ? 1.f : i < 5003 ? 3.f : 4.f;
+		passed &= read[2 * i] == expected;
+	}
+
+	std::cout << "Event scheduler test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testScorePlayer()
+{
+	// A score reaches the MIDI callback at the frames of its times, stress patterns are balanced and repeatable
+	std::cout << "Running score player test ...\n";
+	bool passed = true;
+	for (const auto& name : stressPatternNames()) {
+		const Score pattern = stressPattern(name, 2., 48, 71);
+		std::array<int, 128> held{};
+		for (std::size_t i = 0; i < pattern.size(); ++i) {
+			const auto& event = pattern[i];
+			passed &= event.note >= 48 && event.note <= 71 && event.time <= 2.;
+			passed &= i == 0 || pattern[i - 1].time <= event.time;
+			held[event.note] += event.velocity ? 1 : -1;
+			passed &= held[event.note] >= 0;
+		}
+		passed &= !pattern.empty() && std::all_of(held.begin(), held.end(), [](int count) { return count == 0; });
+		const Score again = stressPattern(name, 2., 48, 71);
+		passed &= again.size() == pattern.size() && std::equal(again.begin(), again.end(), pattern.begin(),
+			[](const NoteEvent& a, const NoteEvent& b) { return a.time == b.time && a.note == b.note && a.velocity == b.velocity; });
+	}
+	try {
+		stressPattern("trills", 1.);
+		passed = false;
+	}
+	catch (const std::invalid_argument&) {}
+
+	const unsigned sampleRate = 44100, bufferSize = 64;
+	const Score score{
+		{ 0., 0, 60, 100 }, { .01, 2, 64, 90 }, { .5, 0, 60, 0 }, { .5, 0, 60, 80 }, { 1., 0, 60, 0 }, { 1., 2, 64, 0 },
+	};
+	std::vector<std::pair<MidiMessage, uint64_t>> played;
+	{
+		auto backend = std::make_unique<FreewheelBackend>(sampleRate, bufferSize, "", sampleRate * 2);
+		auto& freewheel = *backend;
+		SynthStream stream(sampleRate, bufferSize, [](float* out, std::size_t n, uint64_t startFrame) {
+			std::fill(out, out + 2 * n, 0.f);
+		}, [](const float* in, std::size_t n, uint64_t startFrame) {}, [&played](const MidiMessage& message, uint64_t frame) {
+			played.push_back({ message, frame });
+		}, std::move(backend));
+		passed &= stream.isScoreDone();
+		stream.playScore(score);
+		try {
+			stream.playScore(score);
+			passed = false;
+		}
+		catch (const std::logic_error&) {}
+		playUntilDone(stream, freewheel);
+		passed &= stream.isScoreDone();
+	}
+	passed &= played.size() == score.size();
+	for (std::size_t i = 0; passed && i < score.size(); ++i) {
+		const auto& [message, frame] = played[i];
+		passed &= frame == uint64_t(std::llround(score[i].time * sampleRate)) && message.channel() == score[i].channel
+			&& message.key() == score[i].note && message.isNoteOn() == (score[i].velocity != 0);
+	}
+
+	std::cout << "Score player test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
+void testInputBlock()
+{
+	// A fed input block rendered in two pieces comes out continuous, frames past it are silent
+	std::cout << "Running input block test ...\n";
+	const std::size_t frames = 64, split = 20;
+	const uint64_t startFrame = 1000;
+	std::vector<float> in(frames);
+	for (std::size_t i = 0; i < frames; ++i)
+		in[i] = float(i + 1) / frames;
+	InputInstrument::GeneratorProxy input;
+	input.feedBlock(in.data(), frames, startFrame, .5f);
+	std::vector<float> out(frames + 8, 1.f);
+	input.renderBlock(out.data(), split, startFrame);
+	input.renderBlock(out.data() + split, frames + 8 - split, startFrame + split);
+	bool passed = true;
+	for (std::size_t i = 0; i < frames; ++i)
+		passed &= out[i] == in[i] * .5f;
+	passed &= std::all_of(out.begin() + frames, out.end(), [](float sample) { return sample == 0.f; });
+	input.renderBlock(out.data(), split, startFrame - split);
+	passed &= std::all_of(out.begin(), out.begin() + split, [](float sample) { return sample == 0.f; });
+
+	std::cout << "Input block test " << (passed ? "passed" : "FAILED") << "\n";
+}
+
 void testGenerator()
 {
 	static KeyboardInstrument inst1(
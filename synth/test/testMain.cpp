@@ -7,6 +7,27 @@ int testMain(int argc, char** argv)
 {
 	//testGui();
 	testGenerator();
+	testOscillatorDrift();
+	testEnvelope();
+	testVoiceStealing();
+	testKeyEventQueue();
+	testMidiFile();
+	testStreamStats();
+	testEffectGraph();
+	testDelayEffect();
+	testWavWriter();
+	testAudioFileReader();
+	testSampler();
+	testTripleBuffer();
+	testMidiTiming();
+	testMidiRouter();
+	testAudioBackends();
+	testEventScheduler();
+	testScorePlayer();
+	testInputBlock();
+	benchmarkWaveforms();
+	benchmarkSliderStorm();
+	benchmarkPolyphony();
 
 	return 0;
 }
\ No newline at end of file